@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "batch.h"
+#include "byte_histo.h"
+#include "dot_plot.h"
+#include "file_source.h"
+#include "histogram_2d_view.h"
+#include "histogram_calc.h"
+#include "image_view.h"
+#include "overall_view.h"
+#include "plot_view.h"
+
+using std::min;
+
+// Output sizes and view settings, matching the defaults of the interactive views.
+static const int overview_w = 128;
+static const int overview_h = 1024;
+static const int histo_2d_thresh = 4;
+static const int histo_2d_scale = 100;
+static const int image_w = 512;
+static const int image_max_h = 4096;
+static const int dot_plot_max_n = 512;
+static const int dot_plot_width = 10000;
+
+/// process_file computes the views of filename and writes them to out, named after filename.
+/// @param [in] filename The file to analyze.
+/// @param [in] out The output directory.
+/// @return False if the file could not be read or an output could not be written.
+static bool process_file(const QString &filename, const QDir &out) {
+    FileSource src;
+    if (!src.open(filename.toStdString())) return false;
+    if (src.size() == 0) {
+        fprintf(stderr, "Skipping empty file %s\n", filename.toStdString().c_str());
+        return true;
+    }
+
+    const unsigned char *dat = src.data();
+    offset_t n = offset_t(src.size());
+
+    // A single pass feeds every accumulator while the window is still in cache.
+    OverviewAccumulator overview(overview_w, overview_h, n, true);
+    EntropyAccumulator entropy(entropy_block_size(n));
+    HistoAccumulator histo;
+    TupleHistoAccumulator histo_2d(2, u8);
+    for_each_window(dat, n, [&](const unsigned char *p, offset_t m) {
+        overview.add(p, m);
+        entropy.add(p, m);
+        histo.add(p, m);
+        histo_2d.add(p, m);
+        return true;
+    });
+
+    offset_t dd_n;
+    std::unique_ptr<float[]> dd(entropy.result(dd_n));
+    std::unique_ptr<float[]> hist(histo.result());
+
+    QString base = out.filePath(QFileInfo(filename).fileName());
+    bool rv = true;
+
+    rv &= overview.image(true).scaled(overview_w, overview_h).save(base + ".overview.png");
+    rv &= PlotView::render(dd.get(), dd_n, overview_w, overview_h).save(base + ".entropy.png");
+    rv &= Histogram2dView::render(histo_2d.hist(), histo_2d_thresh, histo_2d_scale).save(base + ".histo_2d.png");
+
+    // Only the leading rows are decoded, an image of a whole large file would not fit in memory.
+    offset_t image_n = min(n, offset_t(image_w) * image_max_h * 3);
+    const pixel_format_t &image_format = pixel_formats()[find_pixel_format("RGB 8")];
+    rv &= ImageView::decode(dat, image_n, 0, image_w, image_format).mirrored(true).save(base + ".image.png");
+
+    {
+        offset_t bs;
+        int mat_n;
+        DotPlot::layout_mat(n, dot_plot_width, dot_plot_max_n, bs, mat_n);
+        if (mat_n > 0) {
+            std::vector<int> mat(mat_n * mat_n, 0);
+            DotPlot::exact_mat(dat, bs, mat_n, mat.data(), [] { return false; });
+            rv &= DotPlot::render(mat.data(), mat_n).save(base + ".dot_plot.png");
+        }
+    }
+
+    {
+        QJsonObject obj;
+        obj["file"] = filename;
+        obj["size"] = double(n);
+        obj["entropy_block_size"] = entropy_block_size(n);
+
+        QJsonArray entropy_arr;
+        double entropy_sum = 0.;
+        for (offset_t i = 0; i < dd_n; i++) {
+            entropy_arr.append(dd[i]);
+            entropy_sum += dd[i];
+        }
+        obj["mean_entropy"] = dd_n > 0 ? entropy_sum / dd_n : 0.;
+        obj["entropy"] = entropy_arr;
+
+        QJsonArray hist_arr;
+        for (int i = 0; i < 256; i++) {
+            hist_arr.append(hist[i]);
+        }
+        obj["histogram"] = hist_arr;
+
+        QFile f(base + ".json");
+        if (f.open(QFile::WriteOnly | QFile::Truncate)) {
+            f.write(QJsonDocument(obj).toJson());
+        } else {
+            rv = false;
+        }
+    }
+
+    if (!rv) fprintf(stderr, "Unable to write all outputs for %s\n", filename.toStdString().c_str());
+
+    return rv;
+}
+
+/// run_batch computes the overview, entropy plot, 2D histogram, image view and dot plot of each file in in_dir
+/// without a display, writing them as PNG and JSON files to out_dir. Files are processed in parallel.
+/// @param [in] in_dir The directory holding the files to analyze, subdirectories are not descended into.
+/// @param [in] out_dir The directory receiving the outputs, created if needed.
+/// @param [in] jobs Number of files processed at a time.
+/// @return EXIT_SUCCESS if every file was processed, EXIT_FAILURE otherwise.
+int run_batch(const QString &in_dir, const QString &out_dir, int jobs) {
+    QDir in(in_dir);
+    if (!in.exists()) {
+        fprintf(stderr, "Input directory %s does not exist\n", in_dir.toStdString().c_str());
+        return EXIT_FAILURE;
+    }
+
+    QDir out(out_dir);
+    if (!out.mkpath(".")) {
+        fprintf(stderr, "Unable to create output directory %s\n", out_dir.toStdString().c_str());
+        return EXIT_FAILURE;
+    }
+
+    QStringList files;
+    for (const auto &j : in.entryList(QDir::Files, QDir::Name)) {
+        files.append(in.filePath(j));
+    }
+
+    std::atomic<int> next(0);
+    std::atomic<int> failed(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::max(jobs, 1); i++) {
+        threads.emplace_back([&files, &out, &next, &failed, jobs] {
+            // The jobs already keep the CPUs busy, kernels splitting a file between threads of their own would only
+            // oversubscribe them.
+            if (jobs > 1) limit_kernel_threads(1);
+
+            for (int j = next++; j < files.size(); j = next++) {
+                printf("%d/%d: %s\n", j + 1, int(files.size()), files[j].toStdString().c_str());
+                if (!process_file(files[j], out)) failed++;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    printf("Processed %d files, %d failed\n", int(files.size()), int(failed));
+
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -16,136 +16,92 @@
  *     You should have received a copy of the GNU General Public License
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
-
-#include <cstdio>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
 #include "bayer.h"
+#include "byte_histo.h"
 
 // A nice description of Bayer demosaicing is at http://www.cambridgeincolour.com/tutorials/camera-sensors.htm
-// Method 2 is based on this description
+// Method 2 is based on this description. The gradient corrected method is from Malvar, He and Cutler, "High-quality
+// linear interpolation for demosaicing of Bayer-patterned color images", ICASSP 2004.
+
+// Rows are split between threads only when each thread gets at least this many pixels.
+static const long thread_min_px = 1L << 20;
 
-//static bool debug = false;
+// The colors of the 2x2 block, in the order (0, 0), (0, 1), (1, 0), (1, 1), for each permutation. 0 is R, 1 is G0,
+// 2 is G1 and 3 is B.
+static const int all_perm[24][4] = {
+        {0, 1, 2, 3},
+        {0, 1, 3, 2},
+        {0, 2, 1, 3},
+        {0, 2, 3, 1},
+        {0, 3, 1, 2},
+        {0, 3, 2, 1},
+        {1, 0, 2, 3},
+        {1, 0, 3, 2},
+        {1, 2, 0, 3},
+        {1, 2, 3, 0},
+        {1, 3, 0, 2},
+        {1, 3, 2, 0},
+        {2, 0, 1, 3},
+        {2, 0, 3, 1},
+        {2, 1, 0, 3},
+        {2, 1, 3, 0},
+        {2, 3, 0, 1},
+        {2, 3, 1, 0},
+        {3, 0, 1, 2},
+        {3, 0, 2, 1},
+        {3, 1, 0, 2},
+        {3, 1, 2, 0},
+        {3, 2, 0, 1},
+        {3, 2, 1, 0}
+};
+
+// The rows and columns, relative to a pixel of each type, of its R, the two G averaged, and its B for the block
+// method.
+static const int block_taps[4][4][2] = {
+        {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
+        {{0, 1}, {0, 0}, {1, 1}, {1, 0}},
+        {{1, 0}, {0, 0}, {1, 1}, {0, 1}},
+        {{1, 1}, {0, 1}, {1, 0}, {0, 0}}
+};
 
 template<class T>
 T bayerEdgeHelp(const T *in, const int h, const int w, const int in_row_w, const int y, const int x, int &n) {
     if (0 <= y && y < h &&
         0 <= x && x < w) {
         n++;
-        //if(debug) printf("p,n: %d %d\n", in[y * in_row_w + x], n);
         return in[y * in_row_w + x];
     }
     return 0;
 }
 
+/// bayerBGPixel2 demosaics one pixel by the block method, with the neighbours beyond the image left out. Only the
+/// last row and column of an image need it.
 static void
-bayerBGPixel2(const unsigned char *in, const int h, const int w, const int in_row_w, const int out_row_w, int perm, const int y, const int x,
-              unsigned char *out) {
-    unsigned int r, g, b;
+bayerBGPixel2(const unsigned char *in, const int h, const int w, const int in_row_w, const int out_row_w, int perm,
+              const int y, const int x, unsigned char *out) {
+    const int (*t)[2] = block_taps[all_perm[perm][(y % 2) * 2 + (x % 2)]];
     int n;
 
-    int all_perm[24][4] = {
-            {0, 1, 2, 3},
-            {0, 1, 3, 2},
-            {0, 2, 1, 3},
-            {0, 2, 3, 1},
-            {0, 3, 1, 2},
-            {0, 3, 2, 1},
-            {1, 0, 2, 3},
-            {1, 0, 3, 2},
-            {1, 2, 0, 3},
-            {1, 2, 3, 0},
-            {1, 3, 0, 2},
-            {1, 3, 2, 0},
-            {2, 0, 1, 3},
-            {2, 0, 3, 1},
-            {2, 1, 0, 3},
-            {2, 1, 3, 0},
-            {2, 3, 0, 1},
-            {2, 3, 1, 0},
-            {3, 0, 1, 2},
-            {3, 0, 2, 1},
-            {3, 1, 0, 2},
-            {3, 1, 2, 0},
-            {3, 2, 0, 1},
-            {3, 2, 1, 0}
-    };
+    n = 0;
+    unsigned int r = bayerEdgeHelp(in, h, w, in_row_w, y + t[0][0], x + t[0][1], n);
 
-    if (perm < 0 || 24 <= perm) abort();
-
-    int type = 0; // current pixel is R if 0, G0 if 1, G1 if 2, B if 3
-    if ((y % 2) == 0 && (x % 2) == 0) {
-        type = all_perm[perm][0];
-    } else if ((y % 2) == 0 && (x % 2) == 1) {
-        type = all_perm[perm][1];
-    } else if ((y % 2) == 1 && (x % 2) == 0) {
-        type = all_perm[perm][2];
-    } else {
-        type = all_perm[perm][3];
-    }
+    n = 0;
+    unsigned int g = (bayerEdgeHelp(in, h, w, in_row_w, y + t[1][0], x + t[1][1], n) +
+                      bayerEdgeHelp(in, h, w, in_row_w, y + t[2][0], x + t[2][1], n));
+    if (n > 1) g /= n;
 
-    bool debug = false;
-
-    if (debug) printf("x,y,v: %d %d %d\n", x, y, in[y * in_row_w + x]);
-    if (debug) printf("type: %d\n", type);
-
-    if (type == 0) {
-        n = 0;
-        r = bayerEdgeHelp(in, h, w, in_row_w, y, x, n);
-        if (debug) printf("r,n=: %d %d\n", r, n);
-
-        n = 0;
-        g = (bayerEdgeHelp(in, h, w, in_row_w, y, x + 1, n) +
-             bayerEdgeHelp(in, h, w, in_row_w, y + 1, x, n));
-        if (n > 1) g /= n;
-        if (debug) printf("g,n=: %d %d\n", g, n);
-
-        n = 0;
-        b = bayerEdgeHelp(in, h, w, in_row_w, y + 1, x + 1, n);
-        if (debug) printf("b,n=: %d %d\n", b, n);
-    } else if (type == 1) {
-        n = 0;
-        r = bayerEdgeHelp(in, h, w, in_row_w, y, x + 1, n);
-        if (debug) printf("r,n=: %d %d\n", r, n);
-
-        n = 0;
-        g = (bayerEdgeHelp(in, h, w, in_row_w, y, x, n) +
-             bayerEdgeHelp(in, h, w, in_row_w, y + 1, x + 1, n));
-        if (n > 1) g /= n;
-        if (debug) printf("g,n=: %d %d\n", g, n);
-
-        n = 0;
-        b = bayerEdgeHelp(in, h, w, in_row_w, y + 1, x, n);
-        if (debug) printf("b,n=: %d %d\n", b, n);
-    } else if (type == 2) {
-        n = 0;
-        r = bayerEdgeHelp(in, h, w, in_row_w, y + 1, x, n);
-        if (debug) printf("r,n=: %d %d\n", r, n);
-
-        n = 0;
-        g = (bayerEdgeHelp(in, h, w, in_row_w, y, x, n) +
-             bayerEdgeHelp(in, h, w, in_row_w, y + 1, x + 1, n));
-        if (n > 1) g /= n;
-        if (debug) printf("g,n=: %d %d\n", g, n);
-
-        n = 0;
-        b = bayerEdgeHelp(in, h, w, in_row_w, y, x + 1, n);
-        if (debug) printf("b,n=: %d %d\n", b, n);
-    } else {
-        n = 0;
-        r = bayerEdgeHelp(in, h, w, in_row_w, y + 1, x + 1, n);
-        if (debug) printf("r,n=: %d %d\n", r, n);
-
-        n = 0;
-        g = (bayerEdgeHelp(in, h, w, in_row_w, y, x + 1, n) +
-             bayerEdgeHelp(in, h, w, in_row_w, y + 1, x, n));
-        if (n > 0) g /= n;
-        if (debug) printf("g,n=: %d %d\n", g, n);
-
-        n = 0;
-        b = bayerEdgeHelp(in, h, w, in_row_w, y, x, n);
-        if (debug) printf("b,n=: %d %d\n", b, n);
-    }
+    n = 0;
+    unsigned int b = bayerEdgeHelp(in, h, w, in_row_w, y + t[3][0], x + t[3][1], n);
 
     // The R and B values are exchanged, and does not makes sense
     out[y * out_row_w + x * 3 + 0] = r;
@@ -153,14 +109,331 @@ bayerBGPixel2(const unsigned char *in, const int h, const int w, const int in_ro
     out[y * out_row_w + x * 3 + 2] = b;
 }
 
-void bayerBG(const unsigned char *bayer, const int h, const int w, const int bayer_row_w, int perm, unsigned char *rgb, const int rgb_row_w) {
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            bayerBGPixel2(bayer, h, w, bayer_row_w, rgb_row_w, perm, y, x, rgb);
+/// block_rows demosaics rows [y0, y1) by the block method. Pixels with a neighbour below or to the right of them in
+/// the image take their colors from pointers chosen once per row, the rest from bayerBGPixel2.
+static void block_rows(const unsigned char *in, int h, int w, int in_row_w, int perm, unsigned char *out,
+                       int out_row_w, int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+        unsigned char *o = out + long(y) * out_row_w;
+        int interior = y + 1 < h ? w - 1 : 0;
+
+        // For the even and the odd columns, the R, the two G and the B of the pixel at column x are at [x].
+        const unsigned char *src[2][4];
+        for (int px = 0; px < 2; px++) {
+            const int (*t)[2] = block_taps[all_perm[perm][(y % 2) * 2 + px]];
+            for (int c = 0; c < 4; c++) src[px][c] = in + long(y + t[c][0]) * in_row_w + t[c][1];
+        }
+
+        int x = 0;
+        for (; x + 1 < interior; x += 2) {
+            o[x * 3 + 0] = src[0][0][x];
+            o[x * 3 + 1] = (src[0][1][x] + src[0][2][x]) / 2;
+            o[x * 3 + 2] = src[0][3][x];
+            o[x * 3 + 3] = src[1][0][x + 1];
+            o[x * 3 + 4] = (src[1][1][x + 1] + src[1][2][x + 1]) / 2;
+            o[x * 3 + 5] = src[1][3][x + 1];
+        }
+        for (; x < interior; x++) {
+            const unsigned char *const *s = src[x % 2];
+            o[x * 3 + 0] = s[0][x];
+            o[x * 3 + 1] = (s[1][x] + s[2][x]) / 2;
+            o[x * 3 + 2] = s[3][x];
+        }
+        for (; x < w; x++) {
+            bayerBGPixel2(in, h, w, in_row_w, out_row_w, perm, y, x, out);
         }
     }
 }
 
-void bayerBG(const unsigned char *bayer, const int h, const int w, int perm, unsigned char *rgb) {
-    bayerBG(bayer, h, w, w, perm, rgb, w * 3);
+// The estimates of a color missing at a pixel, by where the pixels of that color are around it: the left and right
+// neighbours, the ones above and below, the diagonal ones, or all four of left, right, above and below.
+enum {
+    est_h, est_v, est_x, est_c, est_n
+};
+
+/// est_scalar computes the estimates of columns [x, w) of a row, from the rows two above to two below it. Each row is
+/// readable two columns before its start and two beyond its end.
+/// @param [in] p The rows, the one of the pixels at p[2].
+/// @param [in] w Width of the rows.
+/// @param [in] method The demosaic method, bayer_bilinear or bayer_mhc.
+/// @param [in] x The first column to compute.
+/// @param [out] est The estimates, est_n rows of w.
+static void est_scalar(const unsigned char *const *p, int w, bayer_method_t method, int x, unsigned char *const *est) {
+    const unsigned char *n2 = p[0], *n1 = p[1], *c0 = p[2], *s1 = p[3], *s2 = p[4];
+
+    for (; x < w; x++) {
+        int c = c0[x];
+        int we = c0[x - 1] + c0[x + 1];
+        int ns = n1[x] + s1[x];
+        int we2 = c0[x - 2] + c0[x + 2];
+        int ns2 = n2[x] + s2[x];
+        int d = n1[x - 1] + n1[x + 1] + s1[x - 1] + s1[x + 1];
+
+        if (method == bayer_bilinear) {
+            est[est_h][x] = (we + 1) >> 1;
+            est[est_v][x] = (ns + 1) >> 1;
+            est[est_x][x] = (d + 2) >> 2;
+            est[est_c][x] = (we + ns + 2) >> 2;
+        } else {
+            // The kernels of the paper, doubled to keep the halves whole, sum to 16
+            int v[est_n] = {
+                    10 * c + 8 * we - 2 * we2 - 2 * d + ns2,
+                    10 * c + 8 * ns - 2 * ns2 - 2 * d + we2,
+                    12 * c + 4 * d - 3 * (we2 + ns2),
+                    8 * c + 4 * (we + ns) - 2 * (we2 + ns2)
+            };
+            for (int k = 0; k < est_n; k++) {
+                est[k][x] = (unsigned char) std::min(255, std::max(0, v[k] + 8) >> 4);
+            }
+        }
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BAYER_DISPATCH
+
+__attribute__((target("sse2")))
+static inline __m128i load8_sse2(const unsigned char *s) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) s), _mm_setzero_si128());
+}
+
+/// est_sse2 computes the estimates of 8 columns per step, in 16 bit lanes, stopping where a load would read beyond
+/// the padding of the rows.
+/// @return The number of columns computed.
+__attribute__((target("sse2")))
+static int est_sse2(const unsigned char *const *p, int w, bayer_method_t method, unsigned char *const *est) {
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i c = load8_sse2(p[2] + x);
+        __m128i we = _mm_add_epi16(load8_sse2(p[2] + x - 1), load8_sse2(p[2] + x + 1));
+        __m128i ns = _mm_add_epi16(load8_sse2(p[1] + x), load8_sse2(p[3] + x));
+        __m128i we2 = _mm_add_epi16(load8_sse2(p[2] + x - 2), load8_sse2(p[2] + x + 2));
+        __m128i ns2 = _mm_add_epi16(load8_sse2(p[0] + x), load8_sse2(p[4] + x));
+        __m128i d = _mm_add_epi16(_mm_add_epi16(load8_sse2(p[1] + x - 1), load8_sse2(p[1] + x + 1)),
+                                  _mm_add_epi16(load8_sse2(p[3] + x - 1), load8_sse2(p[3] + x + 1)));
+
+        __m128i v[est_n];
+        if (method == bayer_bilinear) {
+            v[est_h] = _mm_srli_epi16(_mm_add_epi16(we, _mm_set1_epi16(1)), 1);
+            v[est_v] = _mm_srli_epi16(_mm_add_epi16(ns, _mm_set1_epi16(1)), 1);
+            v[est_x] = _mm_srli_epi16(_mm_add_epi16(d, _mm_set1_epi16(2)), 2);
+            v[est_c] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(we, ns), _mm_set1_epi16(2)), 2);
+        } else {
+            __m128i d2 = _mm_add_epi16(d, d);
+            __m128i c8 = _mm_slli_epi16(c, 3);
+            v[est_h] = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(c8, _mm_add_epi16(c, c)),
+                                                                 _mm_slli_epi16(we, 3)), ns2),
+                                     _mm_add_epi16(_mm_add_epi16(we2, we2), d2));
+            v[est_v] = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(c8, _mm_add_epi16(c, c)),
+                                                                 _mm_slli_epi16(ns, 3)), we2),
+                                     _mm_add_epi16(_mm_add_epi16(ns2, ns2), d2));
+            __m128i a2 = _mm_add_epi16(we2, ns2);
+            v[est_x] = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(c8, _mm_slli_epi16(c, 2)), _mm_slli_epi16(d, 2)),
+                                     _mm_add_epi16(_mm_add_epi16(a2, a2), a2));
+            v[est_c] = _mm_sub_epi16(_mm_add_epi16(c8, _mm_slli_epi16(_mm_add_epi16(we, ns), 2)),
+                                     _mm_add_epi16(a2, a2));
+            for (int k = 0; k < est_n; k++) {
+                v[k] = _mm_srai_epi16(_mm_add_epi16(v[k], _mm_set1_epi16(8)), 4);
+            }
+        }
+        for (int k = 0; k < est_n; k++) {
+            _mm_storel_epi64((__m128i *) (est[k] + x), _mm_packus_epi16(v[k], v[k]));
+        }
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load16_avx2(const unsigned char *s) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) s));
+}
+
+/// est_avx2 computes the estimates of 16 columns per step, as est_sse2.
+/// @return The number of columns computed.
+__attribute__((target("avx2")))
+static int est_avx2(const unsigned char *const *p, int w, bayer_method_t method, unsigned char *const *est) {
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m256i c = load16_avx2(p[2] + x);
+        __m256i we = _mm256_add_epi16(load16_avx2(p[2] + x - 1), load16_avx2(p[2] + x + 1));
+        __m256i ns = _mm256_add_epi16(load16_avx2(p[1] + x), load16_avx2(p[3] + x));
+        __m256i we2 = _mm256_add_epi16(load16_avx2(p[2] + x - 2), load16_avx2(p[2] + x + 2));
+        __m256i ns2 = _mm256_add_epi16(load16_avx2(p[0] + x), load16_avx2(p[4] + x));
+        __m256i d = _mm256_add_epi16(_mm256_add_epi16(load16_avx2(p[1] + x - 1), load16_avx2(p[1] + x + 1)),
+                                     _mm256_add_epi16(load16_avx2(p[3] + x - 1), load16_avx2(p[3] + x + 1)));
+
+        __m256i v[est_n];
+        if (method == bayer_bilinear) {
+            v[est_h] = _mm256_srli_epi16(_mm256_add_epi16(we, _mm256_set1_epi16(1)), 1);
+            v[est_v] = _mm256_srli_epi16(_mm256_add_epi16(ns, _mm256_set1_epi16(1)), 1);
+            v[est_x] = _mm256_srli_epi16(_mm256_add_epi16(d, _mm256_set1_epi16(2)), 2);
+            v[est_c] = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(we, ns), _mm256_set1_epi16(2)), 2);
+        } else {
+            __m256i d2 = _mm256_add_epi16(d, d);
+            __m256i c8 = _mm256_slli_epi16(c, 3);
+            v[est_h] = _mm256_sub_epi16(
+                    _mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(c8, _mm256_add_epi16(c, c)),
+                                                      _mm256_slli_epi16(we, 3)), ns2),
+                    _mm256_add_epi16(_mm256_add_epi16(we2, we2), d2));
+            v[est_v] = _mm256_sub_epi16(
+                    _mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(c8, _mm256_add_epi16(c, c)),
+                                                      _mm256_slli_epi16(ns, 3)), we2),
+                    _mm256_add_epi16(_mm256_add_epi16(ns2, ns2), d2));
+            __m256i a2 = _mm256_add_epi16(we2, ns2);
+            v[est_x] = _mm256_sub_epi16(
+                    _mm256_add_epi16(_mm256_add_epi16(c8, _mm256_slli_epi16(c, 2)), _mm256_slli_epi16(d, 2)),
+                    _mm256_add_epi16(_mm256_add_epi16(a2, a2), a2));
+            v[est_c] = _mm256_sub_epi16(_mm256_add_epi16(c8, _mm256_slli_epi16(_mm256_add_epi16(we, ns), 2)),
+                                        _mm256_add_epi16(a2, a2));
+            for (int k = 0; k < est_n; k++) {
+                v[k] = _mm256_srai_epi16(_mm256_add_epi16(v[k], _mm256_set1_epi16(8)), 4);
+            }
+        }
+        for (int k = 0; k < est_n; k++) {
+            // The packed columns are in the low 8 bytes of each lane
+            __m256i u = _mm256_permute4x64_epi64(_mm256_packus_epi16(v[k], v[k]), 0x08);
+            _mm_storeu_si128((__m128i *) (est[k] + x), _mm256_castsi256_si128(u));
+        }
+    }
+    return x;
+}
+#endif
+
+typedef int (*est_fn_t)(const unsigned char *const *p, int w, bayer_method_t method, unsigned char *const *est);
+
+/// select_est picks the estimate kernel for the instruction sets of the CPU running the program, null if there is
+/// none.
+static est_fn_t select_est() {
+#ifdef BAYER_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return est_avx2;
+    if (__builtin_cpu_supports("sse2")) return est_sse2;
+#endif
+    return nullptr;
+}
+
+/// reflect maps a row or column beyond [0, n) back into it, mirrored about the first or last one so that it keeps
+/// its parity, and so its color. n must be at least 3.
+static int reflect(int i, int n) {
+    if (i < 0) return -i;
+    if (i >= n) return 2 * (n - 1) - i;
+    return i;
+}
+
+/// interp_rows demosaics rows [y0, y1) by interpolation. The five rows around each row are copied once, with two
+/// mirrored columns on either side, so that the estimates of every column run without bounds checks. Each color of
+/// a pixel is then the pixel itself or one of its estimates, chosen once for the even and once for the odd columns.
+static void interp_rows(const unsigned char *in, int h, int w, int in_row_w, int perm, bayer_method_t method,
+                        unsigned char *out, int out_row_w, int y0, int y1) {
+    static const est_fn_t kernel = select_est();
+
+    // The color, 0 for R, 1 for G and 2 for B, of each pixel of the 2x2 block
+    int color[2][2];
+    for (int k = 0; k < 4; k++) {
+        int t = all_perm[perm][k];
+        color[k / 2][k % 2] = t == 0 ? 0 : t == 3 ? 2 : 1;
+    }
+
+    // Five padded rows, each slot holding the row of its index modulo 5, and the estimates of the current row
+    int pw = w + 4;
+    std::vector<unsigned char> buf(size_t(pw) * 5 + size_t(w) * est_n);
+    int held[5] = {-1, -1, -1, -1, -1};
+    unsigned char *est[est_n];
+    for (int k = 0; k < est_n; k++) est[k] = buf.data() + size_t(pw) * 5 + size_t(w) * k;
+
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *p[5];
+        for (int k = 0; k < 5; k++) {
+            int r = reflect(y + k - 2, h);
+            unsigned char *row = buf.data() + size_t(pw) * (r % 5) + 2;
+            if (held[r % 5] != r) {
+                const unsigned char *src = in + long(r) * in_row_w;
+                memcpy(row, src, size_t(w));
+                row[-2] = src[2];
+                row[-1] = src[1];
+                row[w] = src[w - 2];
+                row[w + 1] = src[w - 3];
+                held[r % 5] = r;
+            }
+            p[k] = row;
+        }
+
+        int x = kernel ? kernel(p, w, method, est) : 0;
+        est_scalar(p, w, method, x, est);
+
+        const unsigned char *src[2][3];
+        for (int px = 0; px < 2; px++) {
+            const int *cy = color[y % 2], *cn = color[1 - y % 2];
+            for (int c = 0; c < 3; c++) {
+                bool h_c = cy[1 - px] == c, v_c = cn[px] == c;
+                src[px][c] = cy[px] == c ? p[2] : h_c && v_c ? est[est_c] : h_c ? est[est_h] : v_c ? est[est_v]
+                                                                                             : est[est_x];
+            }
+        }
+
+        unsigned char *o = out + long(y) * out_row_w;
+        x = 0;
+        for (; x + 1 < w; x += 2) {
+            o[x * 3 + 0] = src[0][0][x];
+            o[x * 3 + 1] = src[0][1][x];
+            o[x * 3 + 2] = src[0][2][x];
+            o[x * 3 + 3] = src[1][0][x + 1];
+            o[x * 3 + 4] = src[1][1][x + 1];
+            o[x * 3 + 5] = src[1][2][x + 1];
+        }
+        if (x < w) {
+            o[x * 3 + 0] = src[0][0][x];
+            o[x * 3 + 1] = src[0][1][x];
+            o[x * 3 + 2] = src[0][2][x];
+        }
+    }
+}
+
+/// bayer_reach returns how many rows above and below a pixel method reads to demosaic it.
+int bayer_reach(bayer_method_t method) {
+    return method == bayer_mhc ? 2 : 1;
+}
+
+/// bayerBG demosaics an image of one byte per pixel into three bytes per pixel. Rows are split between threads when
+/// the image is large.
+/// @param [in] bayer The mosaic.
+/// @param [in] h Height of the image in pixels.
+/// @param [in] w Width of the image in pixels.
+/// @param [in] bayer_row_w Bytes from the start of one row of bayer to the next.
+/// @param [in] perm Which of the 24 orders of R, G0, G1 and B the 2x2 blocks of the mosaic hold.
+/// @param [out] rgb The R, G and B of each pixel.
+/// @param [in] rgb_row_w Bytes from the start of one row of rgb to the next.
+/// @param [in] method How the colors missing at each pixel are made up from its neighbours.
+void bayerBG(const unsigned char *bayer, const int h, const int w, const int bayer_row_w, int perm, unsigned char *rgb,
+             const int rgb_row_w, bayer_method_t method) {
+    if (perm < 0 || 24 <= perm) abort();
+    if (h <= 0 || w <= 0) return;
+
+    // Mirrored rows and columns need an image of at least three of each
+    if (h < 3 || w < 3) method = bayer_block;
+
+    auto rows = [=](int y0, int y1) {
+        if (method == bayer_block) block_rows(bayer, h, w, bayer_row_w, perm, rgb, rgb_row_w, y0, y1);
+        else interp_rows(bayer, h, w, bayer_row_w, perm, method, rgb, rgb_row_w, y0, y1);
+    };
+
+    int n_threads = int(std::max(1L, std::min(long(kernel_threads()), long(h) * w / thread_min_px)));
+    if (n_threads <= 1) {
+        rows(0, h);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    int m = (h + n_threads - 1) / n_threads;
+    for (int k = 1; k < n_threads; k++) {
+        int y0 = std::min(h, k * m);
+        threads.emplace_back(rows, y0, std::min(h, y0 + m));
+    }
+    rows(0, std::min(h, m));
+    for (auto &t : threads) t.join();
+}
+
+void bayerBG(const unsigned char *bayer, const int h, const int w, int perm, unsigned char *rgb,
+             bayer_method_t method) {
+    bayerBG(bayer, h, w, w, perm, rgb, w * 3, method);
 }
@@ -20,8 +20,18 @@
 #ifndef _BAYER_H_
 #define _BAYER_H_
 
-void bayerBG(const unsigned char *bayer, int h, int w, int bayer_row_w, int perm, unsigned char *rgb, int rgb_row_w);
+typedef enum {
+    bayer_block,     // the colors of the 2x2 block to the right of and below each pixel
+    bayer_bilinear,  // the average of the nearest pixels of each color in the 3x3 neighbourhood
+    bayer_mhc        // Malvar-He-Cutler gradient corrected interpolation over the 5x5 neighbourhood
+} bayer_method_t;
 
-void bayerBG(const unsigned char *bayer, int h, int w, int perm, unsigned char *rgb);
+int bayer_reach(bayer_method_t method);
+
+void bayerBG(const unsigned char *bayer, int h, int w, int bayer_row_w, int perm, unsigned char *rgb, int rgb_row_w,
+             bayer_method_t method = bayer_block);
+
+void bayerBG(const unsigned char *bayer, int h, int w, int perm, unsigned char *rgb,
+             bayer_method_t method = bayer_block);
 
 #endif
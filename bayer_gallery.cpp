@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+#include "bayer_gallery.h"
+#include "byte_histo.h"
+
+// Blocks of more than this many cells across average an evenly spaced subset of them, about as many.
+static const int max_samples = 8;
+
+/// bin_mosaic shrinks rows [row0, row0 + n_rows) of a mosaic by averaging blocks of 2x2 cells, each color of a cell
+/// separately, so that the result is a mosaic of the same color order.
+/// @param [in] dat The mosaic, one byte per pixel.
+/// @param [in] offset Number of bytes to skip at the start of dat.
+/// @param [in] w Width of the mosaic in pixels.
+/// @param [in] row0 First row, rounded down to an even row.
+/// @param [in] n_rows Number of rows, all of them complete.
+/// @param [in] max_side Largest width and height of the result.
+/// @param [out] pw Width of the result, even.
+/// @param [out] ph Height of the result, even.
+/// @return The pw x ph mosaic, empty if there is not a single 2x2 cell.
+static std::vector<unsigned char> bin_mosaic(const unsigned char *dat, offset_t offset, int w, offset_t row0,
+                                             offset_t n_rows, int max_side, int &pw, int &ph) {
+    n_rows += row0 & 1;
+    row0 &= ~offset_t(1);
+
+    offset_t cw = w / 2, ch = n_rows / 2;
+    if (cw < 1 || ch < 1) {
+        pw = ph = 0;
+        return std::vector<unsigned char>();
+    }
+
+    // Blocks are k x k cells
+    offset_t half = std::max(1, max_side / 2);
+    offset_t k = std::max((cw + half - 1) / half, (ch + half - 1) / half);
+    offset_t step = std::max(offset_t(1), k / max_samples);
+    int pcw = int(std::max(offset_t(1), cw / k)), pch = int(std::max(offset_t(1), ch / k));
+    pw = pcw * 2;
+    ph = pch * 2;
+
+    std::vector<unsigned char> rv(size_t(pw) * ph);
+    for (int i = 0; i < pch; i++) {
+        for (int j = 0; j < pcw; j++) {
+            unsigned int sum[4] = {0, 0, 0, 0};
+            unsigned int n = 0;
+            for (offset_t ci = i * k; ci < std::min(ch, (i + 1) * k); ci += step) {
+                const unsigned char *p = dat + offset + (row0 + ci * 2) * w;
+                for (offset_t cj = j * k; cj < std::min(cw, (j + 1) * k); cj += step) {
+                    sum[0] += p[cj * 2];
+                    sum[1] += p[cj * 2 + 1];
+                    sum[2] += p[w + cj * 2];
+                    sum[3] += p[w + cj * 2 + 1];
+                    n++;
+                }
+            }
+            unsigned char *o = rv.data() + size_t(i) * 2 * pw + j * 2;
+            o[0] = (unsigned char) ((sum[0] + n / 2) / n);
+            o[1] = (unsigned char) ((sum[1] + n / 2) / n);
+            o[pw] = (unsigned char) ((sum[2] + n / 2) / n);
+            o[pw + 1] = (unsigned char) ((sum[3] + n / 2) / n);
+        }
+    }
+    return rv;
+}
+
+/// chroma_score returns the mean absolute change of R - G and B - G to the right and below each pixel. Colors of a
+/// scene change together, the differences between them change slowly. Demosaicing by a wrong order of colors mixes
+/// the colors of neighbouring pixels and makes them change at every pixel.
+static double chroma_score(const unsigned char *rgb, int w, int h) {
+    double s = 0;
+    offset_t n = 0;
+    for (int y = 0; y + 1 < h; y++) {
+        for (int x = 0; x + 1 < w; x++) {
+            const unsigned char *p = rgb + (size_t(y) * w + x) * 3, *r = p + 3, *d = p + size_t(w) * 3;
+            int rg = p[0] - p[1], bg = p[2] - p[1];
+            s += std::abs(rg - (r[0] - r[1])) + std::abs(rg - (d[0] - d[1])) +
+                 std::abs(bg - (r[2] - r[1])) + std::abs(bg - (d[2] - d[1]));
+            n++;
+        }
+    }
+    return n > 0 ? s / n : 0.;
+}
+
+/// bayer_gallery demosaics a preview of part of a mosaic by each of the 24 permutations of the colors, on as many
+/// threads as there are processors, and ranks them by chroma_score(). The score is always taken from a bilinear
+/// demosaic, the other methods do not tell the permutations apart as well.
+/// @param [in] dat The mosaic, one byte per pixel.
+/// @param [in] offset Number of bytes to skip at the start of dat.
+/// @param [in] w Width of the mosaic in pixels.
+/// @param [in] row0 First row of the part previewed.
+/// @param [in] n_rows Number of rows of the part previewed, all of them complete.
+/// @param [in] max_side Largest width and height of the previews.
+/// @param [in] method Demosaic method of the previews.
+/// @param [out] pw Width of the previews.
+/// @param [out] ph Height of the previews.
+/// @return The previews, best first, empty if the part is smaller than 2x2.
+std::vector<bayer_preview_t> bayer_gallery(const unsigned char *dat, offset_t offset, int w, offset_t row0,
+                                           offset_t n_rows, int max_side, bayer_method_t method, int &pw, int &ph) {
+    std::vector<bayer_preview_t> rv;
+
+    std::vector<unsigned char> mosaic = bin_mosaic(dat, offset, w, row0, n_rows, max_side, pw, ph);
+    if (mosaic.empty()) return rv;
+
+    rv.resize(24);
+    std::atomic<int> next(0);
+    auto run = [&]() {
+        for (int p = next++; p < 24; p = next++) {
+            bayer_preview_t &v = rv[p];
+            v.perm = p;
+            v.rgb.resize(size_t(pw) * ph * 3);
+            bayerBG(mosaic.data(), ph, pw, p, v.rgb.data(), bayer_bilinear);
+            v.score = chroma_score(v.rgb.data(), pw, ph);
+            if (method != bayer_bilinear) bayerBG(mosaic.data(), ph, pw, p, v.rgb.data(), method);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int k = 1; k < std::min(kernel_threads(), 24); k++) threads.emplace_back(run);
+    run();
+    for (auto &t : threads) t.join();
+
+    std::stable_sort(rv.begin(), rv.end(), [](const bayer_preview_t &a, const bayer_preview_t &b) {
+        return a.score < b.score;
+    });
+    return rv;
+}
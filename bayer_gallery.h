@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BAYER_GALLERY_H_
+#define _BAYER_GALLERY_H_
+
+#include <vector>
+
+#include "bayer.h"
+#include "offset.h"
+
+/// bayer_preview_t is a small demosaic of part of a mosaic by one permutation of the colors.
+typedef struct {
+    int perm;
+    // Mean change of R - G and B - G between neighbouring pixels, lowest for the permutation that fits best
+    double score;
+    // w x h pixels of R, G and B
+    std::vector<unsigned char> rgb;
+} bayer_preview_t;
+
+std::vector<bayer_preview_t> bayer_gallery(const unsigned char *dat, offset_t offset, int w, offset_t row0,
+                                           offset_t n_rows, int max_side, bayer_method_t method, int &pw, int &ph);
+
+#endif
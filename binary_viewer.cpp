@@ -24,6 +24,8 @@
 
 #include "binary_viewer.h"
 
+// A wheel notch, 120 eighths of a degree, scrolls three rows.
+static const int wheel_row_delta = 40;
 
 BinaryView::BinaryView(QWidget *p)
         : QWidget(p),
@@ -38,6 +40,11 @@ int BinaryView::rowHeight() const {
     return fh;
 }
 
+/// addressDigits returns the number of hex digits in the address column, widened for files beyond 4 GB.
+int BinaryView::addressDigits() const {
+    return dat_n_ > 0xffffffffL ? 12 : 8;
+}
+
 int BinaryView::columnStart(int c, int fw) const {
     int x = 0;
 
@@ -49,7 +56,7 @@ int BinaryView::columnStart(int c, int fw) const {
         x += fw;
     }
     if (c >= 1) {
-        x += (2 + 1 + 4 + 1 + 4) * fw;
+        x += (2 + addressDigits() / 4 * 5) * fw;
         x += 4 * fw;
     }
     if (c >= 2) {
@@ -88,10 +95,12 @@ void BinaryView::paintEvent(QPaintEvent *e) {
         int x = columnStart(0, fw);
         int y = (i + 1) * fh;
 
-        long pos = (off_ + i) * 16;
+        offset_t pos = (off_ + i) * 16;
 
-        QString s1;
-        s1 = QString("0x %1 %2").arg((pos >> 16) & 0xffff, 4, 16, QChar('0')).arg(pos & 0xffff, 4, 16, QChar('0'));
+        QString s1 = "0x";
+        for (int k = addressDigits() / 4 - 1; k >= 0; k--) {
+            s1 += QString(" %1").arg((pos >> (k * 16)) & 0xffff, 4, 16, QChar('0'));
+        }
 
         p.setPen(default_pen);
         p.drawText(x, y, s1);
@@ -170,6 +179,11 @@ void BinaryView::paintEvent(QPaintEvent *e) {
 void BinaryView::resizeEvent(QResizeEvent *e) {
     QWidget::resizeEvent(e);
 
+    update_font();
+}
+
+/// update_font selects the largest font for which all columns fit within the widget.
+void BinaryView::update_font() {
     QFont font("Courier New");
     for (int i = 48; i > 4; i--) {
         font = QFont("Courier New", i);
@@ -181,23 +195,28 @@ void BinaryView::resizeEvent(QResizeEvent *e) {
     font_ = font;
 }
 
-void BinaryView::setData(const unsigned char *dat, long n) {
+void BinaryView::setData(const unsigned char *dat, offset_t n) {
+    bool resize = addressDigits() != (n > 0xffffffffL ? 12 : 8);
+
     dat_ = dat;
     dat_n_ = n;
     off_ = 0;
+
+    // the width of the address column depends on the data length
+    if (resize) update_font();
+
     update();
 }
 
-void BinaryView::setStart(int off) {
+void BinaryView::setStart(offset_t off) {
     off_ = off;
     update();
 }
 
 
 BinaryViewer::BinaryViewer(QWidget *p)
-        : QWidget(p)
-//          hist_(nullptr), dat_(nullptr), dat_n_(0)
-{
+        : QWidget(p),
+          dat_(nullptr), dat_n_(0), row_(0), wheel_delta_(0) {
     auto layout = new QHBoxLayout(this);
 
     bv_ = new BinaryView();
@@ -210,7 +229,7 @@ BinaryViewer::BinaryViewer(QWidget *p)
     sb_->setFocus();
     sb_->setFocusPolicy(Qt::StrongFocus);
 
-    connect(sb_, SIGNAL(valueChanged(int)), bv_, SLOT(setStart(int)));
+    connect(sb_, SIGNAL(valueChanged(int)), SLOT(scrollTo(int)));
 
     setLayout(layout);
 }
@@ -225,23 +244,48 @@ void BinaryViewer::paintEvent(QPaintEvent *e) {
 void BinaryViewer::resizeEvent(QResizeEvent *e) {
     QWidget::resizeEvent(e);
 
-    int nvis_rows = height() / bv_->rowHeight();
-    int page_step = std::max(16, nvis_rows - 2);
-    sb_->setRange(0, int(ceil(dat_n_ / 16.)) - nvis_rows + 1);
-    sb_->setPageStep(page_step);
+    update_scroll();
 }
 
-void BinaryViewer::setData(const unsigned char *dat, long n) {
+/// update_scroll maps the rows of the data onto the scroll bar, which is limited to an int range.
+void BinaryViewer::update_scroll() {
+    offset_t nvis_rows = height() / bv_->rowHeight();
+    offset_t n_rows = dat_n_ / 16 + (dat_n_ % 16 ? 1 : 0);
+    scroll_.set_rows(n_rows, nvis_rows);
+
+    sb_->blockSignals(true);
+    sb_->setRange(0, scroll_.maximum());
+    sb_->setPageStep(scroll_.page_step());
+    sb_->setValue(scroll_.value_for_row(row_));
+    sb_->blockSignals(false);
+}
+
+void BinaryViewer::setData(const unsigned char *dat, offset_t n) {
     dat_ = dat;
     dat_n_ = n;
+    row_ = 0;
 
     bv_->setData(dat, n);
-    int nvis_rows = height() / bv_->rowHeight();
-    sb_->setRange(0, int(ceil(dat_n_ / 16.)) - nvis_rows + 1);
+    update_scroll();
+}
+
+/// start returns the row shown at the top of the view.
+offset_t BinaryViewer::start() const {
+    return row_;
 }
 
-void BinaryViewer::setStart(int s) {
-    sb_->setValue(s);
+void BinaryViewer::setStart(offset_t row) {
+    row_ = scroll_.clamp_row(row);
+    bv_->setStart(row_);
+
+    sb_->blockSignals(true);
+    sb_->setValue(scroll_.value_for_row(row_));
+    sb_->blockSignals(false);
+}
+
+void BinaryViewer::scrollTo(int v) {
+    row_ = scroll_.row_for_value(v);
+    bv_->setStart(row_);
 }
 
 void BinaryViewer::enterEvent(QEvent *e) {
@@ -250,6 +294,15 @@ void BinaryViewer::enterEvent(QEvent *e) {
 }
 
 void BinaryViewer::wheelEvent(QWheelEvent *e) {
-    sb_->event(e);
+    // Scroll by rows rather than through the scroll bar, whose steps may span many rows on large files. Trackpads and
+    // high resolution wheels send fractions of a row, kept until they add up to whole rows.
+    if (!e->pixelDelta().isNull()) {
+        wheel_delta_ += e->pixelDelta().y() * wheel_row_delta / std::max(1, bv_->rowHeight());
+    } else {
+        wheel_delta_ += e->angleDelta().y();
+    }
+    int rows = wheel_delta_ / wheel_row_delta;
+    wheel_delta_ -= rows * wheel_row_delta;
+    if (rows != 0) setStart(row_ - rows);
     e->accept();
 }
@@ -22,6 +22,9 @@
 
 #include <QWidget>
 
+#include "offset.h"
+#include "virtual_scroll.h"
+
 class BinaryView;
 
 class QScrollBar;
@@ -37,9 +40,9 @@ public:
 
 public slots:
 
-    void setData(const unsigned char *dat, long n);
+    void setData(const unsigned char *dat, offset_t n);
 
-    void setStart(int);
+    void setStart(offset_t row);
 
 protected slots:
 
@@ -51,8 +54,12 @@ protected:
     void resizeEvent(QResizeEvent *) override;
 
     const unsigned char *dat_;
-    long dat_n_;
-    int off_;
+    offset_t dat_n_;
+    offset_t off_;
+
+    int addressDigits() const;
+
+    void update_font();
 
     int columnStart(int c, int fw) const;
 };
@@ -64,14 +71,18 @@ public:
 
     ~BinaryViewer() override;
 
+    offset_t start() const;
+
 public slots:
 
-    void setData(const unsigned char *dat, long n);
+    void setData(const unsigned char *dat, offset_t n);
 
-    void setStart(int);
+    void setStart(offset_t row);
 
 protected slots:
 
+    void scrollTo(int);
+
 protected:
     void paintEvent(QPaintEvent *) override;
 
@@ -81,11 +92,17 @@ protected:
 
     void wheelEvent(QWheelEvent *) override;
 
+    void update_scroll();
+
     BinaryView *bv_;
     QScrollBar *sb_;
+    VirtualScroll scroll_;
 
     const unsigned char *dat_;
-    long dat_n_;
+    offset_t dat_n_;
+    offset_t row_;
+    // Wheel movement not yet scrolled, in eighths of a degree
+    int wheel_delta_;
 };
 
 #endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "block_index.h"
+
+using std::min;
+using std::max;
+
+// Blocks start at these sizes and double as needed so at most this many boundaries are kept. A byte boundary takes
+// 2 KiB and a digram boundary 512 KiB, the limits keep either part of the index within 64 MiB.
+static const offset_t min_block_size = offset_t(64) << 10;
+static const offset_t max_rows = 32768;
+static const offset_t min_block_size_2d = offset_t(1) << 20;
+static const offset_t max_rows_2d = 128;
+
+/// BlockIndex constructor.
+/// @param [in] len Expected length of the file in bytes, which determines the initial block sizes.
+BlockIndex::BlockIndex(offset_t len)
+        : n_(0), prev_(-1),
+          bs_(block_size(len, min_block_size, max_rows)),
+          dbs_(block_size(len, min_block_size_2d, max_rows_2d)) {
+    memset(cur_, 0, sizeof(cur_));
+    cur_2d_.assign(256 * 256, 0);
+
+    // The boundary at offset 0
+    cum_.assign(256, 0);
+    cum_2d_.assign(256 * 256, 0);
+}
+
+/// block_size returns the smallest power of two multiple of min_bs dividing len into at most max_rows - 1 blocks.
+offset_t BlockIndex::block_size(offset_t len, offset_t min_bs, offset_t max_rows) {
+    offset_t bs = min_bs;
+    while (len / bs >= max_rows - 1) bs *= 2;
+    return bs;
+}
+
+/// thin drops every other boundary of cum, doubling the block size.
+void BlockIndex::thin(std::vector<offset_t> &cum, int row_n) {
+    size_t n_rows = cum.size() / row_n;
+    size_t k = 0;
+    for (size_t i = 0; i < n_rows; i += 2, k++) {
+        if (k != i) std::copy(cum.begin() + i * row_n, cum.begin() + (i + 1) * row_n, cum.begin() + k * row_n);
+    }
+    cum.resize(k * row_n);
+}
+
+/// add indexes the next window of the file.
+/// @param [in] dat Byte data to be indexed.
+/// @param [in] n Length of dat in bytes.
+void BlockIndex::add(const unsigned char *dat, offset_t n) {
+    offset_t *cur_2d = cur_2d_.data();
+
+    for (offset_t i = 0; i < n;) {
+        // Digram boundaries are counted in digrams, each byte after the first completes one.
+        offset_t n_2d = max(n_ - 1, offset_t(0));
+        offset_t m = min(n - i, bs_ - n_ % bs_);
+        m = min(m, (n_2d / dbs_ + 1) * dbs_ + 1 - n_);
+
+        offset_t ie = i + m;
+        if (prev_ < 0) {
+            prev_ = dat[i];
+            cur_[dat[i]]++;
+            i++;
+        }
+        for (; i < ie; i++) {
+            unsigned char c = dat[i];
+            cur_[c]++;
+            cur_2d[prev_ * 256 + c]++;
+            prev_ = c;
+        }
+        n_ += m;
+
+        if (n_ % bs_ == 0) {
+            if (offset_t(cum_.size() / 256) >= max_rows) {
+                thin(cum_, 256);
+                bs_ *= 2;
+            }
+            if (n_ % bs_ == 0) cum_.insert(cum_.end(), cur_, cur_ + 256);
+        }
+
+        n_2d = n_ - 1;
+        if (n_2d > 0 && n_2d % dbs_ == 0) {
+            if (offset_t(cum_2d_.size() / (256 * 256)) >= max_rows_2d) {
+                thin(cum_2d_, 256 * 256);
+                dbs_ *= 2;
+            }
+            if (n_2d % dbs_ == 0) cum_2d_.insert(cum_2d_.end(), cur_2d_.begin(), cur_2d_.end());
+        }
+    }
+}
+
+/// size returns the number of bytes indexed so far, queries must lie within them.
+offset_t BlockIndex::size() const {
+    return n_;
+}
+
+/// query_cost returns the most bytes histo() reads, those of the partial blocks at either edge of the range.
+offset_t BlockIndex::query_cost() const {
+    return 2 * bs_;
+}
+
+/// query_cost_2d returns the most bytes histo_2d() reads.
+offset_t BlockIndex::query_cost_2d() const {
+    return 2 * dbs_;
+}
+
+/// histo counts the bytes of a range of the indexed file.
+/// @param [in] dat The bytes of the range, only the partial blocks at either edge are read.
+/// @param [in] s Offset of the range within the file.
+/// @param [in] n Length of the range in bytes, s + n must not exceed size().
+/// @param [out] cnt Receives the count of each byte value, 256 entries.
+void BlockIndex::histo(const unsigned char *dat, offset_t s, offset_t n, offset_t *cnt) const {
+    memset(cnt, 0, sizeof(cnt[0]) * 256);
+
+    // Addressed by file offset from here on
+    dat -= s;
+    offset_t e = s + n;
+
+    offset_t b0 = (s + bs_ - 1) / bs_;
+    offset_t b1 = min(e / bs_, offset_t(cum_.size() / 256) - 1);
+
+    if (b0 >= b1) {
+        for (offset_t i = s; i < e; i++) cnt[dat[i]]++;
+        return;
+    }
+
+    const offset_t *c0 = cum_.data() + b0 * 256;
+    const offset_t *c1 = cum_.data() + b1 * 256;
+    for (int i = 0; i < 256; i++) cnt[i] = c1[i] - c0[i];
+
+    for (offset_t i = s; i < b0 * bs_; i++) cnt[dat[i]]++;
+    for (offset_t i = b1 * bs_; i < e; i++) cnt[dat[i]]++;
+}
+
+/// histo_2d counts the overlapping digrams of a range of the indexed file.
+/// @param [in] dat The bytes of the range, only the partial blocks at either edge are read.
+/// @param [in] s Offset of the range within the file.
+/// @param [in] n Length of the range in bytes, s + n must not exceed size().
+/// @param [out] cnt Receives the count of each digram, as a linearized matrix of size 256 * 256.
+void BlockIndex::histo_2d(const unsigned char *dat, offset_t s, offset_t n, offset_t *cnt) const {
+    memset(cnt, 0, sizeof(cnt[0]) * 256 * 256);
+
+    // Addressed by file offset from here on. Digrams are identified by the offset of their first byte, those starting
+    // in [s, s + n - 1) lie within the range.
+    dat -= s;
+    offset_t pe = s + n - 1;
+    if (pe <= s) return;
+
+    offset_t b0 = (s + dbs_ - 1) / dbs_;
+    offset_t b1 = min(pe / dbs_, offset_t(cum_2d_.size() / (256 * 256)) - 1);
+
+    if (b0 >= b1) {
+        for (offset_t i = s; i < pe; i++) cnt[dat[i] * 256 + dat[i + 1]]++;
+        return;
+    }
+
+    const offset_t *c0 = cum_2d_.data() + b0 * 256 * 256;
+    const offset_t *c1 = cum_2d_.data() + b1 * 256 * 256;
+    for (int i = 0; i < 256 * 256; i++) cnt[i] = c1[i] - c0[i];
+
+    for (offset_t i = s; i < b0 * dbs_; i++) cnt[dat[i] * 256 + dat[i + 1]]++;
+    for (offset_t i = b1 * dbs_; i < pe; i++) cnt[dat[i] * 256 + dat[i + 1]]++;
+}
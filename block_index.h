@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BLOCK_INDEX_H_
+#define _BLOCK_INDEX_H_
+
+#include <vector>
+
+#include "offset.h"
+
+/// BlockIndex answers byte and digram histogram queries over any range of a file without reading all of it. Counts
+/// are kept cumulatively at the boundaries of fixed-size blocks, so a query subtracts two boundaries and only reads
+/// the partial blocks at either edge of the range. Block sizes grow with the file to keep the index within a budget.
+class BlockIndex {
+public:
+    explicit BlockIndex(offset_t len);
+
+    void add(const unsigned char *dat, offset_t n);
+
+    offset_t size() const;
+
+    void histo(const unsigned char *dat, offset_t s, offset_t n, offset_t *cnt) const;
+
+    void histo_2d(const unsigned char *dat, offset_t s, offset_t n, offset_t *cnt) const;
+
+    offset_t query_cost() const;
+
+    offset_t query_cost_2d() const;
+
+protected:
+    static offset_t block_size(offset_t len, offset_t min_bs, offset_t max_rows);
+
+    static void thin(std::vector<offset_t> &cum, int row_n);
+
+    offset_t n_;
+    int prev_;
+
+    offset_t bs_;
+    offset_t cur_[256];
+    std::vector<offset_t> cum_;
+
+    offset_t dbs_;
+    std::vector<offset_t> cur_2d_;
+    std::vector<offset_t> cum_2d_;
+};
+
+#endif
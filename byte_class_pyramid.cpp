@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "byte_class_pyramid.h"
+
+using std::min;
+using std::max;
+
+// Each level has blocks 16 times the size of the previous one, at most 16 MiB so sums of bytes fit 32 bits.
+static const int min_shift = 8;
+static const int shift_step = 4;
+
+// A level is dropped once it exceeds this many blocks, 80 MiB, for the 256 B level that is a file over 1 GiB. The
+// coarser levels and the bytes at the edges of a range still answer its sums.
+static const size_t max_level_n = size_t(1) << 22;
+
+/// add_byte_classes adds the classes and values of n bytes of dat to rv.
+void add_byte_classes(byte_class_sums_t &rv, const unsigned char *dat, offset_t n) {
+    offset_t cnt[4] = {0};
+    offset_t sum = 0;
+    for (offset_t i = 0; i < n; i++) {
+        unsigned char v = dat[i];
+        // 0x00 counts towards none of them, 0x01-0x1f low, 0x20-0x7f text, 0x80-0xfe high and 0xff
+        int c = v == 0xff ? 3 : v >= 0x80 ? 2 : v >= 0x20 ? 1 : 0;
+        cnt[c] += v != 0;
+        sum += v;
+    }
+
+    rv.low += cnt[0];
+    rv.text += cnt[1];
+    rv.high += cnt[2];
+    rv.ff += cnt[3];
+    rv.sum += sum;
+}
+
+/// ByteClassPyramid constructor.
+ByteClassPyramid::ByteClassPyramid()
+        : n_(0) {
+    memset(cur_, 0, sizeof(cur_));
+    for (int i = 0; i < n_levels; i++) dropped_[i] = false;
+}
+
+/// level_shift returns log2 of the block size of level.
+int ByteClassPyramid::level_shift(int level) {
+    return min_shift + level * shift_step;
+}
+
+/// add_block adds the sums of block b to rv.
+void ByteClassPyramid::add_block(byte_class_sums_t &rv, const block_t &b) {
+    rv.low += b.low;
+    rv.text += b.text;
+    rv.high += b.high;
+    rv.ff += b.ff;
+    rv.sum += b.sum;
+}
+
+/// add extends the pyramid by the next window of the file.
+/// @param [in] dat Byte data to be summed.
+/// @param [in] n Length of dat in bytes.
+void ByteClassPyramid::add(const unsigned char *dat, offset_t n) {
+    const offset_t bs0 = offset_t(1) << min_shift;
+
+    for (offset_t i = 0; i < n;) {
+        offset_t m = min(n - i, bs0 - (n_ & (bs0 - 1)));
+        byte_class_sums_t s = {0, 0, 0, 0, 0};
+        add_byte_classes(s, dat + i, m);
+        block_t &c = cur_[0];
+        c.low += uint32_t(s.low);
+        c.text += uint32_t(s.text);
+        c.high += uint32_t(s.high);
+        c.ff += uint32_t(s.ff);
+        c.sum += uint32_t(s.sum);
+        i += m;
+        n_ += m;
+
+        // A completed block adds its sums to the block of the next level, which may complete in turn.
+        for (int level = 0; level < n_levels; level++) {
+            offset_t bs = offset_t(1) << level_shift(level);
+            if ((n_ & (bs - 1)) != 0) break;
+
+            const block_t &b = cur_[level];
+            if (!dropped_[level]) {
+                levels_[level].push_back(b);
+                if (levels_[level].size() > max_level_n) {
+                    std::vector<block_t>().swap(levels_[level]);
+                    dropped_[level] = true;
+                }
+            }
+            if (level + 1 < n_levels) {
+                block_t &u = cur_[level + 1];
+                u.low += b.low;
+                u.text += b.text;
+                u.high += b.high;
+                u.ff += b.ff;
+                u.sum += b.sum;
+            }
+            memset(&cur_[level], 0, sizeof(block_t));
+        }
+    }
+}
+
+/// size returns the number of bytes of the file covered so far.
+offset_t ByteClassPyramid::size() const {
+    return n_;
+}
+
+/// block_size returns the size of the finest blocks kept, ranges aligned to it are summed without reading any bytes.
+offset_t ByteClassPyramid::block_size() const {
+    for (int level = 0; level < n_levels; level++) {
+        if (!dropped_[level]) return offset_t(1) << level_shift(level);
+    }
+    return offset_t(1) << level_shift(n_levels - 1);
+}
+
+/// sums adds up the classes and values of the bytes in [s, s + n), which must lie within size().
+/// @param [in] dat Byte data of the range, the byte at offset s of the file.
+/// @param [in] s Start of the range.
+/// @param [in] n Length of the range in bytes.
+/// @param [out] rv The sums.
+void ByteClassPyramid::sums(const unsigned char *dat, offset_t s, offset_t n, byte_class_sums_t &rv) const {
+    memset(&rv, 0, sizeof(rv));
+
+    offset_t bs0 = block_size();
+    offset_t e = s + n;
+    for (offset_t p = s; p < e;) {
+        // The coarsest whole block starting at p
+        int level = n_levels - 1;
+        for (; level >= 0; level--) {
+            offset_t bs = offset_t(1) << level_shift(level);
+            if (!dropped_[level] && (p & (bs - 1)) == 0 && p + bs <= e && p + bs <= n_) break;
+        }
+
+        if (level >= 0) {
+            int sh = level_shift(level);
+            add_block(rv, levels_[level][p >> sh]);
+            p += offset_t(1) << sh;
+        } else {
+            offset_t q = min(e, (p / bs0 + 1) * bs0);
+            add_byte_classes(rv, dat + (p - s), q - p);
+            p = q;
+        }
+    }
+}
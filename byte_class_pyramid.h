@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BYTE_CLASS_PYRAMID_H_
+#define _BYTE_CLASS_PYRAMID_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "offset.h"
+
+/// byte_class_sums_t counts the bytes of a range by class, 0x01-0x1f (low), 0x20-0x7f (text), 0x80-0xfe (high) and
+/// 0xff, and sums their values. The remaining bytes are 0x00.
+typedef struct {
+    offset_t low, text, high, ff, sum;
+} byte_class_sums_t;
+
+/// ByteClassPyramid keeps byte_class_sums_t of a file at block sizes of 256 B up to 16 MiB, each level 16 times
+/// coarser than the previous, computed once in a single pass. Any range is then summed from a few blocks per level
+/// and the bytes at either end not covered by a whole block.
+class ByteClassPyramid {
+public:
+    ByteClassPyramid();
+
+    void add(const unsigned char *dat, offset_t n);
+
+    offset_t size() const;
+
+    offset_t block_size() const;
+
+    void sums(const unsigned char *dat, offset_t s, offset_t n, byte_class_sums_t &rv) const;
+
+    static const int n_levels = 5;
+
+protected:
+    typedef struct {
+        uint32_t low, text, high, ff, sum;
+    } block_t;
+
+    static int level_shift(int level);
+
+    static void add_block(byte_class_sums_t &rv, const block_t &b);
+
+    offset_t n_;
+    // Sums of the incomplete block of each level, less those still pending in the finer levels
+    block_t cur_[n_levels];
+    std::vector<block_t> levels_[n_levels];
+    bool dropped_[n_levels];
+};
+
+void add_byte_classes(byte_class_sums_t &rv, const unsigned char *dat, offset_t n);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "byte_histo.h"
+
+using std::min;
+
+// Below this many bytes a single table is cheaper than clearing and merging several.
+static const offset_t small_n = 1024;
+// Each table counts at most this many bytes before it is merged, so 32-bit counts cannot overflow.
+static const offset_t chunk_n = offset_t(1) << 30;
+// Ranges are split between threads only when each thread gets at least this many bytes.
+static const offset_t thread_min_n = offset_t(8) << 20;
+
+// Most threads the kernels called from this thread split their work between, 0 for one per CPU.
+static thread_local int thread_cap = 0;
+
+typedef void (*byte_histo_fn_t)(offset_t *, const unsigned char *, offset_t);
+
+/// byte_histo_impl counts into four tables in turn. Consecutive equal bytes then increment different counters, rather
+/// than waiting on the store of the previous increment of the same counter, and the counters stay 32-bit until merged.
+static inline __attribute__((always_inline)) void byte_histo_impl(offset_t *cnt, const unsigned char *dat_u8,
+                                                                  offset_t n) {
+    uint32_t t[4][256];
+
+    for (offset_t s = 0; s < n; s += chunk_n) {
+        const unsigned char *p = dat_u8 + s;
+        offset_t m = min(chunk_n, n - s);
+
+        memset(t, 0, sizeof(t));
+
+        offset_t i = 0;
+        for (; i + 16 <= m; i += 16) {
+            uint64_t a, b;
+            memcpy(&a, p + i, 8);
+            memcpy(&b, p + i + 8, 8);
+
+            t[0][a & 0xff]++;
+            t[1][(a >> 8) & 0xff]++;
+            t[2][(a >> 16) & 0xff]++;
+            t[3][(a >> 24) & 0xff]++;
+            t[0][(a >> 32) & 0xff]++;
+            t[1][(a >> 40) & 0xff]++;
+            t[2][(a >> 48) & 0xff]++;
+            t[3][a >> 56]++;
+
+            t[0][b & 0xff]++;
+            t[1][(b >> 8) & 0xff]++;
+            t[2][(b >> 16) & 0xff]++;
+            t[3][(b >> 24) & 0xff]++;
+            t[0][(b >> 32) & 0xff]++;
+            t[1][(b >> 40) & 0xff]++;
+            t[2][(b >> 48) & 0xff]++;
+            t[3][b >> 56]++;
+        }
+        for (; i < m; i++) {
+            t[0][p[i]]++;
+        }
+
+        // Vectorized by the compiler, using the widest instructions the variant was compiled for.
+        for (int j = 0; j < 256; j++) {
+            cnt[j] += offset_t(t[0][j]) + t[1][j] + t[2][j] + t[3][j];
+        }
+    }
+}
+
+static void byte_histo_generic(offset_t *cnt, const unsigned char *dat_u8, offset_t n) {
+    byte_histo_impl(cnt, dat_u8, n);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BYTE_HISTO_DISPATCH
+
+__attribute__((target("sse4.2")))
+static void byte_histo_sse4(offset_t *cnt, const unsigned char *dat_u8, offset_t n) {
+    byte_histo_impl(cnt, dat_u8, n);
+}
+
+__attribute__((target("avx2")))
+static void byte_histo_avx2(offset_t *cnt, const unsigned char *dat_u8, offset_t n) {
+    byte_histo_impl(cnt, dat_u8, n);
+}
+#endif
+
+/// select_kernel picks the variant for the instruction sets of the CPU running the program.
+static byte_histo_fn_t select_kernel() {
+#ifdef BYTE_HISTO_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return byte_histo_avx2;
+    if (__builtin_cpu_supports("sse4.2")) return byte_histo_sse4;
+#endif
+    return byte_histo_generic;
+}
+
+/// limit_kernel_threads caps the threads the kernels called from the calling thread split their work between, as when
+/// several files are processed at once, each by a thread of its own.
+/// @param [in] n The most threads per kernel, 0 for one per CPU.
+void limit_kernel_threads(int n) {
+    thread_cap = n;
+}
+
+/// kernel_threads returns the most threads a kernel called from the calling thread may split its work between.
+int kernel_threads() {
+    static const int n_cpus = std::max(1, int(std::thread::hardware_concurrency()));
+    return thread_cap > 0 ? min(thread_cap, n_cpus) : n_cpus;
+}
+
+/// histo_threads returns the number of threads to split the histogram of n bytes between.
+int histo_threads(offset_t n) {
+    return int(std::max(offset_t(1), min(offset_t(kernel_threads()), n / thread_min_n)));
+}
+
+/// add_byte_histo adds the count of each byte value within dat_u8 to cnt. This is the innermost loop of the byte
+/// histogram, the entropy track and the overview. Large ranges are split between threads.
+/// @param [in,out] cnt The counts, 256 entries.
+/// @param [in] dat_u8 Byte data to be analyzed.
+/// @param [in] n Length of dat_u8 in bytes.
+void add_byte_histo(offset_t *cnt, const unsigned char *dat_u8, offset_t n) {
+    if (n <= 0) return;
+
+    if (n < small_n) {
+        for (offset_t i = 0; i < n; i++) {
+            cnt[dat_u8[i]]++;
+        }
+        return;
+    }
+
+    static const byte_histo_fn_t kernel = select_kernel();
+
+    int n_threads = histo_threads(n);
+    if (n_threads <= 1) {
+        kernel(cnt, dat_u8, n);
+        return;
+    }
+
+    // Each thread counts a contiguous part into its own table, merged once all are done.
+    std::vector<offset_t> part(size_t(n_threads) * 256, 0);
+    std::vector<std::thread> threads;
+    offset_t m = (n + n_threads - 1) / n_threads;
+    for (int k = 1; k < n_threads; k++) {
+        offset_t s = k * m;
+        threads.emplace_back(kernel, part.data() + k * 256, dat_u8 + s, min(m, n - s));
+    }
+    kernel(part.data(), dat_u8, min(m, n));
+    for (auto &t : threads) t.join();
+
+    for (int k = 0; k < n_threads; k++) {
+        for (int j = 0; j < 256; j++) {
+            cnt[j] += part[k * 256 + j];
+        }
+    }
+}
@@ -17,16 +17,27 @@
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
+#include <climits>
+#include <thread>
 #include <vector>
 #include <algorithm>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
 #include <QtGui>
 #include <QGridLayout>
 #include <QSpinBox>
+#include <QDoubleSpinBox>
 #include <QComboBox>
 #include <QPushButton>
 
+#include "byte_histo.h"
 #include "dot_plot.h"
+#include "paint_image.h"
+#include "worker.h"
 
 using std::max;
 using std::min;
@@ -35,11 +46,20 @@ using std::random_shuffle;
 using std::pair;
 using std::make_pair;
 
+// Histograms of this many blocks are compared against those of every block before them at a time, staying in cache.
+static const int dot_tile_n = 64;
+
+// random() only provides 31 bits, too few to sample within blocks of large files
+static offset_t random64() {
+    return (offset_t(random()) << 31) | random();
+}
+
 DotPlot::DotPlot(QWidget *p)
         : QLabel(p),
           dat_(nullptr), dat_n_(0),
-          mat_(nullptr), mat_max_n_(0), mat_n_(0),
-          pts_i_(0) {
+          mat_max_n_(0), mat_n_(0) {
+    worker_ = new Worker(this);
+
     {
         auto layout = new QGridLayout(this);
         int r = 0;
@@ -50,7 +70,8 @@ DotPlot::DotPlot(QWidget *p)
             layout->addWidget(l, r, 0);
         }
         {
-            auto sb = new QSpinBox;
+            auto sb = new QDoubleSpinBox;
+            sb->setDecimals(0);
             sb->setFixedSize(sb->sizeHint());
             sb->setFixedWidth(sb->width() * 1.5);
             sb->setRange(0, 100000);
@@ -66,7 +87,8 @@ DotPlot::DotPlot(QWidget *p)
             layout->addWidget(l, r, 0);
         }
         {
-            auto sb = new QSpinBox;
+            auto sb = new QDoubleSpinBox;
+            sb->setDecimals(0);
             sb->setFixedSize(sb->sizeHint());
             sb->setFixedWidth(sb->width() * 1.5);
             sb->setRange(0, 100000);
@@ -82,7 +104,8 @@ DotPlot::DotPlot(QWidget *p)
             layout->addWidget(l, r, 0);
         }
         {
-            auto sb = new QSpinBox;
+            auto sb = new QDoubleSpinBox;
+            sb->setDecimals(0);
             sb->setFixedSize(sb->sizeHint());
             sb->setFixedWidth(sb->width() * 1.5);
             sb->setRange(1, 100000);
@@ -92,6 +115,24 @@ DotPlot::DotPlot(QWidget *p)
         }
         r++;
 
+        {
+            auto l = new QLabel("Method");
+            l->setFixedSize(l->sizeHint());
+            layout->addWidget(l, r, 0);
+        }
+        {
+            // In the order of dot_method_t
+            auto cb = new QComboBox;
+            cb->addItem("Exact");
+            cb->addItem("Sampled");
+            cb->setCurrentIndex(dot_exact);
+            cb->setEditable(false);
+            cb->setFixedSize(cb->sizeHint());
+            method_ = cb;
+            layout->addWidget(cb, r, 1);
+        }
+        r++;
+
         {
             auto l = new QLabel("Max Samples");
             l->setFixedSize(l->sizeHint());
@@ -103,6 +144,7 @@ DotPlot::DotPlot(QWidget *p)
             sb->setFixedWidth(sb->width() * 1.5);
             sb->setRange(1, 100000);
             sb->setValue(10);
+            sb->setEnabled(false);
             max_samples_ = sb;
             layout->addWidget(sb, r, 1);
         }
@@ -111,6 +153,8 @@ DotPlot::DotPlot(QWidget *p)
         {
             auto pb = new QPushButton("Resample");
             pb->setFixedSize(pb->sizeHint());
+            pb->setEnabled(false);
+            resample_ = pb;
             layout->addWidget(pb, r, 1);
             QObject::connect(pb, SIGNAL(clicked()), this, SLOT(parameters_changed()));
         }
@@ -119,22 +163,25 @@ DotPlot::DotPlot(QWidget *p)
         layout->setColumnStretch(2, 1);
         layout->setRowStretch(r, 1);
 
-        QObject::connect(offset1_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
-        QObject::connect(offset2_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
-        QObject::connect(width_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
+        QObject::connect(offset1_, SIGNAL(valueChanged(double)), this, SLOT(parameters_changed()));
+        QObject::connect(offset2_, SIGNAL(valueChanged(double)), this, SLOT(parameters_changed()));
+        QObject::connect(width_, SIGNAL(valueChanged(double)), this, SLOT(parameters_changed()));
+        QObject::connect(method_, SIGNAL(currentIndexChanged(int)), this, SLOT(parameters_changed()));
         QObject::connect(max_samples_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
     }
 }
 
-DotPlot::~DotPlot() {
-    delete[] mat_;
+DotPlot::~DotPlot() = default;
+
+/// stop abandons the dot plot being computed and waits until its task has returned.
+void DotPlot::stop() {
+    worker_->cancel();
+    worker_->join();
 }
 
 void DotPlot::setImage(QImage &img) {
     img_ = img;
 
-    update_pix();
-
     update();
 }
 
@@ -142,6 +189,8 @@ void DotPlot::paintEvent(QPaintEvent *e) {
     QLabel::paintEvent(e);
 
     QPainter p(this);
+    paint_image(p, this, img_);
+
     {
         // a border around the image helps to see the border of a dark image
         p.setPen(Qt::darkGray);
@@ -152,28 +201,13 @@ void DotPlot::paintEvent(QPaintEvent *e) {
 void DotPlot::resizeEvent(QResizeEvent *e) {
     QLabel::resizeEvent(e);
 
-    int tmp = min(width(), height());
-    if (tmp != mat_max_n_) {
-        delete[] mat_;
-        mat_max_n_ = tmp;
-        mat_n_ = 0;
-        mat_ = new int[mat_max_n_ * mat_max_n_];
-    }
+    mat_max_n_ = min(width(), height());
 
     parameters_changed();
 }
 
-void DotPlot::update_pix() {
-    if (img_.isNull()) return;
 
-    int vw = width() - 4;
-    int vh = height() - 4; // TODO BUG: With QDarkStyle, without the subtraction, the height or width of the application grows without bounds.
-    pix_ = QPixmap::fromImage(img_).scaled(vw, vh); //, Qt::KeepAspectRatio);
-    setPixmap(pix_);
-}
-
-
-void DotPlot::setData(const unsigned char *dat, long n) {
+void DotPlot::setData(const file_data_t &dat, offset_t n) {
     dat_ = dat;
     dat_n_ = n;
 
@@ -190,159 +224,356 @@ void DotPlot::setData(const unsigned char *dat, long n) {
 void DotPlot::parameters_changed() {
     puts("called");
 
-    long mdw = min(dat_n_, (long) width_->value());
-    int bs = int(mdw / mat_max_n_) + ((mdw % mat_max_n_) > 0 ? 1 : 0);
-    mat_n_ = 0;
+    // Nothing to sample until the widget has a size, report completion so progress is not left waiting.
+    if (mat_max_n_ <= 0) {
+        emit(dataReady());
+        return;
+    }
+
+    offset_t bs;
+    int mat_n;
+    layout_mat(dat_n_, offset_t(width_->value()), mat_max_n_, bs, mat_n);
 
     if (dat_n_ > 0) {
-        mat_n_ = min(int(mdw / bs), mat_max_n_);
-        printf("Setting max to %d\n", bs);
-        max_samples_->setMaximum(bs);
+        printf("Setting max to %ld\n", long(bs));
+        max_samples_->setMaximum(int(min(bs, offset_t(INT_MAX))));
     }
 
-    printf("dat_n_%d mdw:%d mat_max_n_:%d bs:%d mat_n_:%d bs * mat_n_:%d\n", dat_n_, mdw, mat_max_n_, bs, mat_n_, bs * mat_n_);
+    // The number of samples, and resampling, only mean anything to the sampled method.
+    dot_method_t method = dot_method_t(method_->currentIndex());
+    max_samples_->setEnabled(method == dot_sampled);
+    resample_->setEnabled(method == dot_sampled);
+
+    int max_samples = max_samples_->value();
+    file_data_t dat = dat_;
+
+    // Either touches the whole range, run it in the background and show the result once complete.
+    int gen = worker_->restart();
+    Worker *worker = worker_;
+    worker_->post(gen, [this, worker, gen, dat, bs, mat_n, method, max_samples] {
+        std::shared_ptr<int> mat(new int[mat_n * mat_n](), std::default_delete<int[]>());
+        auto cancelled = [worker, gen] { return worker->cancelled(gen); };
+        bool done = method == dot_exact ? exact_mat(dat.get(), bs, mat_n, mat.get(), cancelled)
+                                        : sample_mat(dat.get(), bs, mat_n, max_samples, mat.get(), cancelled);
+        if (!done) return;
+        worker->deliver(gen, [this, mat, mat_n] {
+            mat_ = mat;
+            mat_n_ = mat_n;
+            regen_image();
+            emit(dataReady());
+        });
+    });
+}
 
-    memset(mat_, 0, sizeof(mat_[0]) * mat_max_n_ * mat_max_n_);
+/// layout_mat divides the first width bytes of the data into at most mat_max_n blocks.
+/// @param [in] dat_n Length of the data in bytes.
+/// @param [in] width Number of bytes to compare.
+/// @param [in] mat_max_n Maximum number of blocks along each side of the matrix.
+/// @param [out] bs Block size in bytes.
+/// @param [out] mat_n Number of blocks along each side of the matrix.
+void DotPlot::layout_mat(offset_t dat_n, offset_t width, int mat_max_n, offset_t &bs, int &mat_n) {
+    mat_n = 0;
+    offset_t mdw = min(dat_n, width);
+    bs = mdw / mat_max_n + ((mdw % mat_max_n) > 0 ? 1 : 0);
+
+    if (dat_n > 0) {
+        mat_n = int(min(mdw / bs, offset_t(mat_max_n)));
+    }
 
-    pts_.clear();
-    pts_.reserve(mat_n_ * mat_n_);
-#if 1
-    for (int i = 0; i < mat_n_; i++) {
-        for (int j = i; j < mat_n_; j++) {
-            pts_.emplace_back(make_pair(i, j));
+    printf("dat_n_%ld mdw:%ld mat_max_n_:%d bs:%ld mat_n:%d bs * mat_n:%ld\n", long(dat_n), long(mdw), mat_max_n, long(bs), mat_n, long(bs * mat_n));
+}
+
+/// dots_generic sets out[j] to the inner product of the histogram a with each of the n_b consecutive histograms of b.
+static void dots_generic(const double *a, const double *b, int n_b, double *out) {
+    for (int j = 0; j < n_b; j++) {
+        const double *p = b + j * 256;
+        double s = 0;
+        for (int v = 0; v < 256; v++) s += a[v] * p[v];
+        out[j] = s;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DOT_PLOT_DISPATCH
+
+/// dots_sse2 computes dots_generic() two bins per lane, each load of a shared by two histograms of b.
+__attribute__((target("sse2")))
+static void dots_sse2(const double *a, const double *b, int n_b, double *out) {
+    int j = 0;
+    for (; j + 2 <= n_b; j += 2) {
+        const double *p0 = b + j * 256, *p1 = p0 + 256;
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        for (int v = 0; v < 256; v += 2) {
+            __m128d x = _mm_loadu_pd(a + v);
+            s0 = _mm_add_pd(s0, _mm_mul_pd(x, _mm_loadu_pd(p0 + v)));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(x, _mm_loadu_pd(p1 + v)));
         }
+        __m128d h = _mm_add_pd(_mm_unpacklo_pd(s0, s1), _mm_unpackhi_pd(s0, s1));
+        _mm_storeu_pd(out + j, h);
     }
-#else
-    for (int i = 0; i < mat_n_; i++) {
-        pts_.emplace_back(make_pair(i, mat_n_-i-1));
-//        pts_.emplace_back(make_pair(i, i));
+    dots_generic(a, b + j * 256, n_b - j, out + j);
+}
+
+/// dots_avx2 computes dots_generic() four bins per lane, each load of a shared by four histograms of b.
+__attribute__((target("avx2,fma")))
+static void dots_avx2(const double *a, const double *b, int n_b, double *out) {
+    int j = 0;
+    for (; j + 4 <= n_b; j += 4) {
+        const double *p0 = b + j * 256, *p1 = p0 + 256, *p2 = p1 + 256, *p3 = p2 + 256;
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+        for (int v = 0; v < 256; v += 4) {
+            __m256d x = _mm256_loadu_pd(a + v);
+            s0 = _mm256_fmadd_pd(x, _mm256_loadu_pd(p0 + v), s0);
+            s1 = _mm256_fmadd_pd(x, _mm256_loadu_pd(p1 + v), s1);
+            s2 = _mm256_fmadd_pd(x, _mm256_loadu_pd(p2 + v), s2);
+            s3 = _mm256_fmadd_pd(x, _mm256_loadu_pd(p3 + v), s3);
+        }
+        // The four sums of each histogram, added across the lanes
+        __m256d h01 = _mm256_hadd_pd(s0, s1), h23 = _mm256_hadd_pd(s2, s3);
+        __m256d h = _mm256_add_pd(_mm256_permute2f128_pd(h01, h23, 0x20), _mm256_permute2f128_pd(h01, h23, 0x31));
+        _mm256_storeu_pd(out + j, h);
     }
+    dots_generic(a, b + j * 256, n_b - j, out + j);
+}
 #endif
-    random_shuffle(pts_.begin(), pts_.end());
 
+typedef void (*dots_fn_t)(const double *a, const double *b, int n_b, double *out);
+
+/// select_dots picks the variant for the instruction sets of the CPU running the program.
+static dots_fn_t select_dots() {
+#ifdef DOT_PLOT_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return dots_avx2;
+    if (__builtin_cpu_supports("sse2")) return dots_sse2;
+#endif
+    return dots_generic;
+}
+
+/// exact_mat counts the pairs of equal bytes of each pair of blocks. The count is the inner product of the byte
+/// histograms of the blocks, so each block is counted once and the pairs cost 256 multiplications each, whatever the
+/// block size. Products and sums of counts are exact in doubles for blocks below 2^26 bytes.
+/// @param [in] dat Byte data to be analyzed.
+/// @param [in] bs Block size in bytes.
+/// @param [in] mat_n Number of blocks along each side of mat.
+/// @param [out] mat Matrix of size mat_n * mat_n receiving the number of equal pairs, scaled down to fit an int when
+/// blocks of a single value would not.
+/// @param [in] cancelled Polled periodically, counting stops early when it returns true.
+/// @return False if counting was cancelled.
+bool DotPlot::exact_mat(const unsigned char *dat, offset_t bs, int mat_n, int *mat,
+                        const std::function<bool()> &cancelled) {
+    if (mat_n <= 0) return true;
+
+    const int max_threads = kernel_threads();
+    static const dots_fn_t dots = select_dots();
+
+    // The histograms of the blocks. A large block is split between threads by add_byte_histo(), small ones are
+    // shared out a block at a time.
+    vector<double> histo(size_t(mat_n) * 256);
     {
-//        float sf = 1.f;
-//        if (mwh < mdw) {
-//            sf = mwh / float(mdw);
-//        }
-//
-//        int xyn = 1 / sf + 1;
+        std::atomic<int> next(0);
+        std::atomic<bool> stop(false);
+        auto run = [&]() {
+            vector<offset_t> cnt(256);
+            for (int k = next++; k < mat_n && !stop; k = next++) {
+                std::fill(cnt.begin(), cnt.end(), 0);
+                add_byte_histo(cnt.data(), dat + k * bs, bs);
+                for (int v = 0; v < 256; v++) histo[size_t(k) * 256 + v] = double(cnt[v]);
+                if ((k & 63) == 0 && cancelled()) stop = true;
+            }
+        };
+
+        int n_threads = histo_threads(bs) > 1 ? 1 : min(max_threads, mat_n);
+        vector<std::thread> threads;
+        for (int k = 1; k < n_threads; k++) threads.emplace_back(run);
+        run();
+        for (auto &t : threads) t.join();
+        if (stop) return false;
+    }
+
+    // The upper triangle by tiles of columns, each compared against every row above its end, the widest first. A
+    // block of a single value pairs all of its bs * bs bytes.
+    double scale = min(1., double(INT_MAX) / (double(bs) * double(bs)));
+    int n_tiles = (mat_n + dot_tile_n - 1) / dot_tile_n;
+    std::atomic<int> next(0);
+    std::atomic<bool> stop(false);
+    auto run = [&]() {
+        vector<double> out(dot_tile_n);
+        for (int k = next++; k < n_tiles && !stop; k = next++) {
+            if (cancelled()) {
+                stop = true;
+                break;
+            }
+
+            int j0 = (n_tiles - 1 - k) * dot_tile_n, j1 = min(mat_n, j0 + dot_tile_n);
+            for (int i = 0; i < j1; i++) {
+                int j = max(i, j0);
+                dots(histo.data() + size_t(i) * 256, histo.data() + size_t(j) * 256, j1 - j, out.data());
+                for (int m = 0; m < j1 - j; m++) {
+                    int c = int(out[m] * scale + .5);
+                    mat[i * mat_n + j + m] = c;
+                    mat[(j + m) * mat_n + i] = c;
+                }
+            }
+        }
+    };
+
+    vector<std::thread> threads;
+    for (int k = 1; k < min(max_threads, n_tiles); k++) threads.emplace_back(run);
+    run();
+    for (auto &t : threads) t.join();
 
-//        printf("min(width(), height()): %d mwh:%d mdw:%d dat_n:%d sf:%f xyn:%d", min(width(), height()), mwh, mdw, dat_n_, sf, xyn);
+    return !stop;
+}
 
+/// sample_mat estimates the similarity of each pair of blocks by comparing randomly chosen bytes.
+/// @param [in] dat Byte data to be analyzed.
+/// @param [in] bs Block size in bytes.
+/// @param [in] mat_n Number of blocks along each side of mat.
+/// @param [in] max_samples Number of byte pairs compared per block pair, on and off the diagonal.
+/// @param [out] mat Zero initialized matrix of size mat_n * mat_n receiving the number of matching pairs.
+/// @param [in] cancelled Polled periodically, sampling stops early when it returns true.
+/// @return False if sampling was cancelled.
+bool DotPlot::sample_mat(const unsigned char *dat, offset_t bs, int mat_n, int max_samples, int *mat, const std::function<bool()> &cancelled) {
+    vector<pair<int, int> > pts;
+    pts.reserve(mat_n * mat_n);
+#if 1
+    for (int i = 0; i < mat_n; i++) {
+        for (int j = i; j < mat_n; j++) {
+            pts.emplace_back(make_pair(i, j));
+        }
+    }
+#else
+    for (int i = 0; i < mat_n; i++) {
+        pts.emplace_back(make_pair(i, mat_n-i-1));
+//        pts.emplace_back(make_pair(i, i));
+    }
+#endif
+    random_shuffle(pts.begin(), pts.end());
 
-//        printf("pts_.size(): %d sf: %f\n", pts_.size(), sf);
-        // pts_i_ is decremented in advance_mat()
-        pts_i_ = pts_.size();
+    {
         int ii = 0;
         // Precompute some random values for sampling
-        std::vector<pair<int, int> > rand;
-        while (pts_i_ > 0) {
+        std::vector<pair<offset_t, offset_t> > rand;
+        for (auto pt = pts.rbegin(); pt != pts.rend(); pt++) {
             if ((ii++ % 100) == 0) {
+                if (cancelled()) return false;
+
                 {
-                    int n = min(max_samples_->value(), bs);
+                    int n = int(min(offset_t(max_samples), bs));
 //            n = n * n;
                     rand.clear();
                     rand.reserve(n);
-                    printf("Generating %d points in range [0, %d-1] along the diagonal\n", n, bs);
+                    printf("Generating %d points in range [0, %ld-1] along the diagonal\n", n, long(bs));
                     for (int tt = 0; tt < n; tt++) {
-                        int a = random() % bs;
+                        offset_t a = random64() % bs;
                         rand.emplace_back(make_pair(a, a));
                     }
-                    int n2 = min(max_samples_->value(), bs * bs - bs);
-                    printf("Generating %d points in range [0, %d-1] off the diagonal\n", n2, bs);
+                    // bs * bs - bs would overflow for very large blocks
+                    int n2 = bs > 65536 ? max_samples : int(min(offset_t(max_samples), bs * bs - bs));
+                    printf("Generating %d points in range [0, %ld-1] off the diagonal\n", n2, long(bs));
                     for (int tt = 0; tt < n2;) {
-                        int a = random() % bs;
-                        int b = random() % bs;
+                        offset_t a = random64() % bs;
+                        offset_t b = random64() % bs;
                         if (a == b) continue;
                         rand.emplace_back(make_pair(a, b));
                         tt++;
                     }
-//            for (int tt = 0; tt < n; tt++) {
-//                rand.emplace_back(make_pair(random() % bs, random() % bs));
-//            }
                 }
             }
 
-
 //            random_shuffle(rand.begin(), rand.end());
-            advance_mat(bs, rand);
+            advance_mat(dat, bs, mat_n, mat, *pt, rand);
         }
     }
-    regen_image();
-}
-
-void DotPlot::advance_mat(int bs, const vector<pair<int, int> > &rand) {
-    if (pts_i_ == 0 || pts_.empty()) return;
 
-    pts_i_--;
-    pair<int, int> pt = pts_[pts_i_];
+    return true;
+}
 
+void DotPlot::advance_mat(const unsigned char *dat, offset_t bs, int mat_n, int *mat, const pair<int, int> &pt, const vector<pair<offset_t, offset_t> > &rand) {
     int x = pt.first;
     int y = pt.second;
 
-    int xo = x * bs;
-    int yo = y * bs;
+    offset_t xo = x * bs;
+    offset_t yo = y * bs;
 
     if (true) {
 //        for (int tt = 0; tt < bs; tt++) {
 //            int i = xo + tt;
 //            int j = yo + tt;
 //
-//            if (dat_[i] == dat_[j]) {
-//                int ii = y * mat_n_ + x;
-//                int jj = x * mat_n_ + y;
-//                if (0 <= ii && ii < mat_n_ * mat_n_) mat_[ii]++;
-//                if (0 <= jj && jj < mat_n_ * mat_n_) mat_[jj]++;
+//            if (dat[i] == dat[j]) {
+//                int ii = y * mat_n + x;
+//                int jj = x * mat_n + y;
+//                if (0 <= ii && ii < mat_n * mat_n) mat[ii]++;
+//                if (0 <= jj && jj < mat_n * mat_n) mat[jj]++;
 //            }
-////            printf("%d %d %d %d %d %d %d %d\n", xo, yo, tt, rand[tt], i, j, dat_[i], dat_[j]);
+////            printf("%d %d %d %d %d %d %d %d\n", xo, yo, tt, rand[tt], i, j, dat[i], dat[j]);
 //        }
         for (int tt = 0; tt < rand.size(); tt++) {
-            int i = xo + rand[tt].first;
-            int j = yo + rand[tt].second;
+            offset_t i = xo + rand[tt].first;
+            offset_t j = yo + rand[tt].second;
 //            int i = xo + (random() % bs);
 //            int j = yo + (random() % bs);
 
-            if (dat_[i] == dat_[j]) {
-                int ii = y * mat_n_ + x;
-                int jj = x * mat_n_ + y;
-                if (0 <= ii && ii < mat_n_ * mat_n_) mat_[ii]++;
-                if (0 <= jj && jj < mat_n_ * mat_n_) mat_[jj]++;
+            if (dat[i] == dat[j]) {
+                int ii = y * mat_n + x;
+                int jj = x * mat_n + y;
+                if (0 <= ii && ii < mat_n * mat_n) mat[ii]++;
+                if (0 <= jj && jj < mat_n * mat_n) mat[jj]++;
             }
-//            printf("%d %d %d %d %d %d %d %d\n", xo, yo, tt, rand[tt], i, j, dat_[i], dat_[j]);
+//            printf("%d %d %d %d %d %d %d %d\n", xo, yo, tt, rand[tt], i, j, dat[i], dat[j]);
         }
     } else {
-        for (int tt1 = 0; tt1 < bs; tt1++) {
-            for (int tt2 = 0; tt2 < bs; tt2++) {
-                int i = xo + tt1;
-                int j = yo + tt2;
-
-                if (dat_[i] == dat_[j]) {
-                    int ii = y * mat_n_ + x;
-                    int jj = x * mat_n_ + y;
-                    if (0 <= ii && ii < mat_n_ * mat_n_) mat_[ii]++;
+        for (offset_t tt1 = 0; tt1 < bs; tt1++) {
+            for (offset_t tt2 = 0; tt2 < bs; tt2++) {
+                offset_t i = xo + tt1;
+                offset_t j = yo + tt2;
+
+                if (dat[i] == dat[j]) {
+                    int ii = y * mat_n + x;
+                    int jj = x * mat_n + y;
+                    if (0 <= ii && ii < mat_n * mat_n) mat[ii]++;
 //                    else abort();
-                    if (0 <= jj && jj < mat_n_ * mat_n_) mat_[jj]++;
+                    if (0 <= jj && jj < mat_n * mat_n) mat[jj]++;
 //                    else abort();
                 }
-                printf("%d %d %d %d %d %d %d %d\n", xo, yo, tt1, tt2, i, j, dat_[i], dat_[j]);
+                printf("%ld %ld %ld %ld %ld %ld %d %d\n", long(xo), long(yo), long(tt1), long(tt2), long(i), long(j), dat[i], dat[j]);
             }
         }
     }
 }
 
 void DotPlot::regen_image() {
+    if (!mat_) return;
+
+    QImage img = render(mat_.get(), mat_n_);
+
+    img.save("a.png");
+
+//    long mdw = min(dat_n_, (long) width_->value());
+//    int mwh = min(width(), height());
+//    if (mwh > mdw) mwh = mdw;
+
+    setImage(img);
+}
+
+/// render draws the similarity matrix in grey levels, scaled to the most similar pair of distinct blocks.
+/// @param [in] mat Matrix of size mat_n * mat_n as filled in by sample_mat().
+/// @param [in] mat_n Number of blocks along each side of mat.
+/// @return The mat_n x mat_n image.
+QImage DotPlot::render(const int *mat, int mat_n) {
     // Find the maximum value, ignoring the diagonal.
     // Could stop the search once m = max_samples_->value()
     int m = 0;
-    for (int j = 0; j < mat_n_; j++) {
+    for (int j = 0; j < mat_n; j++) {
         for (int i = 0; i < j; i++) {
-            int k = j * mat_n_ + i;
-            if (m < mat_[k]) m = mat_[k];
+            int k = j * mat_n + i;
+            if (m < mat[k]) m = mat[k];
         }
-        for (int i = j + 1; i < mat_n_; i++) {
-            int k = j * mat_n_ + i;
-            if (m < mat_[k]) m = mat_[k];
+        for (int i = j + 1; i < mat_n; i++) {
+            int k = j * mat_n + i;
+            if (m < mat[k]) m = mat[k];
         }
     }
 
@@ -353,11 +584,11 @@ void DotPlot::regen_image() {
         printf("max(2): %d\n", m);
     }
 
-    QImage img(mat_n_, mat_n_, QImage::Format_RGB32);
+    QImage img(mat_n, mat_n, QImage::Format_RGB32);
     img.fill(0);
     auto p = (unsigned int *) img.bits();
-    for (int i = 0; i < mat_n_ * mat_n_; i++) {
-        int c = min(255, int(mat_[i] / float(m) * 255. + .5));
+    for (int i = 0; i < mat_n * mat_n; i++) {
+        int c = min(255, int(mat[i] / float(m) * 255. + .5));
         unsigned char r = c;
         unsigned char g = c;
         unsigned char b = c;
@@ -365,11 +596,5 @@ void DotPlot::regen_image() {
         *p++ = v;
     }
 
-    img.save("a.png");
-
-//    long mdw = min(dat_n_, (long) width_->value());
-//    int mwh = min(width(), height());
-//    if (mwh > mdw) mwh = mdw;
-
-    setImage(img);
+    return img;
 }
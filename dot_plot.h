@@ -20,14 +20,32 @@
 #ifndef _DOTPLOT_H_
 #define _DOTPLOT_H_
 
+#include <functional>
+#include <memory>
 #include <vector>
 
 #include <QLabel>
 #include <QImage>
-#include <QPixmap>
+
+#include "file_source.h"
+#include "offset.h"
 
 class QSpinBox;
 
+class QDoubleSpinBox;
+
+class Worker;
+
+class QComboBox;
+
+class QPushButton;
+
+/// dot_method_t is how DotPlot compares two blocks.
+typedef enum {
+    dot_exact,   // every pair of equal bytes, counted from the byte histograms of the blocks
+    dot_sampled  // the equal bytes of up to max_samples random pairs
+} dot_method_t;
+
 class DotPlot : public QLabel {
 Q_OBJECT
 public:
@@ -35,9 +53,20 @@ public:
 
     ~DotPlot() override;
 
+    void stop();
+
+    static void layout_mat(offset_t dat_n, offset_t width, int mat_max_n, offset_t &bs, int &mat_n);
+
+    static bool exact_mat(const unsigned char *dat, offset_t bs, int mat_n, int *mat,
+                          const std::function<bool()> &cancelled);
+
+    static bool sample_mat(const unsigned char *dat, offset_t bs, int mat_n, int max_samples, int *mat, const std::function<bool()> &cancelled);
+
+    static QImage render(const int *mat, int mat_n);
+
 public slots:
 
-    void setData(const unsigned char *dat, long n);
+    void setData(const file_data_t &dat, offset_t n);
 
     void parameters_changed();
 
@@ -45,28 +74,33 @@ protected slots:
 
     void setImage(QImage &img);
 
-    void advance_mat(int bs, const std::vector<std::pair<int, int> > &rand);
-
     void regen_image();
 
 protected:
     QImage img_;
-    QPixmap pix_;
 
     void paintEvent(QPaintEvent *) override;
 
     void resizeEvent(QResizeEvent *e) override;
 
-    void update_pix();
+    static void advance_mat(const unsigned char *dat, offset_t bs, int mat_n, int *mat, const std::pair<int, int> &pt,
+                            const std::vector<std::pair<offset_t, offset_t> > &rand);
 
-    QSpinBox *offset1_, *offset2_, *width_, *max_samples_;
-    const unsigned char *dat_;
-    long dat_n_;
-    int *mat_;
+    QDoubleSpinBox *offset1_, *offset2_, *width_;
+    QComboBox *method_;
+    QSpinBox *max_samples_;
+    QPushButton *resample_;
+    file_data_t dat_;
+    offset_t dat_n_;
+    std::shared_ptr<int> mat_;
     int mat_max_n_;
     int mat_n_;
-    std::vector<std::pair<int, int> > pts_;
-    int pts_i_;
+
+    Worker *worker_;
+
+signals:
+
+    void dataReady();
 };
 
 #endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "entropy_pyramid.h"
+#include "byte_histo.h"
+#include "histogram_calc.h"
+
+using std::min;
+using std::max;
+
+// Each level has blocks 16 times the size of the previous one.
+static const int min_shift = 8;
+static const int shift_step = 4;
+
+// A level is dropped once it exceeds this many blocks, 64 MiB, for the 256 B level that is a file over 4 GiB. The
+// coarser levels still answer its plots.
+static const size_t max_level_n = size_t(1) << 24;
+
+/// EntropyPyramid constructor.
+EntropyPyramid::EntropyPyramid()
+        : n_(0) {
+    memset(cnt_, 0, sizeof(cnt_));
+    for (int i = 0; i < n_levels; i++) dropped_[i] = false;
+}
+
+/// level_shift returns log2 of the block size of level.
+int EntropyPyramid::level_shift(int level) {
+    return min_shift + level * shift_step;
+}
+
+/// counts_entropy returns the entropy of n bytes with the byte counts cnt, scaled between [0., 1.].
+float EntropyPyramid::counts_entropy(const offset_t *cnt, offset_t n) {
+    if (n <= 0) return 0.f;
+
+    // The blocks of the finest level, most of those completed, sum the table of EntropyAccumulator rather than take
+    // a log per count. No count of n bytes exceeds n.
+    static const std::shared_ptr<const std::vector<int64_t>> lut = nlogn_table(1 << min_shift);
+    if (n < offset_t(lut->size())) {
+        int64_t s = 0;
+        for (int i = 0; i < 256; i++) s += (*lut)[cnt[i]];
+        return nlogn_entropy(s, n);
+    }
+
+    // -sum(p * ln(p)) with p = c / n is ln(n) - sum(c * ln(c)) / n.
+    double s = 0.;
+    for (int i = 0; i < 256; i++) {
+        if (cnt[i] > 1) s += cnt[i] * std::log(double(cnt[i]));
+    }
+    double entropy = std::log(double(n)) - s / n;
+    entropy /= std::log(2.0);
+    entropy /= 8.0;
+
+    return float(max(entropy, 0.));
+}
+
+/// add extends the pyramid by the next window of the file.
+/// @param [in] dat Byte data to be analyzed.
+/// @param [in] n Length of dat in bytes.
+void EntropyPyramid::add(const unsigned char *dat, offset_t n) {
+    const offset_t bs0 = offset_t(1) << min_shift;
+
+    for (offset_t i = 0; i < n;) {
+        offset_t m = min(n - i, bs0 - (n_ & (bs0 - 1)));
+        add_byte_histo(cnt_[0], dat + i, m);
+        i += m;
+        n_ += m;
+
+        // A completed block adds its counts to the block of the next level, which may complete in turn.
+        for (int level = 0; level < n_levels; level++) {
+            offset_t bs = offset_t(1) << level_shift(level);
+            if ((n_ & (bs - 1)) != 0) break;
+
+            if (!dropped_[level]) {
+                levels_[level].push_back(counts_entropy(cnt_[level], bs));
+                if (levels_[level].size() > max_level_n) {
+                    std::vector<float>().swap(levels_[level]);
+                    dropped_[level] = true;
+                }
+            }
+            if (level + 1 < n_levels) {
+                for (int j = 0; j < 256; j++) cnt_[level + 1][j] += cnt_[level][j];
+            }
+            memset(cnt_[level], 0, sizeof(cnt_[level]));
+        }
+    }
+}
+
+/// size returns the number of bytes of the file covered so far.
+offset_t EntropyPyramid::size() const {
+    return n_;
+}
+
+/// pending_entropy returns the entropy of the incomplete block at the end of level.
+float EntropyPyramid::pending_entropy(int level) const {
+    offset_t cnt[256];
+    memset(cnt, 0, sizeof(cnt));
+    for (int l = 0; l <= level; l++) {
+        for (int j = 0; j < 256; j++) cnt[j] += cnt_[l][j];
+    }
+
+    offset_t bs = offset_t(1) << level_shift(level);
+    return counts_entropy(cnt, n_ & (bs - 1));
+}
+
+/// resolves returns whether the finest level kept has at least one block per row for a plot of n bytes.
+/// @param [in] n Length of the plotted range in bytes.
+/// @param [in] rows Height of the plot.
+bool EntropyPyramid::resolves(offset_t n, int rows) const {
+    for (int level = 0; level < n_levels; level++) {
+        if (!dropped_[level]) return (n >> level_shift(level)) >= rows;
+    }
+    return false;
+}
+
+/// entropy returns the entropy of the blocks overlapping [s, e) at the coarsest level still having a block per row,
+/// or the finest level kept if none has.
+/// @param [in] s Start of the range.
+/// @param [in] e End of the range, clipped to size().
+/// @param [in] rows Height of the plot.
+/// @param [out] rv_len The length of the return vector.
+/// @return The entropy of each block, as vector of length rv_len scaled between [0., 1.], null if the range is empty.
+float *EntropyPyramid::entropy(offset_t s, offset_t e, int rows, offset_t &rv_len) const {
+    rv_len = 0;
+    e = min(e, n_);
+    if (s >= e) return nullptr;
+
+    int level = -1;
+    for (int l = n_levels - 1; l >= 0; l--) {
+        if (dropped_[l]) continue;
+        level = l;
+        int sh = level_shift(l);
+        offset_t bs = offset_t(1) << sh;
+        if (((e + bs - 1) >> sh) - (s >> sh) >= rows) break;
+    }
+    if (level < 0) return nullptr;
+
+    int sh = level_shift(level);
+    offset_t bs = offset_t(1) << sh;
+    offset_t k0 = s >> sh;
+    offset_t k1 = (e + bs - 1) >> sh;
+    const std::vector<float> &dd = levels_[level];
+
+    rv_len = k1 - k0;
+    auto rv = new float[rv_len];
+    for (offset_t k = k0; k < k1; k++) {
+        rv[k - k0] = k < offset_t(dd.size()) ? dd[k] : pending_entropy(level);
+    }
+
+    return rv;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ENTROPY_PYRAMID_H_
+#define _ENTROPY_PYRAMID_H_
+
+#include <vector>
+
+#include "offset.h"
+
+/// EntropyPyramid keeps the entropy of a file at block sizes of 256 B, 4 KiB, 64 KiB and 1 MiB, computed once in a
+/// single pass. A plot of any range then picks the level matching its height without reading the bytes again.
+class EntropyPyramid {
+public:
+    EntropyPyramid();
+
+    void add(const unsigned char *dat, offset_t n);
+
+    offset_t size() const;
+
+    bool resolves(offset_t n, int rows) const;
+
+    float *entropy(offset_t s, offset_t e, int rows, offset_t &rv_len) const;
+
+    static const int n_levels = 4;
+
+protected:
+    static int level_shift(int level);
+
+    static float counts_entropy(const offset_t *cnt, offset_t n);
+
+    float pending_entropy(int level) const;
+
+    offset_t n_;
+    // Counts of the incomplete block of each level, less those still pending in the finer levels
+    offset_t cnt_[n_levels][256];
+    std::vector<float> levels_[n_levels];
+    bool dropped_[n_levels];
+};
+
+#endif
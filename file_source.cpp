@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_source.h"
+
+// Mappings a SIGBUS may be recovered from, as [lo, hi) address ranges. A slot is free while its lo is 0. Plain atomics
+// rather than a locked container, the signal handler reads them.
+static const int max_guarded = 256;
+static std::atomic<uintptr_t> guarded_lo[max_guarded];
+static std::atomic<uintptr_t> guarded_hi[max_guarded];
+static uintptr_t guard_page_size;
+
+/// on_sigbus handles reads of pages a mapped file no longer has since it was truncated. The page is replaced by one of
+/// zeros and the read carries on, the analysis in question is stopped and redone once the new size is noticed. Any
+/// other SIGBUS takes its default action once the handler returns and the access faults again.
+static void on_sigbus(int, siginfo_t *info, void *) {
+    auto a = uintptr_t(info->si_addr);
+
+    for (int i = 0; i < max_guarded; i++) {
+        uintptr_t lo = guarded_lo[i].load();
+        if (lo == 0 || a < lo || a >= guarded_hi[i].load()) continue;
+
+        void *page = (void *) (a & ~(guard_page_size - 1));
+        if (mmap(page, guard_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) return;
+        break;
+    }
+
+    signal(SIGBUS, SIG_DFL);
+}
+
+static bool install_sigbus_guard() {
+    guard_page_size = sysconf(_SC_PAGESIZE);
+
+    struct sigaction sa{};
+    sa.sa_sigaction = on_sigbus;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGBUS, &sa, nullptr) == 0;
+}
+
+/// guard_mapping lets reads of [p, p + len) survive the file being truncated underneath them.
+/// @return False if too many mappings are guarded already, reads beyond the end of the file then raise SIGBUS.
+static bool guard_mapping(const unsigned char *p, size_t len) {
+    static const bool installed = install_sigbus_guard();
+    if (!installed) return false;
+
+    for (int i = 0; i < max_guarded; i++) {
+        uintptr_t expected = 0;
+        if (guarded_lo[i].compare_exchange_strong(expected, uintptr_t(p))) {
+            guarded_hi[i] = uintptr_t(p) + len;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void unguard_mapping(const unsigned char *p) {
+    for (int i = 0; i < max_guarded; i++) {
+        if (guarded_lo[i].load() == uintptr_t(p)) {
+            guarded_hi[i] = 0;
+            guarded_lo[i] = 0;
+            return;
+        }
+    }
+}
+
+
+FileSource::FileSource()
+        : fd_(-1), dat_(nullptr), len_(0) {
+}
+
+FileSource::~FileSource() {
+    close();
+}
+
+/// open maps filename read-only into memory, replacing any previously opened file.
+/// @param [in] filename The file to map.
+/// @return True if the file was opened, false otherwise.
+bool FileSource::open(const std::string &filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Unable to stat %s: %s\n", filename.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    size_t len = st.st_size;
+
+    // mmap() rejects zero length mappings, an empty file is represented by a null pointer and zero length
+    unsigned char *dat = nullptr;
+    if (len > 0) {
+        void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Unable to map %s: %s\n", filename.c_str(), strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        dat = (unsigned char *) p;
+        guard_mapping(dat, len);
+    }
+
+    filename_ = filename;
+    fd_ = fd;
+    dat_ = dat;
+    len_ = len;
+
+    // Most analyses walk the file from front to back, so favor aggressive read-ahead.
+    advise(0, len_, access_sequential);
+
+    return true;
+}
+
+void FileSource::close() {
+    if (dat_ != nullptr) {
+        unguard_mapping(dat_);
+        munmap(dat_, len_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+
+    filename_.clear();
+    fd_ = -1;
+    dat_ = nullptr;
+    len_ = 0;
+}
+
+bool FileSource::is_open() const {
+    return fd_ >= 0;
+}
+
+const std::string &FileSource::filename() const {
+    return filename_;
+}
+
+const unsigned char *FileSource::data() const {
+    return dat_;
+}
+
+size_t FileSource::size() const {
+    return len_;
+}
+
+/// advise passes an access pattern hint for a region of the mapping to the kernel.
+/// @param [in] offset Start of the region in bytes, rounded down to a page boundary.
+/// @param [in] len Length of the region in bytes.
+/// @param [in] access The expected access pattern.
+void FileSource::advise(size_t offset, size_t len, access_t access) const {
+    if (dat_ == nullptr || offset >= len_) return;
+
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    size_t aligned = offset - offset % page_size;
+    len = std::min(len + (offset - aligned), len_ - aligned);
+
+    int advice;
+    switch (access) {
+        case access_sequential:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case access_random:
+            advice = MADV_RANDOM;
+            break;
+        case access_will_need:
+            advice = MADV_WILLNEED;
+            break;
+        case access_dont_need:
+            advice = MADV_DONTNEED;
+            break;
+        case access_normal:
+        default:
+            advice = MADV_NORMAL;
+            break;
+    }
+
+    madvise(dat_ + aligned, len, advice);
+}
+
+/// file_data returns a pointer to offset within the mapping of src that keeps src alive.
+/// @param [in] src The mapped file.
+/// @param [in] offset Offset of the first byte in bytes.
+/// @return The pointer, null if src is not open.
+file_data_t file_data(const std::shared_ptr<FileSource> &src, offset_t offset) {
+    if (!src || src->data() == nullptr) return file_data_t();
+    return file_data_t(src, src->data() + offset);
+}
+
+/// for_each_window passes consecutive windows of [dat, dat + n) to fn in order. The following window is prefetched
+/// while fn runs, and the pages of a window are released once fn is done with them, which only drops clean pages of
+/// the read-only mapping; they are read again from the file if touched later.
+/// @param [in] dat Mapped data to be streamed.
+/// @param [in] n Length of dat in bytes.
+/// @param [in] fn Called for each window, returning false stops early.
+/// @param [in] window Maximum length of a window in bytes.
+/// @return False if fn stopped early.
+bool for_each_window(const unsigned char *dat, offset_t n, const window_fn_t &fn, offset_t window) {
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+    // madvise() only accepts whole pages, shrink [p, p + len) to the pages lying entirely inside it
+    auto advise = [](const unsigned char *p, offset_t len, int advice) {
+        uintptr_t s = (uintptr_t(p) + page_size - 1) & ~(page_size - 1);
+        uintptr_t e = (uintptr_t(p) + len) & ~(page_size - 1);
+        if (s < e) madvise((void *) s, e - s, advice);
+    };
+
+    for (offset_t i = 0; i < n; i += window) {
+        offset_t m = std::min(window, n - i);
+
+        if (i + m < n) advise(dat + i + m, std::min(window, n - i - m), MADV_WILLNEED);
+
+        bool more = fn(dat + i, m);
+
+        if (n > window) advise(dat + i, m, MADV_DONTNEED);
+
+        if (!more) return false;
+    }
+
+    return true;
+}
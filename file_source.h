@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILE_SOURCE_H_
+#define _FILE_SOURCE_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "offset.h"
+
+/// FileSource provides read-only access to the contents of a file through a private memory mapping.
+/// Pages are only read from disk when they are first touched, so opening a file is cheap regardless of its size. Should
+/// the file be truncated while mapped, the pages it lost read as zeros rather than raising SIGBUS.
+class FileSource {
+public:
+    typedef enum {
+        access_normal, access_sequential, access_random, access_will_need, access_dont_need
+    } access_t;
+
+    FileSource();
+
+    ~FileSource();
+
+    FileSource(const FileSource &) = delete;
+
+    FileSource &operator=(const FileSource &) = delete;
+
+    bool open(const std::string &filename);
+
+    void close();
+
+    bool is_open() const;
+
+    const std::string &filename() const;
+
+    const unsigned char *data() const;
+
+    size_t size() const;
+
+    void advise(size_t offset, size_t len, access_t access) const;
+
+protected:
+    std::string filename_;
+    int fd_;
+    unsigned char *dat_;
+    size_t len_;
+};
+
+// Bytes within a mapped file. Shares ownership of the FileSource, so the bytes stay valid on background threads even
+// after the application has moved on to another file.
+typedef std::shared_ptr<const unsigned char> file_data_t;
+
+file_data_t file_data(const std::shared_ptr<FileSource> &src, offset_t offset = 0);
+
+// Analyses stream through mapped data in windows of this many bytes, so the number of resident pages they cause stays
+// bounded regardless of the size of the file.
+const offset_t analysis_window = offset_t(64) << 20;
+
+typedef std::function<bool(const unsigned char *dat, offset_t n)> window_fn_t;
+
+bool for_each_window(const unsigned char *dat, offset_t n, const window_fn_t &fn, offset_t window = analysis_window);
+
+#endif
@@ -19,6 +19,9 @@
 
 // The gilbert2d method is based on Python code from https://github.com/jakubcerveny/gilbert/blob/master/gilbert2d.py
 
+#include <list>
+#include <mutex>
+#include <tuple>
 #include <vector>
 
 #include <cstdlib>
@@ -122,3 +125,42 @@ void gilbert2d(int width, int height, curve_t &curve) {
 
     gilbert2d(pt, a, b, curve);
 }
+
+// Curves kept by gilbert2d_index(), enough for both overviews to alternate between a few selection lengths.
+static const size_t max_cached_curves = 8;
+
+/// gilbert2d_index returns the pixel index y * width + x of each point along the curve filling width x height.
+/// Curves are built once per size and shared, so laying out an image along one is a plain scatter.
+/// @param [in] width Width of the grid.
+/// @param [in] height Height of the grid.
+/// @return The pixel indices in curve order, width * height of them.
+std::shared_ptr<const curve_index_t> gilbert2d_index(int width, int height) {
+    typedef std::tuple<int, int, std::shared_ptr<const curve_index_t>> entry_t;
+    static std::mutex mutex;
+    static std::list<entry_t> cache;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (std::get<0>(*it) == width && std::get<1>(*it) == height) {
+                // Most recently used first
+                cache.splice(cache.begin(), cache, it);
+                return std::get<2>(cache.front());
+            }
+        }
+    }
+
+    // Built outside the lock, two threads asking for the same new size at once both build it.
+    curve_t curve;
+    gilbert2d(width, height, curve);
+    auto index = std::make_shared<curve_index_t>(curve.size());
+    for (size_t i = 0; i < curve.size(); i++) {
+        (*index)[i] = uint32_t(curve[i].second) * uint32_t(width) + uint32_t(curve[i].first);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.emplace_front(width, height, index);
+    if (cache.size() > max_cached_curves) cache.pop_back();
+
+    return index;
+}
@@ -20,11 +20,16 @@
 #ifndef __HILBERT_H__
 #define __HILBERT_H__
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 typedef std::pair<int, int> pt_t;
 typedef std::vector<pt_t> curve_t;
+typedef std::vector<uint32_t> curve_index_t;
 
 void gilbert2d(int width, int height, curve_t &curve);
 
+std::shared_ptr<const curve_index_t> gilbert2d_index(int width, int height);
+
 #endif
\ No newline at end of file
@@ -17,7 +17,9 @@
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cfloat>
+#include <vector>
 
 #include <QtGui>
 #include <QGridLayout>
@@ -25,7 +27,10 @@
 #include <QComboBox>
 
 #include "histogram_2d_view.h"
+#include "paint_image.h"
+#include "block_index.h"
 #include "histogram_calc.h"
+#include "worker.h"
 
 using std::isnan;
 using std::signbit;
@@ -34,7 +39,9 @@ using std::isinf;
 
 Histogram2dView::Histogram2dView(QWidget *p)
         : QLabel(p),
-          hist_(nullptr), dat_(nullptr), dat_n_(0) {
+          work_offset_(0), dat_n_(0), offset_(0) {
+    worker_ = new Worker(this);
+
     {
         auto layout = new QGridLayout(this);
         {
@@ -72,13 +79,10 @@ Histogram2dView::Histogram2dView(QWidget *p)
         }
         {
             auto cb = new QComboBox;
+            for (const auto &j : histo_dtype_names()) {
+                cb->addItem(QString::fromStdString(j));
+            }
             cb->setFixedSize(cb->sizeHint());
-            cb->addItem("U8");
-            cb->addItem("U16");
-            cb->addItem("U32");
-            cb->addItem("U64");
-            cb->addItem("F32");
-            cb->addItem("F64");
             cb->setCurrentIndex(0);
             cb->setEditable(false);
             type_ = cb;
@@ -95,14 +99,19 @@ Histogram2dView::Histogram2dView(QWidget *p)
 }
 
 Histogram2dView::~Histogram2dView() {
-    delete[] hist_;
+    // The tasks of worker_ use work_acc_, they are stopped before it goes.
+    delete worker_;
+}
+
+/// stop cancels the digram counting of the worker and waits for it to return.
+void Histogram2dView::stop() {
+    worker_->cancel();
+    worker_->join();
 }
 
 void Histogram2dView::setImage(QImage &img) {
     img_ = img;
 
-    update_pix();
-
     update();
 }
 
@@ -110,6 +119,8 @@ void Histogram2dView::paintEvent(QPaintEvent *e) {
     QLabel::paintEvent(e);
 
     QPainter p(this);
+    paint_image(p, this, img_);
+
     {
         // a border around the image helps to see the border of a dark image
         p.setPen(Qt::darkGray);
@@ -117,50 +128,162 @@ void Histogram2dView::paintEvent(QPaintEvent *e) {
     }
 }
 
-void Histogram2dView::resizeEvent(QResizeEvent *e) {
-    QLabel::resizeEvent(e);
+void Histogram2dView::setData(const file_data_t &dat, offset_t n) {
+    dat_ = dat;
+    dat_n_ = n;
+    index_.reset();
+    offset_ = 0;
 
-    update_pix();
+    regen_histo();
 }
 
-void Histogram2dView::update_pix() {
-    if (img_.isNull()) return;
+/// setRange shows the histogram of the n bytes at offset of a file. When the previous histogram was of the same file,
+/// it is slid to the new range by only reading the bytes that entered or left it. Otherwise it is answered from index
+/// where the dtype allows it, or computed from scratch.
+void Histogram2dView::setRange(const file_data_t &dat, offset_t n, offset_t offset,
+                               const std::shared_ptr<const BlockIndex> &index) {
+    dat_ = dat;
+    dat_n_ = n;
+    index_ = index;
+    offset_ = offset;
+
+    update_histo(true);
+}
 
-    int vw = width() - 4;
-    int vh = height() - 4; // TODO BUG: With QDarkStyle, without the subtraction, the height or width of the application grows without bounds.
-    pix_ = QPixmap::fromImage(img_).scaled(vw, vh); //, Qt::KeepAspectRatio);
-    setPixmap(pix_);
+histo_dtype_t Histogram2dView::dtype() const {
+    return string_to_histo_dtype(type_->currentText().toStdString());
 }
 
-void Histogram2dView::setData(const unsigned char *dat, long n) {
+/// setPrefetched shows the histogram of dat from acc computed ahead of time, falling back to setData() if acc does not
+/// cover n bytes or counts different tuples.
+void Histogram2dView::setPrefetched(const file_data_t &dat, offset_t n, const std::shared_ptr<const TupleHistoAccumulator> &acc) {
+    if (!acc || acc->size() != n || !acc->matches(2, dtype(), true)) {
+        setData(dat, n);
+        return;
+    }
+
     dat_ = dat;
     dat_n_ = n;
+    index_.reset();
+    offset_ = 0;
 
-    regen_histo();
+    // The worker takes its own copy of acc to go on from, so nothing is left for it to read.
+    update_histo(false, false, acc);
 }
 
+/// regen_histo computes the histogram in the background, the image is updated once it is ready.
 void Histogram2dView::regen_histo() {
-    delete[] hist_;
-    hist_ = nullptr;
+    update_histo(false);
+}
+
+/// appendData extends the histogram to n bytes of dat, only the bytes beyond the previous length are read. dat must
+/// start at the same offset as the data last passed to setData().
+void Histogram2dView::appendData(const file_data_t &dat, offset_t n) {
+    dat_ = dat;
+    dat_n_ = n;
+    index_.reset();
+
+    update_histo(true, true);
+}
+
+/// update_histo brings the histogram up to date with dat_ in the background and delivers a copy of its counts. The
+/// accumulator of the worker is reused where it can be, so the GUI thread never copies it.
+/// @param [in] reuse Whether the accumulator of the worker may be slid to dat_ if it holds another range of the file.
+/// @param [in] append Whether dat_ extends the bytes the accumulator of the worker has seen, though it may have been
+/// mapped again since.
+/// @param [in] seed When not null, a histogram of dat_ the worker starts from rather than its own.
+void Histogram2dView::update_histo(bool reuse, bool append, const std::shared_ptr<const TupleHistoAccumulator> &seed) {
+    file_data_t dat = dat_;
+    offset_t n = dat_n_;
+    std::shared_ptr<const BlockIndex> index;
+    if (index_ && offset_ + n <= index_->size()) index = index_;
+    offset_t offset = offset_;
+    histo_dtype_t dtype = this->dtype();
+
+    int gen = worker_->restart();
+    Worker *worker = worker_;
+    worker_->post(gen, [this, worker, gen, dat, n, index, offset, dtype, reuse, append, seed] {
+        if (seed) {
+            work_acc_ = std::make_shared<TupleHistoAccumulator>(*seed);
+            work_dat_ = dat;
+            work_offset_ = offset;
+        }
+
+        bool keep = (reuse || seed) && work_acc_ && work_acc_->matches(2, dtype, true);
+        if (keep && append) {
+            keep = work_acc_->size() <= n;
+        } else if (keep) {
+            // The mapping is kept alive by work_dat_, so matching base addresses mean the same file.
+            keep = work_dat_.get() - work_offset_ == dat.get() - offset;
+            offset_t d = work_offset_ - offset;
+            if (keep && (d != 0 || work_acc_->size() > n)) {
+                offset_t cost = work_acc_->shift_cost(n, d);
+
+                offset_t full_cost = n;
+                if (index && dtype == u8) full_cost = std::min(n, index->query_cost_2d());
+
+                keep = cost >= 0 && cost < full_cost;
+                if (keep) work_acc_->shift(dat.get(), n, d);
+            }
+        }
+
+        if (!keep) {
+            work_acc_ = std::make_shared<TupleHistoAccumulator>(2, dtype);
+            if (index && dtype == u8) {
+                std::vector<offset_t> cnt(256 * 256);
+                index->histo_2d(dat.get(), offset, n, cnt.data());
+                work_acc_->add_counts(cnt.data(), dat.get(), n);
+            }
+        }
+        work_dat_ = dat;
+        work_offset_ = offset;
 
-    histo_dtype_t t = string_to_histo_dtype(type_->currentText().toStdString());
-    hist_ = generate_histo_2d(dat_, dat_n_, t);
+        // A cancelled task leaves the accumulator consistent with the bytes it has seen, the next one goes on from it.
+        TupleHistoAccumulator &acc = *work_acc_;
+        offset_t s = acc.size();
+        if (!for_each_window(dat.get() + s, n - s, [&acc, worker, gen](const unsigned char *p, offset_t m) {
+            acc.add(p, m);
+            return !worker->cancelled(gen);
+        })) return;
 
+        std::shared_ptr<offset_t> hist(new offset_t[256 * 256], std::default_delete<offset_t[]>());
+        std::copy(acc.hist(), acc.hist() + 256 * 256, hist.get());
+        worker->deliver(gen, [this, hist] {
+            set_histo(hist);
+        });
+    });
+}
+
+/// set_histo shows hist, the counts of all 256 * 256 digrams.
+void Histogram2dView::set_histo(const std::shared_ptr<const offset_t> &hist) {
+    hist_ = hist;
     parameters_changed();
+    emit(dataReady());
 }
 
 void Histogram2dView::parameters_changed() {
-    int thresh = thresh_->value();
-    float scale_factor = scale_->value();
+    if (!hist_) return;
+
+    QImage img = render(hist_.get(), thresh_->value(), scale_->value());
+    setImage(img);
+
+    update();
+}
 
+/// render draws a digram histogram, brighter for more frequent digrams.
+/// @param [in] hist The histogram, as a linearized matrix of size 256 * 256.
+/// @param [in] thresh Digrams seen fewer times are left black.
+/// @param [in] scale_factor The count shown at full brightness.
+/// @return The 256 x 256 image.
+QImage Histogram2dView::render(const offset_t *hist, int thresh, float scale_factor) {
     QImage img(256, 256, QImage::Format_RGB32);
     img.fill(0);
 
     auto p = (unsigned int *) img.bits();
 
     for (int i = 0; i < 256 * 256; i++, p++) {
-        if (hist_[i] >= thresh) {
-            float cc = hist_[i] / scale_factor;
+        if (hist[i] >= thresh) {
+            float cc = hist[i] / scale_factor;
             cc += .2;
             if (cc > 1.) cc = 1.;
             int c = cc * 255 + .5;
@@ -176,7 +299,5 @@ void Histogram2dView::parameters_changed() {
         }
     }
 
-    setImage(img);
-
-    update();
+    return img;
 }
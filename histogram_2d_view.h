@@ -22,12 +22,21 @@
 
 #include <QLabel>
 #include <QImage>
-#include <QPixmap>
+
+#include <memory>
+
+#include "file_source.h"
+#include "histogram_calc.h"
+#include "offset.h"
+
+class BlockIndex;
 
 class QSpinBox;
 
 class QComboBox;
 
+class Worker;
+
 class Histogram2dView : public QLabel {
 Q_OBJECT
 public:
@@ -35,9 +44,21 @@ public:
 
     ~Histogram2dView() override;
 
+    void stop();
+
+    histo_dtype_t dtype() const;
+
+    static QImage render(const offset_t *hist, int thresh, float scale_factor);
+
 public slots:
 
-    void setData(const unsigned char *dat, long n);
+    void setData(const file_data_t &dat, offset_t n);
+
+    void appendData(const file_data_t &dat, offset_t n);
+
+    void setPrefetched(const file_data_t &dat, offset_t n, const std::shared_ptr<const TupleHistoAccumulator> &acc);
+
+    void setRange(const file_data_t &dat, offset_t n, offset_t offset, const std::shared_ptr<const BlockIndex> &index);
 
     void parameters_changed();
 
@@ -49,23 +70,36 @@ protected slots:
 
 protected:
     QImage img_;
-    QPixmap pix_;
 
     void paintEvent(QPaintEvent *) override;
 
-    void resizeEvent(QResizeEvent *e) override;
+    void update_histo(bool reuse, bool append = false,
+                      const std::shared_ptr<const TupleHistoAccumulator> &seed = nullptr);
 
-    void update_pix();
+    void set_histo(const std::shared_ptr<const offset_t> &hist);
 
     QSpinBox *thresh_, *scale_;
     QComboBox *type_;
-    int *hist_;
-    const unsigned char *dat_;
-    long dat_n_;
+    // The delivered counts, drawn by parameters_changed().
+    std::shared_ptr<const offset_t> hist_;
+    // Only touched by the tasks of worker_: the accumulator they slide and extend in place, of the bytes at work_dat_,
+    // work_offset_ bytes into the file.
+    std::shared_ptr<TupleHistoAccumulator> work_acc_;
+    file_data_t work_dat_;
+    offset_t work_offset_;
+    file_data_t dat_;
+    offset_t dat_n_;
+    // Index of the file dat_ is part of, starting at offset_ within it. Null when dat_ has no index.
+    std::shared_ptr<const BlockIndex> index_;
+    offset_t offset_;
+
+    Worker *worker_;
 
 signals:
 
     void rangeSelected(float, float);
+
+    void dataReady();
 };
 
 #endif
@@ -29,6 +29,7 @@
 
 #include "histogram_calc.h"
 #include "histogram_3d_view.h"
+#include "worker.h"
 
 using std::isnan;
 using std::signbit;
@@ -43,7 +44,9 @@ static GLfloat *colors = nullptr;
 int n_vertices = 0;
 
 Histogram3dView::Histogram3dView(QWidget *p)
-        : QGLWidget(p), hist_(nullptr), dat_(nullptr), dat_n_(0), spinning_(true) {
+        : QGLWidget(p), work_offset_(0), dat_n_(0), offset_(0), spinning_(true) {
+    worker_ = new Worker(this);
+
     auto update_timer = new QTimer(this);
     QObject::connect(update_timer, SIGNAL(timeout()), this, SLOT(updateGL())); //, Qt::QueuedConnection);
     update_timer->start(100);
@@ -89,14 +92,10 @@ Histogram3dView::Histogram3dView(QWidget *p)
     }
     {
         auto cb = new QComboBox;
+        for (const auto &j : histo_dtype_names()) {
+            cb->addItem(QString::fromStdString(j));
+        }
         cb->setFixedSize(cb->sizeHint());
-        cb->addItem("U8");
-        cb->addItem("U12");
-        cb->addItem("U16");
-        cb->addItem("U32");
-        cb->addItem("U64");
-        cb->addItem("F32");
-        cb->addItem("F64");
         cb->setCurrentIndex(0);
         cb->setEditable(false);
         type_ = cb;
@@ -122,24 +121,42 @@ Histogram3dView::Histogram3dView(QWidget *p)
     layout->setRowStretch(r, 1);
 
     QObject::connect(thresh_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
-    QObject::connect(scale_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
+    QObject::connect(scale_, SIGNAL(valueChanged(int)), this, SLOT(draw_points()));
     QObject::connect(type_, SIGNAL(currentIndexChanged(int)), this, SLOT(regen_histo()));
     QObject::connect(overlap_, SIGNAL(toggled(bool)), this, SLOT(regen_histo()));
 }
 
 Histogram3dView::~Histogram3dView() {
-    delete[] hist_;
+    // The tasks of worker_ use work_acc_, they are stopped before it goes.
+    delete worker_;
     delete[] vertices;
     delete[] colors;
 }
 
-void Histogram3dView::setData(const unsigned char *dat, long n) {
+/// stop cancels the trigram counting of the worker and waits for it to return.
+void Histogram3dView::stop() {
+    worker_->cancel();
+    worker_->join();
+}
+
+void Histogram3dView::setData(const file_data_t &dat, offset_t n) {
     dat_ = dat;
     dat_n_ = n;
+    offset_ = 0;
 
     regen_histo();
 }
 
+/// setRange shows the histogram of the n bytes at offset of a file. When the previous histogram was of the same file,
+/// it is slid to the new range by only reading the bytes that entered or left it.
+void Histogram3dView::setRange(const file_data_t &dat, offset_t n, offset_t offset) {
+    dat_ = dat;
+    dat_n_ = n;
+    offset_ = offset;
+
+    update_histo(true);
+}
+
 void Histogram3dView::initializeGL() {
     glClearColor(0, 0, 0, 0);
     glEnable(GL_DEPTH_TEST);
@@ -246,27 +263,125 @@ void Histogram3dView::paintGL() {
     glFlush();
 }
 
+histo_dtype_t Histogram3dView::dtype() const {
+    return string_to_histo_dtype(type_->currentText().toStdString());
+}
+
+bool Histogram3dView::overlap() const {
+    return overlap_->isChecked();
+}
+
+/// setPrefetched shows the histogram of dat from acc computed ahead of time, falling back to setData() if acc does not
+/// cover n bytes or counts different tuples.
+void Histogram3dView::setPrefetched(const file_data_t &dat, offset_t n, const std::shared_ptr<const TupleHistoAccumulator> &acc) {
+    if (!acc || acc->size() != n || !acc->matches(3, dtype(), overlap())) {
+        setData(dat, n);
+        return;
+    }
+
+    dat_ = dat;
+    dat_n_ = n;
+    offset_ = 0;
+
+    // The worker takes its own copy of acc to go on from, so nothing is left for it to read.
+    update_histo(false, false, acc);
+}
+
+/// regen_histo computes the histogram in the background, the point cloud is updated once it is ready.
 void Histogram3dView::regen_histo() {
-    delete[] hist_;
-    hist_ = nullptr;
+    update_histo(false);
+}
+
+/// appendData extends the histogram to n bytes of dat, only the bytes beyond the previous length are read. dat must
+/// start at the same offset as the data last passed to setData().
+void Histogram3dView::appendData(const file_data_t &dat, offset_t n) {
+    dat_ = dat;
+    dat_n_ = n;
+
+    update_histo(true, true);
+}
+
+/// update_histo brings the histogram up to date with dat_ in the background and delivers the trigrams seen at least
+/// thresh_ times. The accumulator of the worker is reused where it can be, so the GUI thread never copies it.
+/// @param [in] reuse Whether the accumulator of the worker may be slid to dat_ if it holds another range of the file.
+/// @param [in] append Whether dat_ extends the bytes the accumulator of the worker has seen, though it may have been
+/// mapped again since.
+/// @param [in] seed When not null, a histogram of dat_ the worker starts from rather than its own.
+void Histogram3dView::update_histo(bool reuse, bool append, const std::shared_ptr<const TupleHistoAccumulator> &seed) {
+    file_data_t dat = dat_;
+    offset_t n = dat_n_;
+    offset_t offset = offset_;
+    histo_dtype_t dtype = this->dtype();
+    bool overlap = this->overlap();
+    offset_t thresh = thresh_->value();
+
+    int gen = worker_->restart();
+    Worker *worker = worker_;
+    worker_->post(gen, [this, worker, gen, dat, n, offset, dtype, overlap, thresh, reuse, append, seed] {
+        if (seed) {
+            work_acc_ = std::make_shared<TupleHistoAccumulator>(*seed);
+            work_dat_ = dat;
+            work_offset_ = offset;
+        }
 
-    histo_dtype_t t = string_to_histo_dtype(type_->currentText().toStdString());
+        bool keep = (reuse || seed) && work_acc_ && work_acc_->matches(3, dtype, overlap);
+        if (keep && append) {
+            keep = work_acc_->size() <= n;
+        } else if (keep) {
+            // The mapping is kept alive by work_dat_, so matching base addresses mean the same file.
+            keep = work_dat_.get() - work_offset_ == dat.get() - offset;
+            offset_t d = work_offset_ - offset;
+            if (keep && (d != 0 || work_acc_->size() > n)) {
+                offset_t cost = work_acc_->shift_cost(n, d);
+                keep = cost >= 0 && cost < n;
+                if (keep) work_acc_->shift(dat.get(), n, d);
+            }
+        }
 
-    hist_ = generate_histo_3d(dat_, dat_n_, t, overlap_->isChecked());
+        if (!keep) work_acc_ = std::make_shared<TupleHistoAccumulator>(3, dtype, overlap);
+        work_dat_ = dat;
+        work_offset_ = offset;
+
+        // A cancelled task leaves the accumulator consistent with the bytes it has seen, the next one goes on from it.
+        TupleHistoAccumulator &acc = *work_acc_;
+        offset_t s = acc.size();
+        if (!for_each_window(dat.get() + s, n - s, [&acc, worker, gen](const unsigned char *p, offset_t m) {
+            acc.add(p, m);
+            return !worker->cancelled(gen);
+        })) return;
+
+        // Only the trigrams that occur are visited, rather than all 256^3.
+        auto points = std::make_shared<points_t>();
+        acc.hist_3d()->for_each([&points, thresh](uint32_t i, offset_t cnt) {
+            if (cnt >= thresh) points->emplace_back(i, cnt);
+        });
+        worker->deliver(gen, [this, points] {
+            set_histo(points);
+        });
+    });
+}
 
-    parameters_changed();
+/// set_histo shows points, the trigrams seen often enough to be drawn.
+void Histogram3dView::set_histo(const std::shared_ptr<const points_t> &points) {
+    points_ = points;
+    draw_points();
+    emit(dataReady());
 }
 
+/// parameters_changed asks the worker for the trigrams above the new threshold, the histogram itself is kept.
 void Histogram3dView::parameters_changed() {
-    int thresh = thresh_->value();
+    if (!points_) return;
+
+    update_histo(true);
+}
+
+/// draw_points turns the delivered trigrams into the point cloud, brighter for more frequent trigrams.
+void Histogram3dView::draw_points() {
+    if (!points_) return;
+
     float scale_factor = scale_->value();
 
-    n_vertices = 0;
-    for (int i = 0; i < 256 * 256 * 256; i++) {
-        if (hist_[i] >= thresh) {
-            n_vertices++;
-        }
-    }
+    n_vertices = points_->size();
 
     delete[] vertices;
     vertices = nullptr;
@@ -276,33 +391,35 @@ void Histogram3dView::parameters_changed() {
     if (n_vertices > 0) {
         vertices = new GLfloat[n_vertices * 3];
         colors = new GLfloat[n_vertices * 3];
-        for (int i = 0, j = 0; i < 256 * 256 * 256; i++) {
-            if (hist_[i] >= thresh) {
-                float x = i / (256 * 256);
-                float y = (i % (256 * 256)) / 256;
-                float z = i % 256;
-                x = x / 255.;
-                y = y / 255.;
-                z = z / 255.;
-                /*
-                if(x < -1 || x > 1.0 ||
-                   y < -1 || y > 1.0 ||
-                   z < -1 || z > 1.0) {
-                  printf("Warning 3dpc %f %f %f\n", x, y, z);
-                }
-                */
-                vertices[j * 3 + 0] = x * 2. - 1.;
-                vertices[j * 3 + 1] = y * 2. - 1.;
-                vertices[j * 3 + 2] = z * 2. - 1.;
-
-                float cc = hist_[i] / scale_factor;
-                cc += .2;
-                if (cc > 1.) cc = 1.;
-                colors[j * 3 + 0] = cc;
-                colors[j * 3 + 1] = cc;
-                colors[j * 3 + 2] = cc;
-                j++;
+        int j = 0;
+        for (const auto &pt : *points_) {
+            uint32_t i = pt.first;
+            offset_t cnt = pt.second;
+
+            float x = i / (256 * 256);
+            float y = (i % (256 * 256)) / 256;
+            float z = i % 256;
+            x = x / 255.;
+            y = y / 255.;
+            z = z / 255.;
+            /*
+            if(x < -1 || x > 1.0 ||
+               y < -1 || y > 1.0 ||
+               z < -1 || z > 1.0) {
+              printf("Warning 3dpc %f %f %f\n", x, y, z);
             }
+            */
+            vertices[j * 3 + 0] = x * 2. - 1.;
+            vertices[j * 3 + 1] = y * 2. - 1.;
+            vertices[j * 3 + 2] = z * 2. - 1.;
+
+            float cc = cnt / scale_factor;
+            cc += .2;
+            if (cc > 1.) cc = 1.;
+            colors[j * 3 + 0] = cc;
+            colors[j * 3 + 1] = cc;
+            colors[j * 3 + 2] = cc;
+            j++;
         }
     }
 
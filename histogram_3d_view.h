@@ -22,22 +22,47 @@
 
 #include <QGLWidget>
 
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "file_source.h"
+#include "histogram_calc.h"
+#include "offset.h"
+
 class QSpinBox;
 
 class QComboBox;
 
 class QCheckBox;
 
+class Worker;
+
 class Histogram3dView : public QGLWidget {
 Q_OBJECT
 public:
+    /// A trigram and how often it occurs.
+    typedef std::vector<std::pair<uint32_t, offset_t> > points_t;
+
     explicit Histogram3dView(QWidget *p = nullptr);
 
     ~Histogram3dView() override;
 
+    void stop();
+
+    histo_dtype_t dtype() const;
+
+    bool overlap() const;
+
 public slots:
 
-    void setData(const unsigned char *dat, long n);
+    void setData(const file_data_t &dat, offset_t n);
+
+    void setRange(const file_data_t &dat, offset_t n, offset_t offset);
+
+    void appendData(const file_data_t &dat, offset_t n);
+
+    void setPrefetched(const file_data_t &dat, offset_t n, const std::shared_ptr<const TupleHistoAccumulator> &acc);
 
     void parameters_changed();
 
@@ -45,6 +70,8 @@ protected slots:
 
     void regen_histo();
 
+    void draw_points();
+
 protected:
     void initializeGL() override;
 
@@ -58,13 +85,31 @@ protected:
 
     void mouseReleaseEvent(QMouseEvent *event) override;
 
+    void update_histo(bool reuse, bool append = false,
+                      const std::shared_ptr<const TupleHistoAccumulator> &seed = nullptr);
+
+    void set_histo(const std::shared_ptr<const points_t> &points);
+
     QSpinBox *thresh_, *scale_;
     QComboBox *type_;
     QCheckBox *overlap_;
-    int *hist_;
-    const unsigned char *dat_;
-    long dat_n_;
+    // The delivered trigrams seen at least thresh_ times with their counts, drawn by draw_points().
+    std::shared_ptr<const points_t> points_;
+    // Only touched by the tasks of worker_: the accumulator they slide and extend in place, of the bytes at work_dat_,
+    // work_offset_ bytes into the file.
+    std::shared_ptr<TupleHistoAccumulator> work_acc_;
+    file_data_t work_dat_;
+    offset_t work_offset_;
+    file_data_t dat_;
+    offset_t dat_n_;
+    offset_t offset_;
     bool spinning_;
+
+    Worker *worker_;
+
+signals:
+
+    void dataReady();
 };
 
 #endif
@@ -17,393 +17,709 @@
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <cfloat>
 #include <cmath>
 #include <algorithm>
+#include <memory>
+#include <thread>
 
 #include <cstring>
 #include <cstdlib>
 
 #include "histogram_calc.h"
+#include "byte_histo.h"
+#include "quantize.h"
+
+// Most threads counting trigrams at once. Each scans the whole range for its share of the trigrams.
+static const int max_threads_3d = 8;
 
 using std::min;
 using std::max;
-using std::isinf;
-using std::isnan;
-using std::signbit;
 
 
+typedef struct {
+    const char *name;
+    histo_dtype_t dtype;
+} dtype_name_t;
+
+// In the order they are offered in the views, the little-endian types first.
+static const dtype_name_t dtype_names[] = {
+        {"U8",      u8},
+        {"S8",      s8},
+        {"U12",     u12},
+        {"U16",     u16},
+        {"S16",     s16},
+        {"U32",     u32},
+        {"S32",     s32},
+        {"U64",     u64},
+        {"S64",     s64},
+        {"F16",     f16},
+        {"BF16",    bf16},
+        {"F32",     f32},
+        {"F64",     f64},
+        {"U12 BE",  u12be},
+        {"U16 BE",  u16be},
+        {"S16 BE",  s16be},
+        {"U32 BE",  u32be},
+        {"S32 BE",  s32be},
+        {"U64 BE",  u64be},
+        {"S64 BE",  s64be},
+        {"F16 BE",  f16be},
+        {"BF16 BE", bf16be},
+        {"F32 BE",  f32be},
+        {"F64 BE",  f64be},
+};
+
 /// string_to_histo_dtype returns a histo_dtype_t type corresponding to the type named type.
 /// @param [in] s The name of the type
 /// @return The associated histo_dtype_t type.
 histo_dtype_t string_to_histo_dtype(const std::string &s) {
-    histo_dtype_t t;
-
-    if (s == "U8") t = u8;
-    else if (s == "U12") t = u12;
-    else if (s == "U16") t = u16;
-    else if (s == "U32") t = u32;
-    else if (s == "U64") t = u64;
-    else if (s == "F32") t = f32;
-    else if (s == "F64") t = f64;
-    else t = none;
-
-    return t;
-}
-
-
-template<class T>
-void hist_float_helper_2d(int *hist, T *dat_f, long n) {
-    for (long i = 0; i < n / long(sizeof(T)) - 1; i++) {
-        int a1;
-        int a2;
-        if (sizeof(T) == 4) {
-            a1 = ((dat_f[i + 0] / FLT_MAX) * 255. + 255.) / 2.;
-            a2 = ((dat_f[i + 1] / FLT_MAX) * 255. + 255.) / 2.;
-        } else if (sizeof(T) == 8) {
-            a1 = ((dat_f[i + 0] / DBL_MAX) * 255. + 255.) / 2.;
-            a2 = ((dat_f[i + 1] / DBL_MAX) * 255. + 255.) / 2.;
-        } else {
-            abort();
-        }
+    for (const auto &j : dtype_names) {
+        if (s == j.name) return j.dtype;
+    }
+    return none;
+}
 
-        if (isnan(dat_f[i + 0])) a1 = 255;
-        if (isnan(dat_f[i + 1])) a2 = 255;
+/// histo_dtype_names returns the names of all types, as accepted by string_to_histo_dtype().
+std::vector<std::string> histo_dtype_names() {
+    std::vector<std::string> rv;
+    for (const auto &j : dtype_names) {
+        rv.emplace_back(j.name);
+    }
+    return rv;
+}
+
+/// with_quantizer calls fn with a Quantizer for dtype, so a kernel templated on it is instantiated for every type.
+/// Nothing is called for none.
+template<class F>
+static void with_quantizer(histo_dtype_t dtype, F fn) {
+    switch (dtype) {
+        case none:
+            break;
+        case u8:
+            fn(Quantizer<uint8_t, unsigned_kind, false>());
+            break;
+        case s8:
+            fn(Quantizer<uint8_t, signed_kind, false>());
+            break;
+        case u12:
+            fn(Quantizer<uint16_t, unsigned_kind, false, 12>());
+            break;
+        case u16:
+            fn(Quantizer<uint16_t, unsigned_kind, false>());
+            break;
+        case s16:
+            fn(Quantizer<uint16_t, signed_kind, false>());
+            break;
+        case u32:
+            fn(Quantizer<uint32_t, unsigned_kind, false>());
+            break;
+        case s32:
+            fn(Quantizer<uint32_t, signed_kind, false>());
+            break;
+        case u64:
+            fn(Quantizer<uint64_t, unsigned_kind, false>());
+            break;
+        case s64:
+            fn(Quantizer<uint64_t, signed_kind, false>());
+            break;
+        case f16:
+        case bf16:
+            // The sign and high bits of either half precision format order the same way.
+            fn(Quantizer<uint16_t, float_kind, false>());
+            break;
+        case f32:
+            fn(Quantizer<uint32_t, float_kind, false>());
+            break;
+        case f64:
+            fn(Quantizer<uint64_t, float_kind, false>());
+            break;
+        case u12be:
+            fn(Quantizer<uint16_t, unsigned_kind, true, 12>());
+            break;
+        case u16be:
+            fn(Quantizer<uint16_t, unsigned_kind, true>());
+            break;
+        case s16be:
+            fn(Quantizer<uint16_t, signed_kind, true>());
+            break;
+        case u32be:
+            fn(Quantizer<uint32_t, unsigned_kind, true>());
+            break;
+        case s32be:
+            fn(Quantizer<uint32_t, signed_kind, true>());
+            break;
+        case u64be:
+            fn(Quantizer<uint64_t, unsigned_kind, true>());
+            break;
+        case s64be:
+            fn(Quantizer<uint64_t, signed_kind, true>());
+            break;
+        case f16be:
+        case bf16be:
+            fn(Quantizer<uint16_t, float_kind, true>());
+            break;
+        case f32be:
+            fn(Quantizer<uint32_t, float_kind, true>());
+            break;
+        case f64be:
+            fn(Quantizer<uint64_t, float_kind, true>());
+            break;
+    }
+}
 
-        if (isnan(dat_f[i + 0])) { if (signbit(dat_f[i + 0])) { a1 = 0; } else { a1 = 255; }}
-        if (isnan(dat_f[i + 1])) { if (signbit(dat_f[i + 1])) { a2 = 0; } else { a2 = 255; }}
+/// histo_dtype_size returns the size of an element of dtype.
+/// @param [in] dtype The type of the element.
+/// @return The size in bytes, or 1 for none.
+int histo_dtype_size(histo_dtype_t dtype) {
+    int rv = 1;
+    with_quantizer(dtype, [&rv](auto q) {
+        rv = decltype(q)::size;
+    });
+    return rv;
+}
 
-        if (isinf(dat_f[i + 0])) { if (signbit(dat_f[i + 0])) { a1 = 0; } else { a1 = 255; }}
-        if (isinf(dat_f[i + 1])) { if (signbit(dat_f[i + 1])) { a2 = 0; } else { a2 = 255; }}
+HistoAccumulator::HistoAccumulator()
+        : n_(0) {
+    memset(cnt_, 0, sizeof(cnt_));
+}
 
-#if 0
-        if(a1 < 0 || a1 > 255) {
-          printf("0 %d %f\n", a1, dat_f[i+0]);
-        }
-        if(a2 < 0 || a2 > 255) {
-          printf("1 %d %f %d %d\n", a2, dat_f[i+1], isnan(dat_f[i+1]), dat_f[i+1] < 0);
-        }
-#endif
+/// add counts the bytes of the next window of the stream.
+/// @param [in] dat_u8 Byte data to be analyzed.
+/// @param [in] n Length of dat_u8 in bytes.
+void HistoAccumulator::add(const unsigned char *dat_u8, offset_t n) {
+    n_ += max(n, offset_t(0));
 
-        if (a1 < 0) a1 = 0;
-        if (a2 < 0) a2 = 0;
+    // Counted in 64-bit integers, a float counter stops incrementing once it reaches 2^24.
+    add_byte_histo(cnt_, dat_u8, n);
+}
 
-        if (a1 > 255) a1 = 255;
-        if (a2 > 255) a2 = 255;
+/// add_counts adds bytes that were counted elsewhere, such as by a BlockIndex.
+/// @param [in] cnt The count of each byte value, 256 entries.
+/// @param [in] n The number of bytes counted.
+void HistoAccumulator::add_counts(const offset_t *cnt, offset_t n) {
+    n_ += n;
 
-        hist[a1 * 256 + a2]++;
+    for (int i = 0; i < 256; i++) {
+        cnt_[i] += cnt[i];
     }
 }
 
-/// generate_histo computes the histogram for each byte within dat_u8.
-/// @param [in] dat_u8 Byte data to be analyzed.
-/// @param [in] n Length of dat_u8 in bytes
-/// @return The calculated histogram of each byte of dat_u8, as vector of length 256 scaled between [0., 1.]
-float *generate_histo(const unsigned char *dat_u8, long n) { //, histo_dtype_t dtype) {
-    auto hist = new float[256];
-    memset(hist, 0, sizeof(hist[0]) * 256);
+/// shift_cost returns the number of bytes shift() reads.
+/// @param [in] n Length of the new range in bytes.
+/// @param [in] d Offset of the current range relative to the new one.
+offset_t HistoAccumulator::shift_cost(offset_t n, offset_t d) const {
+    offset_t e = d + n_;
+    return max(min(e, offset_t(0)) - d, offset_t(0)) + max(e - max(d, n), offset_t(0)) +
+           max(min(n, d), offset_t(0)) + max(n - max(offset_t(0), e), offset_t(0));
+}
 
-    //if(dtype != u8) {
-    //  abort()
-    //}
+/// shift moves the counted range to n bytes at dat_u8, removing the bytes that left it and adding the bytes that
+/// entered it. The bytes of the current range must still be readable at their previous addresses.
+/// @param [in] dat_u8 Byte data of the new range.
+/// @param [in] n Length of the new range in bytes.
+/// @param [in] d Offset of the current range relative to the new one, negative if it started before dat_u8.
+void HistoAccumulator::shift(const unsigned char *dat_u8, offset_t n, offset_t d) {
+    offset_t e = d + n_;
 
-    for (long i = 0; i < n; i++) {
-        hist[dat_u8[i]]++;
-    }
+    for (offset_t i = d; i < min(e, offset_t(0)); i++) cnt_[dat_u8[i]]--;
+    for (offset_t i = max(d, n); i < e; i++) cnt_[dat_u8[i]]--;
+    for (offset_t i = 0; i < min(n, d); i++) cnt_[dat_u8[i]]++;
+    for (offset_t i = max(offset_t(0), e); i < n; i++) cnt_[dat_u8[i]]++;
 
-    float mx = 0.;
+    n_ = n;
+}
+
+/// size returns the number of bytes seen so far.
+offset_t HistoAccumulator::size() const {
+    return n_;
+}
+
+/// result returns the histogram of the bytes seen so far.
+/// @return The histogram, as vector of length 256 scaled between [0., 1.]
+float *HistoAccumulator::result() const {
+    offset_t mx = 0;
     for (int i = 0; i < 256; i++) {
-        mx = max(mx, hist[i]);
+        mx = max(mx, cnt_[i]);
     }
+
+    auto hist = new float[256];
     for (int i = 0; i < 256; i++) {
-        hist[i] /= mx;
+        hist[i] = mx > 0 ? cnt_[i] / double(mx) : 0.f;
     }
 
     return hist;
 }
 
-/// generate_histo_2d computes a 2d histogram of each overlapping digram within dat_u8.
-/// @param [in] dat_u8 Byte data to be analyzed.
-/// @param [in] n Length of dat_u8 in bytes.
-/// @param [in] dtype The type of data to cast dat_u8 as.
-/// @return The 2d histogram, as a linearized matrix of size 256 * 256, containing counts of each digram,
-int *generate_histo_2d(const unsigned char *dat_u8, long n, histo_dtype_t dtype) {
-    auto hist = new int[256 * 256];
-    memset(hist, 0, sizeof(hist[0]) * 256 * 256);
+/// add_histo_2d_q adds each overlapping digram of Q elements within dat_u8 to hist, or removes it when inc is -1.
+template<class Q>
+static void add_histo_2d_q(offset_t *hist, const unsigned char *dat_u8, offset_t n, int inc) {
+    offset_t ne = n / Q::size;
+    if (ne < 2) return;
 
-    switch (dtype) {
-        case none:
-            break;
-        case u8: {
-            for (long i = 0; i < n - 1; i++) {
-                int a1 = dat_u8[i + 0];
-                int a2 = dat_u8[i + 1];
+    int a1 = Q::q(dat_u8);
+    for (offset_t i = 1; i < ne; i++) {
+        int a2 = Q::q(dat_u8 + i * Q::size);
 
-                hist[a1 * 256 + a2]++;
-            }
-        }
-            break;
-        case u16: {
-            auto dat_u16 = (const unsigned short *) dat_u8;
-            for (long i = 0; i < n / 2 - 1; i++) {
-                int a1 = dat_u16[i + 0] / float(0xffff) * 255.;
-                int a2 = dat_u16[i + 1] / float(0xffff) * 255.;
+        hist[a1 * 256 + a2] += inc;
+        a1 = a2;
+    }
+}
 
-                hist[a1 * 256 + a2]++;
-            }
-        }
-            break;
-        case u32: {
-            auto dat_u32 = (const unsigned int *) dat_u8;
-            for (long i = 0; i < n / 4 - 1; i++) {
-                int a1 = dat_u32[i + 0] / float(0xffffffff) * 255.;
-                int a2 = dat_u32[i + 1] / float(0xffffffff) * 255.;
+/// add_histo_2d adds each overlapping digram within dat_u8 to hist, or removes it when inc is -1.
+static void add_histo_2d(offset_t *hist, const unsigned char *dat_u8, offset_t n, histo_dtype_t dtype, int inc = 1) {
+    with_quantizer(dtype, [=](auto q) {
+        add_histo_2d_q<decltype(q)>(hist, dat_u8, n, inc);
+    });
+}
 
-                hist[a1 * 256 + a2]++;
-            }
-        }
-            break;
-        case u64: {
-            auto dat_u64 = (const unsigned long *) dat_u8;
-            for (long i = 0; i < n / 8 - 1; i++) {
-                int a1 = dat_u64[i + 0] / float(0xffffffffffffffff) * 255.;
-                int a2 = dat_u64[i + 1] / float(0xffffffffffffffff) * 255.;
+/// add_histo_3d_q adds each trigram of Q elements starting at every st'th element within dat_u8 to hist, or removes it
+/// when inc is -1. Only the trigrams whose first element is within [a_lo, a_hi) are counted, as key - key_base.
+template<class Q>
+static void add_histo_3d_q(SparseHisto &hist, const unsigned char *dat_u8, offset_t n, int st, int inc, int a_lo,
+                           int a_hi, uint32_t key_base) {
+    offset_t ne = n / Q::size;
 
-                hist[a1 * 256 + a2]++;
-            }
-        }
-            break;
-        case f32: {
-            auto dat_f32 = (const float *) dat_u8;
-            hist_float_helper_2d(hist, dat_f32, n);
-        }
-            break;
-        case f64: {
-            auto dat_f64 = (const double *) dat_u8;
-            hist_float_helper_2d(hist, dat_f64, n);
-        }
-            break;
+    for (offset_t i = 0; i + 2 < ne; i += st) {
+        int a1 = Q::q(dat_u8 + (i + 0) * Q::size);
+        if (a1 < a_lo || a1 >= a_hi) continue;
+        int a2 = Q::q(dat_u8 + (i + 1) * Q::size);
+        int a3 = Q::q(dat_u8 + (i + 2) * Q::size);
+
+        hist.add(uint32_t(a1 * 256 * 256 + a2 * 256 + a3) - key_base, inc);
     }
+}
+
+/// add_histo_3d adds each trigram starting at every st'th element within dat_u8 to hist, or removes it when inc is -1.
+/// Only the trigrams whose first element is within [a_lo, a_hi) are counted, as key - key_base.
+static void add_histo_3d(SparseHisto &hist, const unsigned char *dat_u8, offset_t n, histo_dtype_t dtype, int st,
+                         int inc = 1, int a_lo = 0, int a_hi = 256, uint32_t key_base = 0) {
+    with_quantizer(dtype, [&hist, dat_u8, n, st, inc, a_lo, a_hi, key_base](auto q) {
+        add_histo_3d_q<decltype(q)>(hist, dat_u8, n, st, inc, a_lo, a_hi, key_base);
+    });
+}
 
-#if 0
-    int n_vertices = 0;
-    float m=10000000, M=-1, a=0.;
-    for(int i=0; i<256*256; i++) {
-      if(hist[i] > 0) {
-        n_vertices++;
-
-        if(m > hist[i]) m = hist[i];
-        if(M < hist[i]) M = hist[i];
-        a += hist[i];
-      }
+/// TupleHistoAccumulator constructor.
+/// @param [in] dims 2 to count digrams, 3 to count trigrams.
+/// @param [in] dtype The type of data to cast the stream as.
+/// @param [in] overlap Whether consecutive trigrams overlap, ignored for digrams.
+TupleHistoAccumulator::TupleHistoAccumulator(int dims, histo_dtype_t dtype, bool overlap)
+        : n_(0), dims_(dims), dtype_(dtype), st_(dims == 3 && !overlap ? 3 : 1), hist_(nullptr), hist_3d_(nullptr) {
+    // Most data has far fewer distinct trigrams than the 2^24 possible, a dense array would mostly hold zeros.
+    if (dims_ == 3) {
+        hist_3d_ = new SparseHisto(256 * 256 * 256);
+    } else {
+        hist_ = new offset_t[hist_n()];
+        memset(hist_, 0, sizeof(hist_[0]) * hist_n());
     }
-    a /= n_vertices;
-    printf("%d %f %f %f\n", n_vertices, m, M, a);
-#endif
+}
 
-    return hist;
+/// The copy constructor snapshots o, so that more data can be added without disturbing readers of o.
+TupleHistoAccumulator::TupleHistoAccumulator(const TupleHistoAccumulator &o)
+        : n_(o.n_), dims_(o.dims_), dtype_(o.dtype_), st_(o.st_), hist_(nullptr), hist_3d_(nullptr),
+          carry_(o.carry_) {
+    if (o.hist_3d_) {
+        hist_3d_ = new SparseHisto(*o.hist_3d_);
+    }
+    if (o.hist_) {
+        hist_ = new offset_t[hist_n()];
+        memcpy(hist_, o.hist_, sizeof(hist_[0]) * hist_n());
+    }
 }
 
-template<class T>
-void hist_float_helper_3d(int *hist, T *dat_f, long n, int st) {
-    for (long i = 0; i < n / long(sizeof(T)) - 2; i += st) {
-        int a1;
-        int a2;
-        int a3;
-        if (sizeof(T) == 4) {
-            a1 = ((dat_f[i + 0] / FLT_MAX) * 255. + 255.) / 2.;
-            a2 = ((dat_f[i + 1] / FLT_MAX) * 255. + 255.) / 2.;
-            a3 = ((dat_f[i + 2] / FLT_MAX) * 255. + 255.) / 2.;
-        } else if (sizeof(T) == 8) {
-            a1 = ((dat_f[i + 0] / DBL_MAX) * 255. + 255.) / 2.;
-            a2 = ((dat_f[i + 1] / DBL_MAX) * 255. + 255.) / 2.;
-            a3 = ((dat_f[i + 2] / DBL_MAX) * 255. + 255.) / 2.;
-        } else {
-            abort();
+TupleHistoAccumulator::~TupleHistoAccumulator() {
+    delete[] hist_;
+    delete hist_3d_;
+}
+
+/// hist_n returns the number of bins of the histogram, 256 per element of a tuple.
+int TupleHistoAccumulator::hist_n() const {
+    return dims_ == 3 ? 256 * 256 * 256 : 256 * 256;
+}
+
+/// count adds the tuples of dat_u8 to the histogram, the first tuple starting at dat_u8.
+/// @return The number of bytes consumed, which is the offset of the first tuple that was not complete.
+offset_t TupleHistoAccumulator::count(const unsigned char *dat_u8, offset_t n) {
+    offset_t es = histo_dtype_size(dtype_);
+    offset_t nt = tuples(n);
+
+    int n_threads = histo_threads(n);
+    if (dims_ == 3) n_threads = min(n_threads, max_threads_3d);
+
+    if (n_threads <= 1 || nt < n_threads) {
+        count_run(dat_u8, 0, nt, 1);
+    } else if (dims_ == 3) {
+        count_3d(dat_u8, nt, n_threads);
+    } else {
+        // Each thread counts a contiguous run of tuples into a partial histogram of its own, the first directly into
+        // this one. The partials are then merged pairwise in parallel, in log2(n_threads) rounds. Counts are integers,
+        // so the result is identical to counting serially.
+        std::vector<std::unique_ptr<TupleHistoAccumulator>> parts(n_threads);
+        std::vector<TupleHistoAccumulator *> acc(n_threads, this);
+        for (int k = 1; k < n_threads; k++) {
+            parts[k].reset(new TupleHistoAccumulator(dims_, dtype_, st_ == 1));
+            acc[k] = parts[k].get();
+        }
+
+        offset_t m = (nt + n_threads - 1) / n_threads;
+        std::vector<std::thread> threads;
+        for (int k = 1; k < n_threads; k++) {
+            threads.emplace_back([&acc, dat_u8, k, m, nt] {
+                acc[k]->count_run(dat_u8, k * m, min(nt, (k + 1) * m), 1);
+            });
+        }
+        count_run(dat_u8, 0, min(nt, m), 1);
+        for (auto &t : threads) t.join();
+
+        for (int step = 1; step < n_threads; step *= 2) {
+            threads.clear();
+            for (int k = 2 * step; k < n_threads; k += 2 * step) {
+                if (k + step < n_threads) {
+                    threads.emplace_back([&acc, k, step] {
+                        acc[k]->merge(*acc[k + step]);
+                    });
+                }
+            }
+            acc[0]->merge(*acc[step]);
+            for (auto &t : threads) t.join();
         }
+    }
 
-        if (isnan(dat_f[i + 0])) a1 = 255;
-        if (isnan(dat_f[i + 1])) a2 = 255;
-        if (isnan(dat_f[i + 2])) a3 = 255;
+    return min(n, nt * st_ * es);
+}
 
-        if (isnan(dat_f[i + 0])) { if (signbit(dat_f[i + 0])) { a1 = 0; } else { a1 = 255; }}
-        if (isnan(dat_f[i + 1])) { if (signbit(dat_f[i + 1])) { a2 = 0; } else { a2 = 255; }}
-        if (isnan(dat_f[i + 2])) { if (signbit(dat_f[i + 2])) { a3 = 0; } else { a3 = 255; }}
+/// count_3d adds the first nt trigrams of dat_u8 on n_threads threads. Each thread scans all of them and counts those
+/// whose first element falls in its share of the values, so no two threads count the same trigram. Once the histogram
+/// is dense they add to it directly. Before that, each counts into a histogram of its part of the key space, whose
+/// dense array is a fraction of the whole, and these are merged, so the counting never holds more than one more dense
+/// array, unlike a dense partial histogram per thread.
+void TupleHistoAccumulator::count_3d(const unsigned char *dat_u8, offset_t nt, int n_threads) {
+    offset_t es = histo_dtype_size(dtype_);
+    offset_t n = (nt - 1) * st_ * es + dims_ * es;
+    bool shared = hist_3d_->is_dense();
+
+    std::vector<std::unique_ptr<SparseHisto>> parts(n_threads);
+    auto run = [this, &parts, dat_u8, n, n_threads, shared](int k) {
+        int a_lo = 256 * k / n_threads, a_hi = 256 * (k + 1) / n_threads;
+        if (shared) {
+            add_histo_3d(*hist_3d_, dat_u8, n, dtype_, st_, 1, a_lo, a_hi);
+        } else {
+            parts[k].reset(new SparseHisto(uint32_t(a_hi - a_lo) * 256 * 256));
+            add_histo_3d(*parts[k], dat_u8, n, dtype_, st_, 1, a_lo, a_hi, uint32_t(a_lo) * 256 * 256);
+        }
+    };
 
-        if (isinf(dat_f[i + 0])) { if (signbit(dat_f[i + 0])) { a1 = 0; } else { a1 = 255; }}
-        if (isinf(dat_f[i + 1])) { if (signbit(dat_f[i + 1])) { a2 = 0; } else { a2 = 255; }}
-        if (isinf(dat_f[i + 2])) { if (signbit(dat_f[i + 2])) { a3 = 0; } else { a3 = 255; }}
+    std::vector<std::thread> threads;
+    for (int k = 1; k < n_threads; k++) threads.emplace_back(run, k);
+    run(0);
+    for (auto &t : threads) t.join();
 
-/*
-    if(a1 < 0 || a1 > 255) {
-      printf("0 %d %f\n", a1, dat_f[i+0]);
-    }
-    if(a3 < 0 || a3 > 255) {
-      printf("2 %d %f\n", a3, dat_f[i+2]);
+    if (!shared) {
+        for (int k = 0; k < n_threads; k++) {
+            hist_3d_->merge(*parts[k], uint32_t(256 * k / n_threads) * 256 * 256);
+            parts[k].reset();
+        }
     }
-    if(a2 < 0 || a2 > 255) {
-      printf("1 %d %f %d %d\n", a2, dat_f[i+1], isnan(dat_f[i+1]), dat_f[i+1] < 0);
+}
+
+/// merge adds the histogram of o, which must count the same tuples.
+void TupleHistoAccumulator::merge(const TupleHistoAccumulator &o) {
+    if (hist_3d_) {
+        hist_3d_->merge(*o.hist_3d_);
+    } else {
+        for (int i = 0; i < hist_n(); i++) {
+            hist_[i] += o.hist_[i];
+        }
     }
-*/
+}
+
+/// tuples returns the number of complete tuples within n bytes.
+offset_t TupleHistoAccumulator::tuples(offset_t n) const {
+    offset_t ne = n / histo_dtype_size(dtype_);
+    return ne >= dims_ ? (ne - dims_) / st_ + 1 : 0;
+}
 
-        if (a1 < 0) a1 = 0;
-        if (a2 < 0) a2 = 0;
-        if (a3 < 0) a3 = 0;
+/// count_run adds (inc = 1) or removes (inc = -1) the tuples k0 up to k1 of dat_u8, which may lie before dat_u8.
+void TupleHistoAccumulator::count_run(const unsigned char *dat_u8, offset_t k0, offset_t k1, int inc) {
+    if (k1 <= k0) return;
 
-        if (a1 > 255) a1 = 255;
-        if (a2 > 255) a2 = 255;
-        if (a3 > 255) a3 = 255;
+    offset_t es = histo_dtype_size(dtype_);
+    offset_t step = st_ * es;
+    offset_t n = (k1 - k0 - 1) * step + dims_ * es;
 
-        hist[a1 * 256 * 256 + a2 * 256 + a3]++;
-    }
+    if (dims_ == 3) add_histo_3d(*hist_3d_, dat_u8 + k0 * step, n, dtype_, st_, inc);
+    else add_histo_2d(hist_, dat_u8 + k0 * step, n, dtype_, inc);
 }
 
-/// generate_histo_3d computes a 3d histogram of each overlapping digram within dat_u8.
+/// add counts the tuples of the next window of the stream.
 /// @param [in] dat_u8 Byte data to be analyzed.
 /// @param [in] n Length of dat_u8 in bytes.
-/// @param [in] dtype The type of data to cast dat_u8 as.
-/// @param [in] overlap Whether to move by a single byte (true) or length of dtype (false) (not implemented correctly.)
-/// @return The 2d histogram, as a linearized matrix of size 256 * 256, containing counts of each digram,
-int *generate_histo_3d(const unsigned char *dat_u8, long n, histo_dtype_t dtype, bool overlap) {
-    auto hist = new int[256 * 256 * 256];
-    memset(hist, 0, sizeof(hist[0]) * 256 * 256 * 256);
+void TupleHistoAccumulator::add(const unsigned char *dat_u8, offset_t n) {
+    if (n <= 0) return;
 
-    int st = overlap ? 1 : 3;
+    n_ += n;
 
-    switch (dtype) {
-        case none:
-            break;
-        case u8: {
-            for (long i = 0; i < n - 2; i += st) {
-                int a1 = dat_u8[i + 0];
-                int a2 = dat_u8[i + 1];
-                int a3 = dat_u8[i + 2];
+    offset_t i = 0;
 
-                hist[a1 * 256 * 256 + a2 * 256 + a3]++;
-            }
-        }
-            break;
-        case u12: {
-            auto dat_u16 = (const unsigned short *) dat_u8;
-            for (long i = 0; i < n / 2 - 2; i += st) {
-                int a1 = (dat_u16[i + 0] & 0x0fff) / float(0x0fff) * 255.;
-                int a2 = (dat_u16[i + 1] & 0x0fff) / float(0x0fff) * 255.;
-                int a3 = (dat_u16[i + 2] & 0x0fff) / float(0x0fff) * 255.;
-
-                hist[a1 * 256 * 256 + a2 * 256 + a3]++;
-            }
-        }
-            break;
-        case u16: {
-            auto dat_u16 = (const unsigned short *) dat_u8;
-            for (long i = 0; i < n / 2 - 2; i += st) {
-                int a1 = dat_u16[i + 0] / float(0xffff) * 255.;
-                int a2 = dat_u16[i + 1] / float(0xffff) * 255.;
-                int a3 = dat_u16[i + 2] / float(0xffff) * 255.;
-
-                hist[a1 * 256 * 256 + a2 * 256 + a3]++;
-            }
-        }
-            break;
-        case u32: {
-            auto dat_u32 = (const unsigned int *) dat_u8;
-            for (long i = 0; i < n / 4 - 2; i += st) {
-                int a1 = dat_u32[i + 0] / float(0xffffffff) * 255.;
-                int a2 = dat_u32[i + 1] / float(0xffffffff) * 255.;
-                int a3 = dat_u32[i + 2] / float(0xffffffff) * 255.;
-
-                hist[a1 * 256 * 256 + a2 * 256 + a3]++;
-            }
-        }
-            break;
-        case u64: {
-            auto dat_u64 = (const unsigned long *) dat_u8;
-            for (long i = 0; i < n / 8 - 2; i += st) {
-                int a1 = dat_u64[i + 0] / float(0xffffffffffffffff) * 255.;
-                int a2 = dat_u64[i + 1] / float(0xffffffffffffffff) * 255.;
-                int a3 = dat_u64[i + 2] / float(0xffffffffffffffff) * 255.;
-
-                hist[a1 * 256 * 256 + a2 * 256 + a3]++;
-            }
-        }
-            break;
-        case f32: {
-            auto dat_f32 = (const float *) dat_u8;
-            hist_float_helper_3d(hist, dat_f32, n, st);
-        }
-            break;
-        case f64: {
-            auto dat_f64 = (const double *) dat_u8;
-            hist_float_helper_3d(hist, dat_f64, n, st);
+    if (!carry_.empty()) {
+        // Complete the tuples that started in an earlier window, joined with just enough of this window that the next
+        // tuple starts within dat_u8.
+        offset_t cn = carry_.size();
+        offset_t m = min(n, offset_t(dims_ * st_ * histo_dtype_size(dtype_)));
+        carry_.insert(carry_.end(), dat_u8, dat_u8 + m);
+
+        offset_t used = count(carry_.data(), carry_.size());
+        if (m == n) {
+            carry_.erase(carry_.begin(), carry_.begin() + used);
+            return;
         }
-            break;
-    }
 
-#if 0
-    n_vertices = 0;
-    float m=10000000, M=-1, a=0.;
-    for(int i=0; i<256*256*256; i++) {
-      if(hist[i] > 0) {
-        n_vertices++;
-
-        if(m > hist[i]) m = hist[i];
-        if(M < hist[i]) M = hist[i];
-        a += hist[i];
-      }
+        i = used - cn;
+        carry_.clear();
     }
-    a /= n_vertices;
-    printf("%d %f %f %f\n", n_vertices, m, M, a);
-#endif
 
-    return hist;
+    i += count(dat_u8 + i, n - i);
+    carry_.assign(dat_u8 + i, dat_u8 + n);
 }
 
-/// generate_entropy computes the entropy within bs-sized blocks of dat_u8.
-/// @param [in] dat_u8 Byte data to be analyzed.
+/// add_counts starts an empty u8 digram accumulator from digrams that were counted elsewhere, such as by a BlockIndex,
+/// leaving it in the same state as add(dat_u8, n) would.
+/// @param [in] cnt The count of each digram of dat_u8, as a linearized matrix of size 256 * 256.
+/// @param [in] dat_u8 The bytes that were counted, only the last one is read.
 /// @param [in] n Length of dat_u8 in bytes.
-/// @param [out] rv_len The length of the return vector.
-/// @param [in] bs The block sized used to analyze dat_u8.
-/// @return The calculated entropy for each block of dat_u8, as vector of length rv_len scaled between [0., 1.]
-float *generate_entropy(const unsigned char *dat_u8, long n, long &rv_len, int bs) { //, histo_dtype_t dtype) {
-    if (n <= 0) {
-        rv_len = 0;
-        return nullptr;
+/// @return false if the accumulator is not empty or counts other tuples, in which case it is left unchanged.
+bool TupleHistoAccumulator::add_counts(const offset_t *cnt, const unsigned char *dat_u8, offset_t n) {
+    if (n_ != 0 || !matches(2, u8, true)) return false;
+    if (n <= 0) return true;
+
+    n_ = n;
+
+    memcpy(hist_, cnt, sizeof(hist_[0]) * 256 * 256);
+
+    // The last byte starts the digram completed by the next window.
+    carry_.assign(dat_u8 + n - 1, dat_u8 + n);
+
+    return true;
+}
+
+/// shift_cost returns the number of bytes shift() reads, or -1 if the tuples of the two ranges are not aligned.
+/// @param [in] n Length of the new range in bytes.
+/// @param [in] d Offset of the current range relative to the new one.
+offset_t TupleHistoAccumulator::shift_cost(offset_t n, offset_t d) const {
+    offset_t step = st_ * histo_dtype_size(dtype_);
+    if (d % step != 0) return -1;
+
+    // In tuples, the current range covers [a0, a1) and the new one [0, nt).
+    offset_t a0 = d / step;
+    offset_t a1 = a0 + tuples(n_);
+    offset_t nt = tuples(n);
+
+    offset_t k = max(min(a1, offset_t(0)) - a0, offset_t(0)) + max(a1 - max(a0, nt), offset_t(0)) +
+                 max(min(nt, a0), offset_t(0)) + max(nt - max(offset_t(0), a1), offset_t(0));
+    return k * step;
+}
+
+/// shift moves the counted range to n bytes at dat_u8, removing the tuples that left it and adding the tuples that
+/// entered it. The bytes of the current range must still be readable at their previous addresses.
+/// @param [in] dat_u8 Byte data of the new range.
+/// @param [in] n Length of the new range in bytes.
+/// @param [in] d Offset of the current range relative to the new one, a multiple of the tuple step (see
+/// shift_cost()).
+void TupleHistoAccumulator::shift(const unsigned char *dat_u8, offset_t n, offset_t d) {
+    offset_t step = st_ * histo_dtype_size(dtype_);
+
+    offset_t a0 = d / step;
+    offset_t a1 = a0 + tuples(n_);
+    offset_t nt = tuples(n);
+
+    count_run(dat_u8, a0, min(a1, offset_t(0)), -1);
+    count_run(dat_u8, max(a0, nt), a1, -1);
+    count_run(dat_u8, 0, min(nt, a0), 1);
+    count_run(dat_u8, max(offset_t(0), a1), nt, 1);
+
+    n_ = n;
+    carry_.assign(dat_u8 + min(n, nt * step), dat_u8 + n);
+}
+
+/// size returns the number of bytes seen so far.
+offset_t TupleHistoAccumulator::size() const {
+    return n_;
+}
+
+/// matches returns whether the accumulator counts the same tuples as one constructed with the given arguments.
+bool TupleHistoAccumulator::matches(int dims, histo_dtype_t dtype, bool overlap) const {
+    return dims_ == dims && dtype_ == dtype && st_ == (dims == 3 && !overlap ? 3 : 1);
+}
+
+/// hist returns the digram histogram seen so far, which changes as more data is added. Null when counting trigrams.
+const offset_t *TupleHistoAccumulator::hist() const {
+    return hist_;
+}
+
+/// hist_3d returns the trigram histogram seen so far, which changes as more data is added. Null when counting digrams.
+const SparseHisto *TupleHistoAccumulator::hist_3d() const {
+    return hist_3d_;
+}
+
+/// memory returns the number of bytes held by the histogram.
+size_t TupleHistoAccumulator::memory() const {
+    return hist_3d_ ? hist_3d_->memory() : sizeof(hist_[0]) * hist_n();
+}
+
+// Fixed point scale of the n * ln(n) table. Sums of it stay exact integers, so sliding a window keeps no rounding
+// error however far it slides, and fit 64 bits for blocks of up to 2^31 bytes.
+static const double nlogn_scale = double(1 << 24);
+
+/// nlogn_table returns c * ln(c) for each count c from 0 to n, in the fixed point of nlogn_entropy().
+std::shared_ptr<const std::vector<int64_t>> nlogn_table(int n) {
+    auto lut = std::make_shared<std::vector<int64_t>>(n + 1);
+    for (int c = 1; c <= n; c++) {
+        (*lut)[c] = int64_t(std::llround(c * std::log(double(c)) * nlogn_scale));
     }
+    return lut;
+}
+
+/// nlogn_entropy returns the entropy of n bytes, scaled between [0., 1.], from the sum s of the nlogn_table() entries
+/// of their byte counts.
+float nlogn_entropy(int64_t s, offset_t n) {
+    if (n <= 0) return 0.f;
+
+    // -sum(p * ln(p)) with p = c / n is ln(n) - sum(c * ln(c)) / n.
+    double entropy = std::log(double(n)) - s / nlogn_scale / n;
+    entropy /= std::log(2.0);
+    entropy /= 8.0;
+
+    return float(max(entropy, 0.));
+}
 
-    int inc = bs; // set to a value less than bs to create overlapping
+/// EntropyAccumulator constructor.
+/// @param [in] bs The block size, the number of bytes each entropy value is computed over.
+/// @param [in] stride The distance between the starts of consecutive blocks. Blocks overlap when it is below bs and
+/// bytes are skipped when it is above bs. 0 selects bs.
+EntropyAccumulator::EntropyAccumulator(int bs, int stride)
+        : n_(0), bs_(bs), stride_(stride > 0 ? stride : bs), start_(0), s_(0) {
+    memset(dict_, 0, sizeof(dict_));
 
-    long ddn = n / inc + (n % inc ? 1 : 0);
-    auto dd = new float[ddn];
-    memset(dd, 0, sizeof(dd[0]) * ddn);
+    // Shared between copies, it only depends on bs.
+    lut_ = nlogn_table(bs_);
 
-    for (long is = 0; is < n; is += inc) {
-        long ie = min(n, is + bs);
+    if (sliding()) ring_.resize(bs_);
+}
+
+/// sliding returns whether blocks overlap, in which case each block is derived from the previous one.
+bool EntropyAccumulator::sliding() const {
+    return stride_ < bs_;
+}
 
-        int dict[256] = {0};
-        for (long i = is; i < ie; i++) {
-            dict[dat_u8[i]]++;
+/// add accumulates the next window of the stream, a block may span several windows.
+/// @param [in] dat_u8 Byte data to be analyzed.
+/// @param [in] n Length of dat_u8 in bytes.
+void EntropyAccumulator::add(const unsigned char *dat_u8, offset_t n) {
+    const int64_t *lut = lut_->data();
+
+    for (offset_t i = 0; i < n;) {
+        if (n_ < start_) {
+            // Between blocks, when the stride exceeds the block size
+            offset_t m = min(n - i, start_ - n_);
+            i += m;
+            n_ += m;
+            continue;
         }
 
-        float entropy = 0.;
-        for (int i = 0; i < 256; i++) {
-            float p = dict[i] / float(ie - is);
-            if (p > 0.) {
-                entropy += -p * logf(p);
+        offset_t m = min(n - i, start_ + bs_ - n_);
+        if (sliding()) {
+            // Updating the sum of c * ln(c) as each count changes makes every step O(1).
+            for (offset_t j = i; j < i + m; j++) {
+                unsigned char v = dat_u8[j];
+                offset_t c = dict_[v]++;
+                s_ += lut[c + 1] - lut[c];
+                ring_[(n_ + j - i) % bs_] = v;
             }
+        } else {
+            add_byte_histo(dict_, dat_u8 + i, m);
         }
-        entropy /= logf(2.0);
-        entropy /= 8.0;
+        i += m;
+        n_ += m;
 
-        int di = is / bs;
-        if (di >= ddn) {
-            //printf("%d %d %d %d\n", is, bs, is/bs, n);
-            continue;
+        if (n_ == start_ + bs_) {
+            dd_.push_back(block_entropy());
+            next_block();
         }
+    }
+}
+
+/// next_block moves from the block just completed to the next one.
+void EntropyAccumulator::next_block() {
+    if (!sliding()) {
+        memset(dict_, 0, sizeof(dict_));
+        start_ += stride_;
+        return;
+    }
 
-        dd[di] = entropy;
+    // The bytes that leave the block are still in the ring, which holds the last bs bytes.
+    const int64_t *lut = lut_->data();
+    for (offset_t p = start_; p < start_ + stride_; p++) {
+        unsigned char v = ring_[p % bs_];
+        offset_t c = dict_[v]--;
+        s_ += lut[c - 1] - lut[c];
     }
+    start_ += stride_;
+}
+
+/// size returns the number of bytes seen so far.
+offset_t EntropyAccumulator::size() const {
+    return n_;
+}
 
-    rv_len = ddn;
+/// block_entropy returns the entropy of the current block, which may be shorter than bs at the end of the stream.
+float EntropyAccumulator::block_entropy() const {
+    offset_t n = min(n_ - start_, offset_t(bs_));
+
+    int64_t s = s_;
+    if (!sliding()) {
+        const int64_t *lut = lut_->data();
+        s = 0;
+        for (int i = 0; i < 256; i++) {
+            s += lut[dict_[i]];
+        }
+    }
+
+    return nlogn_entropy(s, n);
+}
+
+/// result returns the entropy of each block seen so far, including a final partial block. The partial block keeps
+/// accumulating if more data is added afterwards.
+/// @param [out] rv_len The length of the return vector.
+/// @return The entropy of each block, as vector of length rv_len scaled between [0., 1.], null if no data was seen.
+float *EntropyAccumulator::result(offset_t &rv_len) const {
+    bool partial = n_ > start_;
+    rv_len = dd_.size() + (partial ? 1 : 0);
+    if (rv_len == 0) return nullptr;
+
+    auto dd = new float[rv_len];
+    std::copy(dd_.begin(), dd_.end(), dd);
+    if (partial) dd[rv_len - 1] = block_entropy();
 
     return dd;
 }
+
+// The most entropy values kept for a range, which bounds the memory of the plot of a huge range.
+static const offset_t max_blocks = 1 << 20;
+
+/// entropy_block_size chooses the block size for the entropy of n bytes, 256 unless that would produce so many blocks
+/// that the plot of a huge range takes up a lot of memory.
+/// @param [in] n Length of the data in bytes.
+/// @return The block size in bytes.
+int entropy_block_size(offset_t n) {
+    int bs = 256;
+    while (n / bs > max_blocks) bs *= 2;
+    return bs;
+}
+
+/// entropy_stride chooses the distance between the blocks of the entropy of n bytes. Blocks of ranges small enough
+/// overlap, down to a block starting at every byte, as long as there are no more than the same number of blocks.
+/// @param [in] n Length of the data in bytes.
+/// @return The stride in bytes, at most entropy_block_size(n).
+int entropy_stride(offset_t n) {
+    offset_t stride = (n + max_blocks - 1) / max_blocks;
+    return int(max(offset_t(1), min(stride, offset_t(entropy_block_size(n)))));
+}
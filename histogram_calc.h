@@ -20,20 +20,137 @@
 #ifndef _HISTOGRAM_CALC_H_
 #define _HISTOGRAM_CALC_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "offset.h"
+#include "sparse_histo.h"
 
 typedef enum {
-    none, u8, u12, u16, u32, u64, f32, f64
+    none, u8, s8, u12, u16, s16, u32, s32, u64, s64, f16, bf16, f32, f64,
+    u12be, u16be, s16be, u32be, s32be, u64be, s64be, f16be, bf16be, f32be, f64be
 } histo_dtype_t;
 
 histo_dtype_t string_to_histo_dtype(const std::string &s);
 
-int *generate_histo_2d(const unsigned char *dat_u8, long n, histo_dtype_t dtype);
+std::vector<std::string> histo_dtype_names();
+
+int histo_dtype_size(histo_dtype_t dtype);
+
+/// HistoAccumulator counts the bytes of a stream that arrives in consecutive windows.
+class HistoAccumulator {
+public:
+    HistoAccumulator();
+
+    void add(const unsigned char *dat_u8, offset_t n);
+
+    void add_counts(const offset_t *cnt, offset_t n);
+
+    offset_t shift_cost(offset_t n, offset_t d) const;
+
+    void shift(const unsigned char *dat_u8, offset_t n, offset_t d);
+
+    offset_t size() const;
+
+    float *result() const;
+
+protected:
+    offset_t n_;
+    offset_t cnt_[256];
+};
+
+/// TupleHistoAccumulator counts the digrams (dims = 2) or trigrams (dims = 3) of dtype elements of a stream that
+/// arrives in consecutive windows. Elements and tuples that straddle a window boundary are carried over, so the result
+/// does not depend on how the stream is split.
+class TupleHistoAccumulator {
+public:
+    TupleHistoAccumulator(int dims, histo_dtype_t dtype, bool overlap = true);
+
+    ~TupleHistoAccumulator();
+
+    TupleHistoAccumulator(const TupleHistoAccumulator &o);
+
+    TupleHistoAccumulator &operator=(const TupleHistoAccumulator &) = delete;
+
+    void add(const unsigned char *dat_u8, offset_t n);
+
+    bool add_counts(const offset_t *cnt, const unsigned char *dat_u8, offset_t n);
+
+    offset_t shift_cost(offset_t n, offset_t d) const;
+
+    void shift(const unsigned char *dat_u8, offset_t n, offset_t d);
+
+    offset_t size() const;
+
+    bool matches(int dims, histo_dtype_t dtype, bool overlap) const;
+
+    const offset_t *hist() const;
+
+    const SparseHisto *hist_3d() const;
+
+    size_t memory() const;
+
+protected:
+    offset_t count(const unsigned char *dat_u8, offset_t n);
+
+    void count_3d(const unsigned char *dat_u8, offset_t nt, int n_threads);
+
+    void count_run(const unsigned char *dat_u8, offset_t k0, offset_t k1, int inc);
+
+    void merge(const TupleHistoAccumulator &o);
+
+    offset_t tuples(offset_t n) const;
+
+    int hist_n() const;
+
+    offset_t n_;
+    int dims_;
+    histo_dtype_t dtype_;
+    int st_;
+    offset_t *hist_;
+    SparseHisto *hist_3d_;
+    std::vector<unsigned char> carry_;
+};
+
+/// EntropyAccumulator computes the entropy of bs-sized blocks of a stream that arrives in consecutive windows, one
+/// block starting every stride bytes. A block may span several windows.
+class EntropyAccumulator {
+public:
+    explicit EntropyAccumulator(int bs = 256, int stride = 0);
+
+    void add(const unsigned char *dat_u8, offset_t n);
+
+    offset_t size() const;
+
+    float *result(offset_t &rv_len) const;
+
+protected:
+    bool sliding() const;
+
+    float block_entropy() const;
+
+    void next_block();
+
+    offset_t n_;
+    int bs_;
+    int stride_;
+    // Start of the current block, its counts and, for sliding blocks, the sum of c * ln(c) over them
+    offset_t start_;
+    offset_t dict_[256];
+    int64_t s_;
+    std::shared_ptr<const std::vector<int64_t>> lut_;
+    std::vector<unsigned char> ring_;
+    std::vector<float> dd_;
+};
+
+std::shared_ptr<const std::vector<int64_t>> nlogn_table(int n);
 
-int *generate_histo_3d(const unsigned char *dat_u8, long n, histo_dtype_t dtype, bool overlap = true);
+float nlogn_entropy(int64_t s, offset_t n);
 
-float *generate_histo(const unsigned char *dat_u8, long n);
+int entropy_block_size(offset_t n);
 
-float *generate_entropy(const unsigned char *dat_u8, long n, long &rv_len, int bs = 256);
+int entropy_stride(offset_t n);
 
 #endif
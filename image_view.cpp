@@ -17,18 +17,56 @@
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include <QtGui>
 #include <QGridLayout>
 #include <QSpinBox>
+#include <QDoubleSpinBox>
 #include <QComboBox>
+#include <QCheckBox>
+#include <QPushButton>
 
 #include "image_view.h"
+#include "paint_image.h"
 #include "bayer.h"
+#include "bayer_gallery.h"
+#include "stride_detect.h"
+#include "worker.h"
+
+using std::min;
+using std::max;
+
+// Rows per tile, and the most bytes of tiles kept beyond those on screen.
+static const int tile_rows = 256;
+static const size_t max_tiles_bytes = size_t(64) << 20;
+
+// The fewest rows zooming in shows.
+static const offset_t min_rows = 16;
+
+// Each wheel notch, 120 eighths of a degree, zooms by a factor of two.
+static const int wheel_zoom_delta = 120;
+
+// The gallery shows the previews of the 24 permutations in this many columns and rows, each preview at most
+// gallery_side pixels wide and high.
+static const int gallery_cols = 6;
+static const int gallery_rows = 4;
+static const int gallery_side = 128;
 
+// The most strides the detector proposes.
+static const int max_strides = 8;
 
 ImageView::ImageView(QWidget *p)
         : QLabel(p),
-          dat_(nullptr), dat_n_(0), inverted_(true) {
+          dat_n_(0), inverted_(true),
+          img_offset_(0), img_w_(1), img_format_(-1), img_method_(bayer_block), img_frame_h_(0),
+          img_rows_(0),
+          top_(0), rows_(0), tiles_bytes_(0), drag_y_(-1), drag_top_(0), wheel_delta_(0), notify_(false) {
+    worker_ = new Worker(this);
+    stride_worker_ = new Worker(this);
+
     {
         auto layout = new QGridLayout(this);
         {
@@ -37,7 +75,9 @@ ImageView::ImageView(QWidget *p)
             layout->addWidget(l, 0, 0);
         }
         {
-            auto sb = new QSpinBox;
+            // A double spin box without decimals holds exact offsets up to 2^53, beyond the int range of QSpinBox.
+            auto sb = new QDoubleSpinBox;
+            sb->setDecimals(0);
             sb->setFixedSize(sb->sizeHint());
             sb->setFixedWidth(sb->width() * 1.5);
             sb->setRange(0, 100000);
@@ -67,66 +107,107 @@ ImageView::ImageView(QWidget *p)
         {
             auto cb = new QComboBox;
             cb->setFixedSize(cb->sizeHint());
-            cb->addItem("RGB 8");
-            cb->addItem("RGB 12");
-            cb->addItem("RGB 16");
-            cb->addItem("RGBA 8");
-            cb->addItem("RGBA 12");
-            cb->addItem("RGBA 16");
-            cb->addItem("BGR 8");
-            cb->addItem("BGR 12");
-            cb->addItem("BGR 16");
-            cb->addItem("BGRA 8");
-            cb->addItem("BGRA 12");
-            cb->addItem("BGRA 16");
-            cb->addItem("Grey 8");
-            cb->addItem("Grey 12");
-            cb->addItem("Grey 16");
-            cb->addItem("Bayer 8 - 0: 0 1 2 3");
-            cb->addItem("Bayer 8 - 1: 0 1 3 2");
-            cb->addItem("Bayer 8 - 2: 0 2 1 3");
-            cb->addItem("Bayer 8 - 3: 0 2 3 1");
-            cb->addItem("Bayer 8 - 4: 0 3 1 2");
-            cb->addItem("Bayer 8 - 5: 0 3 2 1");
-            cb->addItem("Bayer 8 - 6: 1 0 2 3");
-            cb->addItem("Bayer 8 - 7: 1 0 3 2");
-            cb->addItem("Bayer 8 - 8: 1 2 0 3");
-            cb->addItem("Bayer 8 - 9: 1 2 3 0");
-            cb->addItem("Bayer 8 - 10: 1 3 0 2");
-            cb->addItem("Bayer 8 - 11: 1 3 2 0");
-            cb->addItem("Bayer 8 - 12: 2 0 1 3");
-            cb->addItem("Bayer 8 - 13: 2 0 3 1");
-            cb->addItem("Bayer 8 - 14: 2 1 0 3");
-            cb->addItem("Bayer 8 - 15: 2 1 3 0");
-            cb->addItem("Bayer 8 - 16: 2 3 0 1");
-            cb->addItem("Bayer 8 - 17: 2 3 1 0");
-            cb->addItem("Bayer 8 - 18: 3 0 1 2");
-            cb->addItem("Bayer 8 - 19: 3 0 2 1");
-            cb->addItem("Bayer 8 - 20: 3 1 0 2");
-            cb->addItem("Bayer 8 - 21: 3 1 2 0");
-            cb->addItem("Bayer 8 - 22: 3 2 0 1");
-            cb->addItem("Bayer 8 - 23: 3 2 1 0");
+            for (const auto &f : pixel_formats()) {
+                cb->addItem(f.name);
+            }
             cb->setCurrentIndex(0);
             cb->setEditable(false);
             cb->setFixedWidth(cb->width() * 1.5);
             type_ = cb;
             layout->addWidget(cb, 2, 1);
         }
+        {
+            auto l = new QLabel("Frame rows");
+            l->setFixedSize(l->sizeHint());
+            layout->addWidget(l, 3, 0);
+        }
+        {
+            // Rows of each frame of the planar formats, 0 for a single frame of all the data
+            auto sb = new QSpinBox;
+            sb->setFixedSize(sb->sizeHint());
+            sb->setFixedWidth(sb->width() * 1.5);
+            sb->setRange(0, 100000);
+            sb->setSpecialValueText("All");
+            sb->setValue(0);
+            frame_h_ = sb;
+            layout->addWidget(sb, 3, 1);
+        }
+        {
+            auto l = new QLabel("Demosaic");
+            l->setFixedSize(l->sizeHint());
+            layout->addWidget(l, 4, 0);
+        }
+        {
+            // In the order of bayer_method_t
+            auto cb = new QComboBox;
+            cb->addItem("Block");
+            cb->addItem("Bilinear");
+            cb->addItem("Malvar-He-Cutler");
+            cb->setCurrentIndex(bayer_block);
+            cb->setEditable(false);
+            cb->setFixedSize(cb->sizeHint());
+            method_ = cb;
+            layout->addWidget(cb, 4, 1);
+        }
+        {
+            auto l = new QLabel("Gallery");
+            l->setFixedSize(l->sizeHint());
+            layout->addWidget(l, 5, 0);
+        }
+        {
+            auto cb = new QCheckBox;
+            cb->setFixedSize(cb->sizeHint());
+            cb->setChecked(false);
+            gallery_ = cb;
+            layout->addWidget(cb, 5, 1);
+        }
+        {
+            auto l = new QLabel("Stride");
+            l->setFixedSize(l->sizeHint());
+            layout->addWidget(l, 6, 0);
+        }
+        {
+            auto cb = new QComboBox;
+            cb->setEditable(false);
+            cb->setEnabled(false);
+            cb->setMinimumContentsLength(16);
+            cb->setFixedSize(cb->sizeHint());
+            strides_ = cb;
+            layout->addWidget(cb, 6, 1);
+        }
+        {
+            auto pb = new QPushButton("Detect");
+            pb->setFixedSize(pb->sizeHint());
+            detect_ = pb;
+            layout->addWidget(pb, 7, 1);
+        }
 
         layout->setColumnStretch(2, 1);
-        layout->setRowStretch(3, 1);
+        layout->setRowStretch(8, 1);
 
-        QObject::connect(offset_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
+        QObject::connect(offset_, SIGNAL(valueChanged(double)), this, SLOT(parameters_changed()));
         QObject::connect(width_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
         QObject::connect(type_, SIGNAL(currentIndexChanged(int)), this, SLOT(parameters_changed()));
+        QObject::connect(frame_h_, SIGNAL(valueChanged(int)), this, SLOT(parameters_changed()));
+        QObject::connect(method_, SIGNAL(currentIndexChanged(int)), this, SLOT(parameters_changed()));
+        QObject::connect(gallery_, SIGNAL(toggled(bool)), this, SLOT(parameters_changed()));
+        QObject::connect(detect_, SIGNAL(clicked()), this, SLOT(detect_stride()));
+        QObject::connect(strides_, SIGNAL(activated(int)), this, SLOT(snap_stride(int)));
     }
 }
 
+/// stop cancels the decoding and stride detection in the background and waits for them, so that neither reads the data
+/// any longer.
+void ImageView::stop() {
+    worker_->cancel();
+    stride_worker_->cancel();
+    worker_->join();
+    stride_worker_->join();
+}
+
 void ImageView::setImage(QImage &img) {
     img_ = img;
 
-    update_pix();
-
     update();
 }
 
@@ -134,6 +215,19 @@ void ImageView::paintEvent(QPaintEvent *e) {
     QLabel::paintEvent(e);
 
     QPainter p(this);
+    paint_image(p, this, img_);
+
+    if (!gallery_perms_.empty()) {
+        // The previews fill the widget in a grid, best first, each labelled with its rank and format
+        double cw = (width() - 4) / double(gallery_cols), ch = (height() - 4) / double(gallery_rows);
+        p.setPen(Qt::white);
+        for (int k = 0; k < int(gallery_perms_.size()); k++) {
+            int x = int(2 + (k % gallery_cols) * cw) + 3, y = int(2 + (k / gallery_cols) * ch) + 3;
+            QString s = QString::number(k + 1) + ". " + pixel_formats()[gallery_perms_[k]].name;
+            p.drawText(x, y + p.fontMetrics().ascent(), s);
+        }
+    }
+
     {
         // a border around the image helps to see the border of a dark image
         p.setPen(Qt::darkGray);
@@ -141,26 +235,21 @@ void ImageView::paintEvent(QPaintEvent *e) {
     }
 }
 
-void ImageView::resizeEvent(QResizeEvent *e) {
-    QLabel::resizeEvent(e);
-
-    update_pix();
-}
-
-void ImageView::update_pix() {
-    if (img_.isNull()) return;
-
-    int vw = width() - 4;
-    int vh = height() - 4; // TODO BUG: With QDarkStyle, without the subtraction, the height or width of the application grows without bounds.
-    pix_ = QPixmap::fromImage(img_).scaled(vw, vh); //, Qt::KeepAspectRatio);
-    setPixmap(pix_);
-}
-
 
-void ImageView::setData(const unsigned char *dat, long n) {
+void ImageView::setData(const file_data_t &dat, offset_t n) {
     dat_ = dat;
     dat_n_ = n;
 
+    // Strides found in the previous data
+    stride_worker_->restart();
+    strides_->clear();
+    strides_->setEnabled(false);
+    found_strides_.clear();
+
+    offset_->blockSignals(true);
+    offset_->setRange(0, std::max(offset_t(0), dat_n_ - 1));
+    offset_->blockSignals(false);
+
     regen_image();
 }
 
@@ -169,410 +258,454 @@ void ImageView::regen_image() {
 }
 
 void ImageView::parameters_changed() {
-    int offset = offset_->value();
+    offset_t offset = offset_t(offset_->value());
     int w = width_->value();
 
-    dtype_t t;
-    QString s = type_->currentText();
-    if (s == "RGB 8") t = rgb8;
-    else if (s == "RGB 12") t = rgb12;
-    else if (s == "RGB 16") t = rgb16;
-    else if (s == "RGBA 8") t = rgba8;
-    else if (s == "RGBA 12") t = rgba12;
-    else if (s == "RGBA 16") t = rgba16;
-    else if (s == "BGR 8") t = bgr8;
-    else if (s == "BGR 12") t = bgr12;
-    else if (s == "BGR 16") t = bgr16;
-    else if (s == "BGRA 8") t = bgra8;
-    else if (s == "BGRA 12") t = bgra12;
-    else if (s == "BGRA 16") t = bgra16;
-    else if (s == "Grey 8") t = grey8;
-    else if (s == "Grey 12") t = grey12;
-    else if (s == "Grey 16") t = grey16;
-    else if (s == "Bayer 8 - 0: 0 1 2 3") t = bayer8_0;
-    else if (s == "Bayer 8 - 1: 0 1 3 2") t = bayer8_1;
-    else if (s == "Bayer 8 - 2: 0 2 1 3") t = bayer8_2;
-    else if (s == "Bayer 8 - 3: 0 2 3 1") t = bayer8_3;
-    else if (s == "Bayer 8 - 4: 0 3 1 2") t = bayer8_4;
-    else if (s == "Bayer 8 - 5: 0 3 2 1") t = bayer8_5;
-    else if (s == "Bayer 8 - 6: 1 0 2 3") t = bayer8_6;
-    else if (s == "Bayer 8 - 7: 1 0 3 2") t = bayer8_7;
-    else if (s == "Bayer 8 - 8: 1 2 0 3") t = bayer8_8;
-    else if (s == "Bayer 8 - 9: 1 2 3 0") t = bayer8_9;
-    else if (s == "Bayer 8 - 10: 1 3 0 2") t = bayer8_10;
-    else if (s == "Bayer 8 - 11: 1 3 2 0") t = bayer8_11;
-    else if (s == "Bayer 8 - 12: 2 0 1 3") t = bayer8_12;
-    else if (s == "Bayer 8 - 13: 2 0 3 1") t = bayer8_13;
-    else if (s == "Bayer 8 - 14: 2 1 0 3") t = bayer8_14;
-    else if (s == "Bayer 8 - 15: 2 1 3 0") t = bayer8_15;
-    else if (s == "Bayer 8 - 16: 2 3 0 1") t = bayer8_16;
-    else if (s == "Bayer 8 - 17: 2 3 1 0") t = bayer8_17;
-    else if (s == "Bayer 8 - 18: 3 0 1 2") t = bayer8_18;
-    else if (s == "Bayer 8 - 19: 3 0 2 1") t = bayer8_19;
-    else if (s == "Bayer 8 - 20: 3 1 0 2") t = bayer8_20;
-    else if (s == "Bayer 8 - 21: 3 1 2 0") t = bayer8_21;
-    else if (s == "Bayer 8 - 22: 3 2 0 1") t = bayer8_22;
-    else if (s == "Bayer 8 - 23: 3 2 1 0") t = bayer8_23;
-    else t = none;
+    int t = type_->currentIndex();
 
-    QImage img;
+    img_offset_ = offset;
+    img_w_ = w;
+    img_format_ = t;
+    img_method_ = bayer_method_t(method_->currentIndex());
+    img_frame_h_ = frame_h_->value();
+    img_rows_ = dat_ && t >= 0 ? image_rows(dat_n_, offset, w, pixel_formats()[t], img_frame_h_) : 0;
+    gallery_perms_.clear();
 
-    switch (t) {
-        case rgb8: {
-            auto dat_u8 = dat_ + offset;
-            int n = (dat_n_ - offset) / 1 / 3;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = dat_u8[i * 3 + 0];
-                unsigned char g = dat_u8[i * 3 + 1];
-                unsigned char b = dat_u8[i * 3 + 2];
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
-        }
-            break;
-        case rgb12: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 3;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 3 + 0] >> 4) & 0xff;
-                unsigned char g = (dat_u16[i * 3 + 1] >> 4) & 0xff;
-                unsigned char b = (dat_u16[i * 3 + 2] >> 4) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
-        }
-            break;
-        case rgb16: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 3;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 3 + 0] >> 8) & 0xff;
-                unsigned char g = (dat_u16[i * 3 + 1] >> 8) & 0xff;
-                unsigned char b = (dat_u16[i * 3 + 2] >> 8) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
-        }
-            break;
-        case rgba8: {
-            auto dat_u8 = (const unsigned char *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 1 / 4;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = dat_u8[i * 4 + 0];
-                unsigned char g = dat_u8[i * 4 + 1];
-                unsigned char b = dat_u8[i * 4 + 2];
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
-        }
-            break;
-        case rgba12: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 4;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 4 + 0] >> 4) & 0xff;
-                unsigned char g = (dat_u16[i * 4 + 1] >> 4) & 0xff;
-                unsigned char b = (dat_u16[i * 4 + 2] >> 4) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
-        }
-            break;
-        case rgba16: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 4;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = dat_u16[i * 4 + 0] >> 8;
-                unsigned char g = dat_u16[i * 4 + 1] >> 8;
-                unsigned char b = dat_u16[i * 4 + 2] >> 8;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
+    // The tiles belong to the previous image, the new one is shown whole.
+    tiles_.clear();
+    tiles_bytes_ = 0;
+    top_ = 0;
+    rows_ = img_rows_;
+
+    notify_ = true;
+    update_viewport();
+}
+
+void ImageView::resizeEvent(QResizeEvent *e) {
+    QLabel::resizeEvent(e);
+
+    // More or fewer rows fit on screen, which may call for another level of detail.
+    if (img_rows_ > 0) update_viewport();
+}
+
+/// update_viewport shows rows [top_, top_ + rows_) of the image, sampling about one row per device pixel of height.
+/// Only the tiles not already kept are decoded, in the background.
+void ImageView::update_viewport() {
+    int gen = worker_->restart();
+
+    if (img_rows_ <= 0) {
+        QImage img;
+        setImage(img);
+        notify_ready();
+        return;
+    }
+
+    if (gallery_->isChecked()) {
+        update_gallery(gen);
+        return;
+    }
+
+    int dh = max(1, device_height(this));
+    int level = 0;
+    while (((rows_ - 1) >> level) + 1 > dh) level++;
+    offset_t step = offset_t(1) << level;
+
+    // Rows of the level, which holds every step-th row of the image
+    offset_t level_rows = (img_rows_ - 1) / step + 1;
+    offset_t u0 = top_ / step;
+    offset_t u1 = min(level_rows, (top_ + rows_ - 1) / step + 1);
+
+    std::vector<offset_t> missing;
+    for (offset_t k = u0 / tile_rows; k <= (u1 - 1) / tile_rows; k++) {
+        bool found = false;
+        for (auto it = tiles_.begin(); it != tiles_.end() && !found; ++it) {
+            if (it->first == tile_key_t(level, k)) {
+                tiles_.splice(tiles_.begin(), tiles_, it);
+                found = true;
             }
         }
-            break;
-        case bgr8: {
-            auto dat_u8 = (const unsigned char *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 1 / 3;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = dat_u8[i * 3 + 2];
-                unsigned char g = dat_u8[i * 3 + 1];
-                unsigned char b = dat_u8[i * 3 + 0];
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
+        if (!found) missing.push_back(k);
+    }
+
+    if (missing.empty()) {
+        compose_viewport(level, u0, u1);
+        notify_ready();
+        return;
+    }
+
+    file_data_t dat = dat_;
+    offset_t dat_n = dat_n_;
+    offset_t offset = img_offset_;
+    int w = img_w_;
+    const pixel_format_t *f = &pixel_formats()[img_format_];
+    bayer_method_t method = img_method_;
+    int frame_h = img_frame_h_;
+
+    Worker *worker = worker_;
+    worker_->post(gen, [this, worker, gen, dat, dat_n, offset, w, f, method, frame_h, level, step, level_rows, u0, u1,
+                        missing] {
+        std::vector<std::pair<tile_key_t, QImage>> tiles;
+        for (offset_t k : missing) {
+            if (worker->cancelled(gen)) return;
+
+            int n = int(min(offset_t(tile_rows), level_rows - k * tile_rows));
+            QImage tile = decode_rows(dat.get(), dat_n, offset, w, *f, k * tile_rows * step, step, n, method,
+                                     frame_h);
+            tiles.emplace_back(tile_key_t(level, k), tile);
         }
-            break;
-        case bgr12: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 3;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 3 + 2] >> 4) & 0xff;
-                unsigned char g = (dat_u16[i * 3 + 1] >> 4) & 0xff;
-                unsigned char b = (dat_u16[i * 3 + 0] >> 4) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
+
+        worker->deliver(gen, [this, tiles, level, u0, u1] {
+            for (const auto &tile : tiles) {
+                tiles_.push_front(tile);
+                tiles_bytes_ += size_t(tile.second.bytesPerLine()) * tile.second.height();
             }
-        }
-            break;
-        case bgr16: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 3;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 3 + 2] >> 8) & 0xff;
-                unsigned char g = (dat_u16[i * 3 + 1] >> 8) & 0xff;
-                unsigned char b = (dat_u16[i * 3 + 0] >> 8) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
+            compose_viewport(level, u0, u1);
+
+            // Everything beyond the budget that is not on screen goes, least recently used first.
+            size_t on_screen = (u1 - 1) / tile_rows - u0 / tile_rows + 1;
+            while (tiles_.size() > on_screen && tiles_bytes_ > max_tiles_bytes) {
+                const QImage &img = tiles_.back().second;
+                tiles_bytes_ -= size_t(img.bytesPerLine()) * img.height();
+                tiles_.pop_back();
             }
-        }
-            break;
-        case bgra8: {
-            auto dat_u8 = (const unsigned char *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 1 / 4;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = dat_u8[i * 4 + 2];
-                unsigned char g = dat_u8[i * 4 + 1];
-                unsigned char b = dat_u8[i * 4 + 0];
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
+
+            notify_ready();
+        });
+    });
+}
+
+/// detect_stride proposes row lengths of the data from the offset on, in the background, listed in strides_ once
+/// found.
+void ImageView::detect_stride() {
+    int gen = stride_worker_->restart();
+
+    strides_->clear();
+    strides_->setEnabled(false);
+    found_strides_.clear();
+    if (!dat_) return;
+
+    file_data_t dat = dat_;
+    offset_t offset = min(offset_t(offset_->value()), dat_n_);
+    offset_t n = dat_n_ - offset;
+
+    Worker *worker = stride_worker_;
+    worker->post(gen, [this, worker, gen, dat, offset, n] {
+        std::vector<stride_candidate_t> strides = ::detect_stride(dat.get() + offset, n, max_strides);
+
+        worker->deliver(gen, [this, strides] {
+            found_strides_ = strides;
+            for (const auto &c : strides) {
+                strides_->addItem(QString::number(c.stride / c.pixel_size) + " x " + QString::number(c.pixel_size) +
+                                  " B (" + QString::number(c.score, 'f', 3) + ")");
             }
+            strides_->setEnabled(!strides.empty());
+        });
+    });
+}
+
+/// snap_stride sets the width to the k-th stride found. The format is kept if its rows divide the stride, otherwise
+/// the first unpacked format of the pixel size of the stride is taken.
+void ImageView::snap_stride(int k) {
+    if (k < 0 || k >= int(found_strides_.size())) return;
+
+    const stride_candidate_t &c = found_strides_[k];
+    int t = type_->currentIndex();
+    if (t < 0 || pixel_format_width(pixel_formats()[t], c.stride) <= 0) {
+        for (t = 0; t < int(pixel_formats().size()); t++) {
+            const pixel_format_t &f = pixel_formats()[t];
+            if (f.packing == packing_none && pixel_format_size(f) == c.pixel_size) break;
         }
-            break;
-        case bgra12: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 4;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
+    }
+    if (t >= int(pixel_formats().size())) return;
+
+    width_->blockSignals(true);
+    type_->blockSignals(true);
+    type_->setCurrentIndex(t);
+    width_->setValue(pixel_format_width(pixel_formats()[t], c.stride));
+    width_->blockSignals(false);
+    type_->blockSignals(false);
+    parameters_changed();
+}
+
+/// update_gallery shows previews of the shown rows demosaiced by each permutation of the colors, read as a Bayer
+/// mosaic whatever the format, the most likely permutations first.
+/// @param [in] gen Generation of worker_ the previews are made in.
+void ImageView::update_gallery(int gen) {
+    // The rows of the mosaic of the bytes of the shown rows
+    offset_t row_n = pixel_format_row_bytes(pixel_formats()[img_format_], img_w_);
+    offset_t mosaic_rows = (dat_n_ - img_offset_) / img_w_;
+    offset_t r0 = min(top_ * row_n / img_w_, mosaic_rows);
+    offset_t n = min(rows_ * row_n / img_w_, mosaic_rows - r0);
+
+    file_data_t dat = dat_;
+    offset_t offset = img_offset_;
+    int w = img_w_;
+    bayer_method_t method = img_method_;
+    bool inverted = inverted_;
+
+    Worker *worker = worker_;
+    worker_->post(gen, [this, worker, gen, dat, offset, w, r0, n, method, inverted] {
+        int pw = 0, ph = 0;
+        std::vector<bayer_preview_t> previews = bayer_gallery(dat.get(), offset, w, r0, n, gallery_side, method,
+                                                              pw, ph);
+
+        QImage img;
+        std::vector<int> perms;
+        if (!previews.empty()) {
+            img = QImage(pw * gallery_cols, ph * gallery_rows, QImage::Format_RGB32);
             img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 4 + 2] >> 4) & 0xff;
-                unsigned char g = (dat_u16[i * 4 + 1] >> 4) & 0xff;
-                unsigned char b = (dat_u16[i * 4 + 0] >> 4) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
+            for (int k = 0; k < int(previews.size()); k++) {
+                // Turned as compose_viewport() turns the image
+                const unsigned char *rgb = previews[k].rgb.data();
+                for (int y = 0; y < ph; y++) {
+                    auto o = (unsigned int *) img.scanLine((k / gallery_cols) * ph + y) + (k % gallery_cols) * pw;
+                    for (int x = 0; x < pw; x++) {
+                        const unsigned char *v = inverted ? rgb + (size_t(ph - 1 - y) * pw + pw - 1 - x) * 3
+                                                          : rgb + (size_t(y) * pw + x) * 3;
+                        o[x] = 0xff000000 | (v[0] << 16) | (v[1] << 8) | v[2];
+                    }
+                }
+
+                // The format of the permutation
+                for (int i = 0; i < int(pixel_formats().size()); i++) {
+                    if (pixel_formats()[i].bayer_perm == previews[k].perm) perms.push_back(i);
+                }
             }
         }
-            break;
-        case bgra16: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2 / 4;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = (dat_u16[i * 4 + 2] >> 8) & 0xff;
-                unsigned char g = (dat_u16[i * 4 + 1] >> 8) & 0xff;
-                unsigned char b = (dat_u16[i * 4 + 0] >> 8) & 0xff;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
+
+        worker->deliver(gen, [this, img, perms] {
+            QImage v = img;
+            gallery_perms_ = perms;
+            setImage(v);
+            notify_ready();
+        });
+    });
+}
+
+/// notify_ready emits dataReady() once the first viewport of new parameters is shown, whichever update shows it.
+void ImageView::notify_ready() {
+    if (!notify_) return;
+
+    notify_ = false;
+    emit(dataReady());
+}
+
+/// compose_viewport shows rows [u0, u1) of the tiles of level, which must all be kept.
+void ImageView::compose_viewport(int level, offset_t u0, offset_t u1) {
+    QImage img(img_w_, int(u1 - u0), QImage::Format_RGB32);
+    img.fill(0);
+
+    for (const auto &tile : tiles_) {
+        if (tile.first.first != level) continue;
+
+        offset_t t0 = tile.first.second * tile_rows;
+        offset_t r0 = max(u0, t0);
+        offset_t r1 = min(u1, t0 + tile.second.height());
+        for (offset_t r = r0; r < r1; r++) {
+            memcpy(img.scanLine(int(r - u0)), tile.second.constScanLine(int(r - t0)), size_t(img_w_) * 4);
         }
-            break;
-        case grey8: {
-            auto dat_u8 = (const unsigned char *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 1;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char c = dat_u8[i];
-                unsigned char r = c;
-                unsigned char g = c;
-                unsigned char b = c;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
+    }
+
+    if (inverted_) img = img.mirrored(true);
+    setImage(img);
+}
+
+/// clamp_viewport keeps the shown rows within the image.
+void ImageView::clamp_viewport() {
+    rows_ = max(min(rows_, img_rows_), min(min_rows, img_rows_));
+    top_ = max(offset_t(0), min(top_, img_rows_ - rows_));
+}
+
+/// wheelEvent zooms in or out by a factor of two per notch, keeping the row under the cursor in place. Trackpads and
+/// high resolution wheels send fractions of a notch, kept until they add up to whole notches.
+void ImageView::wheelEvent(QWheelEvent *e) {
+    e->accept();
+    if (img_rows_ <= 0 || height() <= 0) return;
+
+    wheel_delta_ += e->angleDelta().y();
+    int notches = wheel_delta_ / wheel_zoom_delta;
+    wheel_delta_ -= notches * wheel_zoom_delta;
+    if (notches == 0) return;
+
+    double f = e->pos().y() / double(height());
+    if (inverted_) f = 1. - f;
+    double anchor = top_ + f * rows_;
+
+    for (; notches > 0; notches--) rows_ /= 2;
+    for (; notches < 0; notches++) rows_ *= 2;
+    clamp_viewport();
+    top_ = offset_t(anchor - f * rows_ + .5);
+    clamp_viewport();
+
+    update_viewport();
+}
+
+void ImageView::mousePressEvent(QMouseEvent *e) {
+    e->accept();
+
+    if (e->button() != Qt::LeftButton) return;
+
+    if (gallery_->isChecked()) {
+        // A click on a preview leaves the gallery for the whole image in its format
+        if (gallery_perms_.empty() || width() <= 4 || height() <= 4) return;
+        int c = (e->pos().x() - 2) * gallery_cols / (width() - 4);
+        int r = (e->pos().y() - 2) * gallery_rows / (height() - 4);
+        int k = r * gallery_cols + c;
+        if (c < 0 || gallery_cols <= c || r < 0 || gallery_rows <= r || k >= int(gallery_perms_.size())) return;
+
+        gallery_->blockSignals(true);
+        type_->blockSignals(true);
+        gallery_->setChecked(false);
+        type_->setCurrentIndex(gallery_perms_[k]);
+        gallery_->blockSignals(false);
+        type_->blockSignals(false);
+        parameters_changed();
+        return;
+    }
+
+    drag_y_ = e->pos().y();
+    drag_top_ = top_;
+}
+
+/// mouseMoveEvent pans the image while dragging.
+void ImageView::mouseMoveEvent(QMouseEvent *e) {
+    e->accept();
+    if (drag_y_ < 0 || img_rows_ <= 0 || height() <= 0) return;
+
+    offset_t d = offset_t((e->pos().y() - drag_y_) * double(rows_) / height());
+    top_ = inverted_ ? drag_top_ + d : drag_top_ - d;
+    clamp_viewport();
+
+    update_viewport();
+}
+
+void ImageView::mouseReleaseEvent(QMouseEvent *e) {
+    e->accept();
+
+    if (e->button() == Qt::LeftButton) drag_y_ = -1;
+}
+
+/// image_rows returns the number of rows decode() produces.
+offset_t ImageView::image_rows(offset_t dat_n, offset_t offset, int w, const pixel_format_t &f, int frame_h) {
+    if (offset >= dat_n || w <= 0) return 0;
+
+    // Bayer images only have complete rows, as do planar images of complete frames, the others end with the partial
+    // row.
+    if (pixel_format_planar(f)) {
+        int h = pixel_format_frame_rows(f, w, frame_h, dat_n - offset);
+        if (h <= 0) return 0;
+        return (dat_n - offset) / pixel_format_frame_bytes(f, w, h) * h;
+    }
+    offset_t row_n = pixel_format_row_bytes(f, w);
+    if (f.bayer_perm >= 0) return (dat_n - offset) / row_n;
+    return (dat_n - offset) / row_n + 1;
+}
+
+/// decode_rows decodes every step-th row of the image decode() would produce, without the rest of it. Rows beyond the
+/// image are black.
+/// @param [in] dat Byte data to be decoded.
+/// @param [in] dat_n Length of dat in bytes.
+/// @param [in] offset Number of bytes to skip at the start of dat.
+/// @param [in] w Width of the image in pixels.
+/// @param [in] f Pixel format of the data.
+/// @param [in] row0 First row decoded.
+/// @param [in] step Distance between the rows decoded.
+/// @param [in] n_rows Number of rows decoded.
+/// @param [in] method Demosaic method of Bayer formats.
+/// @param [in] frame_h Rows of a frame of planar formats, 0 for a single frame of all the data.
+/// @return The rows as an image w x n_rows.
+QImage ImageView::decode_rows(const unsigned char *dat, offset_t dat_n, offset_t offset, int w, const pixel_format_t &f,
+                              offset_t row0, offset_t step, int n_rows, bayer_method_t method, int frame_h) {
+    QImage img(w, max(n_rows, 1), QImage::Format_RGB32);
+    img.fill(0);
+
+    offset_t rows = image_rows(dat_n, offset, w, f, frame_h);
+    if (f.bayer_perm < 0) {
+        // Every other row stands alone
+        if (offset >= dat_n) return img;
+        int h = pixel_format_frame_rows(f, w, frame_h, dat_n - offset);
+        for (int j = 0; j < n_rows; j++) {
+            offset_t r = row0 + j * step;
+            if (r >= rows) break;
+            convert_row(f, dat + offset, dat_n - offset, w, h, r, (uint32_t *) img.scanLine(j));
         }
-            break;
-        case grey12: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char c = (dat_u16[i] >> 4) & 0xff;
-                unsigned char r = c;
-                unsigned char g = c;
-                unsigned char b = c;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
+        return img;
+    }
+
+    offset_t row_n = pixel_format_row_bytes(f, w);
+    int reach = bayer_reach(method);
+    for (int j = 0; j < n_rows;) {
+        offset_t r = row0 + j * step;
+        if (r >= rows) break;
+
+        // Consecutive rows are decoded together. A demosaiced row depends on the rows around it, and on its parity, and
+        // the interpolating methods need at least three rows.
+        int n = step == 1 ? int(min(offset_t(n_rows - j), rows - r)) : 1;
+        offset_t r0 = max(offset_t(0), r - reach) & ~offset_t(1);
+        offset_t r1 = min(rows, max(r + n + reach, r0 + 3));
+        r0 = min(r0, max(offset_t(0), r1 - 3) & ~offset_t(1));
+        offset_t s = offset + r0 * row_n;
+        QImage band = decode(dat, min(dat_n, s + row_n * (r1 - r0)), s, w, f, method);
+        for (int i = 0; i < n && r - r0 + i < band.height(); i++) {
+            memcpy(img.scanLine(j + i), band.constScanLine(int(r - r0 + i)), size_t(w) * 4);
         }
-            break;
-        case grey16: {
-            auto dat_u16 = (const unsigned short *) (dat_ + offset);
-            int n = (dat_n_ - offset) / 2;
-            img = QImage(w, n / w + 1, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char c = (dat_u16[i] >> 8) & 0xff;
-                unsigned char r = c;
-                unsigned char g = c;
-                unsigned char b = c;
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
+        j += n;
+    }
+
+    return img;
+}
+
+/// decode converts raw bytes to an image, run on a background thread.
+/// @param [in] dat Byte data to be decoded.
+/// @param [in] dat_n Length of dat in bytes.
+/// @param [in] offset Number of bytes to skip at the start of dat.
+/// @param [in] w Width of the image in pixels.
+/// @param [in] f Pixel format of the data.
+/// @param [in] method Demosaic method of Bayer formats.
+/// @param [in] frame_h Rows of a frame of planar formats, 0 for a single frame of all the data.
+/// @return The decoded image.
+QImage ImageView::decode(const unsigned char *dat, offset_t dat_n, offset_t offset, int w, const pixel_format_t &f,
+                         bayer_method_t method, int frame_h) {
+    QImage img;
+
+    if (dat == nullptr || offset >= dat_n) return img;
+
+    if (f.bayer_perm < 0) {
+        offset_t rows = image_rows(dat_n, offset, w, f, frame_h);
+        img = QImage(w, int(max(rows, offset_t(1))), QImage::Format_RGB32);
+        img.fill(0);
+        if (!pixel_format_planar(f) && pixel_format_width(f, pixel_format_row_bytes(f, w)) == w) {
+            // Rows without padding run on as the rows of the image, converted at once in whole groups of pixels
+            offset_t group_n = pixel_format_row_bytes(f, 1);
+            offset_t n = (dat_n - offset) / group_n * pixel_format_width(f, group_n);
+            convert_pixels(f, dat + offset, n, (uint32_t *) img.bits());
+        } else {
+            int h = pixel_format_frame_rows(f, w, frame_h, dat_n - offset);
+            for (offset_t r = 0; r < rows; r++) {
+                convert_row(f, dat + offset, dat_n - offset, w, h, r, (uint32_t *) img.scanLine(int(r)));
             }
         }
-            break;
-        case bayer8_0:
-        case bayer8_1:
-        case bayer8_2:
-        case bayer8_3:
-        case bayer8_4:
-        case bayer8_5:
-        case bayer8_6:
-        case bayer8_7:
-        case bayer8_8:
-        case bayer8_9:
-        case bayer8_10:
-        case bayer8_11:
-        case bayer8_12:
-        case bayer8_13:
-        case bayer8_14:
-        case bayer8_15:
-        case bayer8_16:
-        case bayer8_17:
-        case bayer8_18:
-        case bayer8_19:
-        case bayer8_20:
-        case bayer8_21:
-        case bayer8_22:
-        case bayer8_23: {
-            int h = dat_n_ / w + 1;
-            //int bayer_n = w * h;
-
-            auto dat_u8 = (const unsigned char *) (dat_ + offset);
-
-            const unsigned char *bayer = dat_u8;
-            auto rgb = new unsigned char[w * h * 3];
-            int perm = 0;
-            switch (t) {
-                case bayer8_0:
-                    perm = 0;
-                    break;
-                case bayer8_1:
-                    perm = 1;
-                    break;
-                case bayer8_2:
-                    perm = 2;
-                    break;
-                case bayer8_3:
-                    perm = 3;
-                    break;
-                case bayer8_4:
-                    perm = 4;
-                    break;
-                case bayer8_5:
-                    perm = 5;
-                    break;
-                case bayer8_6:
-                    perm = 6;
-                    break;
-                case bayer8_7:
-                    perm = 7;
-                    break;
-                case bayer8_8:
-                    perm = 8;
-                    break;
-                case bayer8_9:
-                    perm = 9;
-                    break;
-                case bayer8_10:
-                    perm = 10;
-                    break;
-                case bayer8_11:
-                    perm = 11;
-                    break;
-                case bayer8_12:
-                    perm = 12;
-                    break;
-                case bayer8_13:
-                    perm = 13;
-                    break;
-                case bayer8_14:
-                    perm = 14;
-                    break;
-                case bayer8_15:
-                    perm = 15;
-                    break;
-                case bayer8_16:
-                    perm = 16;
-                    break;
-                case bayer8_17:
-                    perm = 17;
-                    break;
-                case bayer8_18:
-                    perm = 18;
-                    break;
-                case bayer8_19:
-                    perm = 19;
-                    break;
-                case bayer8_20:
-                    perm = 20;
-                    break;
-                case bayer8_21:
-                    perm = 21;
-                    break;
-                case bayer8_22:
-                    perm = 22;
-                    break;
-                case bayer8_23:
-                    perm = 23;
-                    break;
-            }
-            bayerBG(bayer, h, w, perm, rgb);
+    } else {
+        // only complete rows, the demosaic reads every pixel of every row and must stay within the mapped file
+        int h = int((dat_n - offset) / w);
 
-            int n = (dat_n_ - offset) / 1;
-            img = QImage(w, h, QImage::Format_RGB32);
-            img.fill(0);
-            auto p = (unsigned int *) img.bits();
-            for (int i = 0; i < n; i++) {
-                unsigned char r = rgb[i * 3 + 0];
-                unsigned char g = rgb[i * 3 + 1];
-                unsigned char b = rgb[i * 3 + 2];
-                unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-                *p++ = v;
-            }
+        auto rgb = new unsigned char[offset_t(w) * h * 3];
+        bayerBG(dat + offset, h, w, f.bayer_perm, rgb, method);
+
+        offset_t n = offset_t(w) * h;
+        img = QImage(w, h, QImage::Format_RGB32);
+        img.fill(0);
+        auto p = (unsigned int *) img.bits();
+        for (offset_t i = 0; i < n; i++) {
+            unsigned char r = rgb[i * 3 + 0];
+            unsigned char g = rgb[i * 3 + 1];
+            unsigned char b = rgb[i * 3 + 2];
+            unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
+            *p++ = v;
         }
-            break;
-        default:
-            abort();
-    }
 
-    if (inverted_) {
-        img = img.mirrored(true);
+        delete[] rgb;
     }
-    setImage(img);
+
+    return img;
 }
@@ -20,14 +20,31 @@
 #ifndef _IMAGE_VIEW_H_
 #define _IMAGE_VIEW_H_
 
+#include <list>
+#include <utility>
+#include <vector>
+
 #include <QLabel>
 #include <QImage>
-#include <QPixmap>
+
+#include "bayer.h"
+#include "file_source.h"
+#include "offset.h"
+#include "pixel_format.h"
+#include "stride_detect.h"
 
 class QSpinBox;
 
+class QDoubleSpinBox;
+
+class Worker;
+
 class QComboBox;
 
+class QCheckBox;
+
+class QPushButton;
+
 class ImageView : public QLabel {
 Q_OBJECT
 public:
@@ -35,12 +52,27 @@ public:
 
     ~ImageView() override = default;
 
+    void stop();
+
+    static QImage decode(const unsigned char *dat, offset_t dat_n, offset_t offset, int w, const pixel_format_t &f,
+                         bayer_method_t method = bayer_block, int frame_h = 0);
+
+    static offset_t image_rows(offset_t dat_n, offset_t offset, int w, const pixel_format_t &f, int frame_h = 0);
+
+    static QImage decode_rows(const unsigned char *dat, offset_t dat_n, offset_t offset, int w, const pixel_format_t &f,
+                              offset_t row0, offset_t step, int n_rows, bayer_method_t method = bayer_block,
+                              int frame_h = 0);
+
 public slots:
 
-    void setData(const unsigned char *dat, long n);
+    void setData(const file_data_t &dat, offset_t n);
 
     void parameters_changed();
 
+    void detect_stride();
+
+    void snap_stride(int k);
+
 protected slots:
 
     void setImage(QImage &img);
@@ -49,47 +81,74 @@ protected slots:
 
 protected:
     QImage img_;
-    QPixmap pix_;
 
     void paintEvent(QPaintEvent *) override;
 
     void resizeEvent(QResizeEvent *e) override;
 
-    void update_pix();
-
-    typedef enum {
-        none, rgb8, rgb12, rgb16, rgba8, rgba12, rgba16, bgr8, bgr12, bgr16, bgra8, bgra12, bgra16, grey8, grey12, grey16,
-        bayer8_0,
-        bayer8_1,
-        bayer8_2,
-        bayer8_3,
-        bayer8_4,
-        bayer8_5,
-        bayer8_6,
-        bayer8_7,
-        bayer8_8,
-        bayer8_9,
-        bayer8_10,
-        bayer8_11,
-        bayer8_12,
-        bayer8_13,
-        bayer8_14,
-        bayer8_15,
-        bayer8_16,
-        bayer8_17,
-        bayer8_18,
-        bayer8_19,
-        bayer8_20,
-        bayer8_21,
-        bayer8_22,
-        bayer8_23
-    } dtype_t;
-
-    QSpinBox *offset_, *width_;
+    void wheelEvent(QWheelEvent *e) override;
+
+    void mousePressEvent(QMouseEvent *e) override;
+
+    void mouseMoveEvent(QMouseEvent *e) override;
+
+    void mouseReleaseEvent(QMouseEvent *e) override;
+
+    void update_viewport();
+
+    void update_gallery(int gen);
+
+    void notify_ready();
+
+    void compose_viewport(int level, offset_t u0, offset_t u1);
+
+    void clamp_viewport();
+
+    QDoubleSpinBox *offset_;
+    QSpinBox *width_;
     QComboBox *type_;
-    const unsigned char *dat_;
-    long dat_n_;
+    QSpinBox *frame_h_;
+    QComboBox *method_;
+    QCheckBox *gallery_;
+    QComboBox *strides_;
+    QPushButton *detect_;
+    file_data_t dat_;
+    offset_t dat_n_;
     bool inverted_;
+
+    // The image decoded from dat_, img_rows_ rows of img_w_ pixels of pixel_formats()[img_format_], Bayer formats
+    // demosaiced by img_method_, planar formats in frames of img_frame_h_ rows
+    offset_t img_offset_;
+    int img_w_;
+    int img_format_;
+    bayer_method_t img_method_;
+    int img_frame_h_;
+    offset_t img_rows_;
+
+    // Rows [top_, top_ + rows_) of the image are shown, decoded from tiles of tile_rows rows sampled every 2^level
+    // rows. Tiles are kept, most recently used first, for panning and zooming back.
+    offset_t top_;
+    offset_t rows_;
+    typedef std::pair<int, offset_t> tile_key_t;
+    std::list<std::pair<tile_key_t, QImage>> tiles_;
+    size_t tiles_bytes_;
+    int drag_y_;
+    offset_t drag_top_;
+    // Wheel movement not yet zoomed by, in eighths of a degree
+    int wheel_delta_;
+    // Formats of the permutations the gallery shows, in the order shown, empty unless it is shown
+    std::vector<int> gallery_perms_;
+    // Whether dataReady() is owed for the current parameters
+    bool notify_;
+
+    Worker *worker_;
+    // Detects strides without cancelling the decoding of worker_
+    Worker *stride_worker_;
+    std::vector<stride_candidate_t> found_strides_;
+
+signals:
+
+    void dataReady();
 };
 
 #endif
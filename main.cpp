@@ -17,17 +17,63 @@
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
 #include <qapplication.h>
 #include <qfile.h>
 #include <qtextstream.h>
 
+#include "batch.h"
 #include "main_app.h"
 #include "version.h"
 
 
 //----------------------------------------------------------------------
 
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [<filename>]\n", argv0);
+    fprintf(stderr, "       %s --batch <dir> --out <dir> [--jobs <n>]\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+/// batch_main runs the headless batch mode, which needs no display.
+static int batch_main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("Confluence");
+    QCoreApplication::setOrganizationDomain("confluencerd.com");
+    QCoreApplication::setApplicationName("binary_viewer");
+
+    QString in_dir, out_dir;
+    int jobs = std::max(1, int(std::thread::hardware_concurrency()));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            in_dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (in_dir.isEmpty() || out_dir.isEmpty() || jobs < 1) {
+        usage(argv[0]);
+    }
+
+    return run_batch(in_dir, out_dir, jobs);
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return batch_main(argc, argv);
+    }
+
+    // Widgets are laid out in scaled pixels on HiDPI screens, the views paint their images in device pixels.
+    QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     QApplication app(argc, argv);
     QCoreApplication::setOrganizationName("Confluence");
     QCoreApplication::setOrganizationDomain("confluencerd.com");
@@ -48,8 +94,7 @@ int main(int argc, char *argv[]) {
     MainApp a;
 
     if (argc > 2) {
-        fprintf(stderr, "usage: %s <filename>\n", argv[0]);
-        exit(EXIT_FAILURE);
+        usage(argv[0]);
     }
 
     if (argc == 2) {
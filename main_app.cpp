@@ -21,15 +21,23 @@
 #include <cstdlib>
 
 #include <QtGui>
+#include <QCheckBox>
 #include <QComboBox>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QGridLayout>
 #include <QHBoxLayout>
+#include <QProgressBar>
 #include <QPushButton>
 #include <QSettings>
+#include <QTimer>
 
 #include "main_app.h"
 #include "binary_viewer.h"
+#include "block_index.h"
+#include "byte_class_pyramid.h"
+#include "entropy_pyramid.h"
 #include "overall_view.h"
 #include "histogram_2d_view.h"
 #include "image_view.h"
@@ -37,14 +45,35 @@
 #include "histogram_3d_view.h"
 #include "plot_view.h"
 #include "histogram_calc.h"
+#include "worker.h"
 
 static int scroller_w = 16 * 8;
+static const int follow_poll_ms = 1000;
+static const int prefetch_depth = 2;
 
 
 MainApp::MainApp(QWidget *p)
-        : QDialog(p), cur_file_(-1), bin_(nullptr), bin_len_(0), start_(0), end_(0) {
+        : QDialog(p), cur_file_(-1), bin_(nullptr), bin_len_(0), start_(0), end_(0), histo_start_(0),
+          plot_pyramid_(false) {
     done_flag_ = false;
 
+    worker_ = new Worker(this);
+    // Separate from worker_, range selections restart that one and must not throw away a partially built index.
+    index_worker_ = new Worker(this);
+
+    prefetcher_ = new Prefetcher(this);
+    {
+        QSettings settings;
+        prefetcher_->set_budget(size_t(settings.value("prefetch_budget_mb", 256).toInt()) << 20);
+    }
+
+    // inotify based where available, the poll timer covers file systems that do not report changes
+    watcher_ = new QFileSystemWatcher(this);
+    connect(watcher_, SIGNAL(fileChanged(const QString &)), SLOT(checkGrowth()));
+    poll_timer_ = new QTimer(this);
+    poll_timer_->setInterval(follow_poll_ms);
+    connect(poll_timer_, SIGNAL(timeout()), SLOT(checkGrowth()));
+
     auto top_layout = new QGridLayout;
 
     {
@@ -67,6 +96,11 @@ MainApp::MainApp(QWidget *p)
             connect(pb, SIGNAL(clicked()), SLOT(nextFile()));
             layout->addWidget(pb);
         }
+        {
+            follow_ = new QCheckBox("Follow");
+            connect(follow_, SIGNAL(toggled(bool)), SLOT(followToggled(bool)));
+            layout->addWidget(follow_);
+        }
         top_layout->addLayout(layout, 0, 0);
     }
 
@@ -75,7 +109,9 @@ MainApp::MainApp(QWidget *p)
         overall_zoomed_ = new OverallView;
         plot_view_ = new PlotView;
 
-        connect(overall_primary_, SIGNAL(rangeSelected(float, float)), SLOT(rangeSelected(float, float)));
+        connect(overall_primary_, SIGNAL(rangeSelected(offset_t, offset_t)), SLOT(rangeSelected(offset_t, offset_t)));
+        connect(overall_primary_, SIGNAL(dataReady()), SLOT(stageDone()));
+        connect(overall_zoomed_, SIGNAL(dataReady()), SLOT(stageDone()));
 
         overall_primary_->setFixedWidth(scroller_w);
         overall_zoomed_->setFixedWidth(scroller_w);
@@ -109,6 +145,13 @@ MainApp::MainApp(QWidget *p)
             filename_ = new QLabel();
             layout->addWidget(filename_);
         }
+        {
+            progress_ = new QProgressBar();
+            progress_->setRange(0, 1);
+            progress_->setValue(1);
+            progress_->setFixedWidth(scroller_w);
+            layout->addWidget(progress_);
+        }
 
         top_layout->addLayout(layout, 0, 1);
     }
@@ -126,6 +169,11 @@ MainApp::MainApp(QWidget *p)
         views_.push_back(image_view_);
         views_.push_back(dot_plot_);
 
+        connect(histogram_3d_, SIGNAL(dataReady()), SLOT(stageDone()));
+        connect(histogram_2d_, SIGNAL(dataReady()), SLOT(stageDone()));
+        connect(image_view_, SIGNAL(dataReady()), SLOT(stageDone()));
+        connect(dot_plot_, SIGNAL(dataReady()), SLOT(stageDone()));
+
         auto layout = new QHBoxLayout;
         for (const auto &j : views_) {
             layout->addWidget(j);
@@ -169,35 +217,39 @@ bool MainApp::load_file(const QString &filename) {
     }
     filename_->setText(title);
 
-    FILE *f = fopen(filename.toStdString().c_str(), "rb");
-    if (!f) {
-        fprintf(stderr, "Unable to open %s\n", filename.toStdString().c_str());
-        return false;
-    }
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    if (bin_ != nullptr) {
-        delete[] bin_;
-        bin_ = nullptr;
-        bin_len_ = 0;
-        start_ = 0;
-        end_ = 0;
-    }
+    // Leave the machine to the analysis of this file, prefetching resumes once it is done.
+    std::shared_ptr<const prefetched_t> pre = prefetcher_->take(filename);
+    prefetcher_->cancel();
 
-    bin_ = new unsigned char[len];
-    bin_len_ = fread(bin_, 1, len, f);
-    fclose(f);
-
-    if (len != bin_len_) {
-        printf("premature read %ld of %ld\n", bin_len_, len);
+    // Map the new file before releasing the current one so views never see a partially loaded state.
+    std::shared_ptr<FileSource> src;
+    if (pre) {
+        src = pre->src;
+    } else {
+        src = std::make_shared<FileSource>();
+        if (!src->open(filename.toStdString())) {
+            return false;
+        }
+        if (src->size() == 0) {
+            fprintf(stderr, "Skipping empty file %s\n", filename.toStdString().c_str());
+            return false;
+        }
     }
 
+    src_ = src;
+    bin_ = src_->data();
+    bin_len_ = offset_t(src_->size());
+
     start_ = 0;
     end_ = bin_len_;
 
-    update_views();
+    index_.reset();
+    pyramid_.reset();
+    class_pyramid_.reset();
+
+    watch_file();
+    update_views(true, pre.get());
+    build_index();
 
     return true;
 }
@@ -235,46 +287,355 @@ void MainApp::loadFile() {
     }
 }
 
-void MainApp::update_views(bool update_iv1) {
+/// update_views recomputes the views for [start_, end_).
+/// @param [in] update_iv1 Whether the overview of the entire file needs updating too.
+/// @param [in] pre Results computed ahead of time for the entire file, used where their settings still apply.
+void MainApp::update_views(bool update_iv1, const prefetched_t *pre) {
     if (update_iv1) overall_primary_->clear();
 
     if (bin_ == nullptr) return;
 
-    // iv1 shows the entire file, iv2 shows the current segment
-    if (update_iv1) overall_primary_->set_data(bin_ + 0, bin_len_);
-    overall_zoomed_->set_data(bin_ + start_, end_ - start_);
+    // Everything still being computed for the previous file or range is stale now.
+    int gen = worker_->restart();
+
+    int n_stages = 3;
+    if (update_iv1) n_stages++;
+    if (views_[cur_view_->currentIndex()] != binary_viewer_) n_stages++;
+    progress_->setRange(0, n_stages);
+    progress_->setValue(0);
+
+    file_data_t dat = file_data(src_, start_);
+    offset_t n = end_ - start_;
+
+    // iv1 shows the entire file, iv2 shows the current segment. The overviews are the cheapest to compute and are
+    // requested first, the remaining views fill in as their results arrive.
+    overall_primary_->set_pyramid(class_pyramid_, 0);
+    overall_zoomed_->set_pyramid(class_pyramid_, start_);
+    if (pre != nullptr) {
+        if (update_iv1) overall_primary_->set_prefetched(file_data(src_), bin_len_, pre->overview);
+        overall_zoomed_->set_prefetched(dat, n, pre->overview);
+    } else {
+        if (update_iv1) overall_primary_->set_data(file_data(src_), bin_len_);
+        overall_zoomed_->set_data(dat, n);
+    }
 
-    {
-        long n;
-        auto dd = generate_entropy(bin_ + start_, end_ - start_, n);
-        if (dd) {
-            plot_view_->set_data(0, dd, n);
-            delete[] dd;
-        }
+    // Sliding the previous byte histogram only reads the bytes that entered or left the range, which beats the index
+    // for small moves such as dragging the selection. histo_dat_ keeps its mapping alive, so matching base addresses
+    // mean the same file.
+    std::shared_ptr<const HistoAccumulator> prev_histo;
+    offset_t histo_d = histo_start_ - start_;
+    if (pre == nullptr && histo_acc_ && histo_dat_.get() - histo_start_ == bin_) {
+        offset_t full_cost = n;
+        if (index_ && end_ <= index_->size()) full_cost = std::min(n, index_->query_cost());
+        if (histo_acc_->shift_cost(n, histo_d) < full_cost) prev_histo = histo_acc_;
     }
 
-    {
-        auto dd = generate_histo(bin_ + start_, end_ - start_);
-        if (dd) {
-            plot_view_->set_data(1, dd, 256, false);
-            delete[] dd;
-        }
+    entropy_acc_.reset();
+    histo_acc_.reset();
+    plot_pyramid_ = false;
+    if (pre != nullptr) {
+        update_plots(gen, std::make_shared<EntropyAccumulator>(*pre->entropy),
+                     std::make_shared<HistoAccumulator>(*pre->histo));
+    } else if (prev_histo) {
+        update_plots(gen, std::make_shared<EntropyAccumulator>(entropy_block_size(n), entropy_stride(n)),
+                     std::make_shared<HistoAccumulator>(*prev_histo), true, histo_d);
+    } else {
+        update_plots(gen, std::make_shared<EntropyAccumulator>(entropy_block_size(n), entropy_stride(n)),
+                     std::make_shared<HistoAccumulator>());
     }
 
-    if (histogram_3d_->isVisible()) histogram_3d_->setData(bin_ + start_, end_ - start_);
-    if (histogram_2d_->isVisible()) histogram_2d_->setData(bin_ + start_, end_ - start_);
+    std::shared_ptr<const TupleHistoAccumulator> tuple_histo;
+    if (pre != nullptr) tuple_histo = pre->tuple_histo;
+    if (histogram_3d_->isVisible()) {
+        if (tuple_histo) histogram_3d_->setPrefetched(dat, n, tuple_histo);
+        else histogram_3d_->setRange(dat, n, start_);
+    }
+    if (histogram_2d_->isVisible()) {
+        if (tuple_histo) histogram_2d_->setPrefetched(dat, n, tuple_histo);
+        else histogram_2d_->setRange(dat, n, start_, index_);
+    }
     if (binary_viewer_->isVisible()) {
 //        binary_viewer_->setData(bin_ + start_, end_ - start_);
         binary_viewer_->setData(bin_, end_);
         binary_viewer_->setStart(start_ / 16);
     }
-    if (image_view_->isVisible()) image_view_->setData(bin_ + start_, end_ - start_);
-    if (dot_plot_->isVisible()) dot_plot_->setData(bin_ + start_, end_ - start_);
+    if (image_view_->isVisible()) image_view_->setData(dat, n);
+    if (dot_plot_->isVisible()) dot_plot_->setData(dat, n);
+}
+
+/// append_views brings the views up to date after the file grew, reading only the appended bytes where possible.
+/// @param [in] tail Whether the selected range grew along with the file.
+void MainApp::append_views(bool tail) {
+    // The binary view holds a plain pointer into the mapping, which is replaced when the file grows.
+    {
+        offset_t row = binary_viewer_->start();
+        binary_viewer_->setData(bin_, end_);
+        binary_viewer_->setStart(row);
+    }
+
+    overall_primary_->setSelection(start_ / double(bin_len_), end_ / double(bin_len_));
+
+    if (!tail) {
+        // The range views are unaffected, leave whatever they are computing alone.
+        progress_->setRange(0, 1);
+        progress_->setValue(0);
+        overall_primary_->append_data(file_data(src_), bin_len_);
+        return;
+    }
+
+    int gen = worker_->restart();
+
+    int n_stages = 4;
+    if (views_[cur_view_->currentIndex()] != binary_viewer_) n_stages++;
+    progress_->setRange(0, n_stages);
+    progress_->setValue(0);
+
+    file_data_t dat = file_data(src_, start_);
+    offset_t n = end_ - start_;
+
+    overall_primary_->append_data(file_data(src_), bin_len_);
+    overall_zoomed_->append_data(dat, n);
+
+    // Copies continue from the delivered results, which are left as they are in case this update is cancelled.
+    std::shared_ptr<EntropyAccumulator> entropy_acc;
+    if (entropy_acc_) entropy_acc = std::make_shared<EntropyAccumulator>(*entropy_acc_);
+    else entropy_acc = std::make_shared<EntropyAccumulator>(entropy_block_size(n), entropy_stride(n));
+    std::shared_ptr<HistoAccumulator> histo_acc;
+    if (histo_acc_) histo_acc = std::make_shared<HistoAccumulator>(*histo_acc_);
+    else histo_acc = std::make_shared<HistoAccumulator>();
+    update_plots(gen, entropy_acc, histo_acc);
+
+    if (histogram_3d_->isVisible()) histogram_3d_->appendData(dat, n);
+    if (histogram_2d_->isVisible()) histogram_2d_->appendData(dat, n);
+    if (image_view_->isVisible()) image_view_->setData(dat, n);
+    if (dot_plot_->isVisible()) dot_plot_->setData(dat, n);
+}
+
+/// update_plots streams the bytes of the selected range not yet seen by the accumulators into them in the background,
+/// then plots the entropy and byte histogram.
+/// @param [in] shift Whether histo_acc holds the histogram of another range of the file, which is slid to the selected
+/// range first.
+/// @param [in] d Offset of the range of histo_acc relative to the selected range when shifting.
+void MainApp::update_plots(int gen, const std::shared_ptr<EntropyAccumulator> &entropy_acc,
+                           const std::shared_ptr<HistoAccumulator> &histo_acc, bool shift, offset_t d) {
+    file_data_t dat = file_data(src_, start_);
+    offset_t n = end_ - start_;
+
+    Worker *worker = worker_;
+    if (entropy_acc->size() == 0 && pyramid_ && pyramid_->resolves(n, plot_view_->height()) &&
+        (end_ <= pyramid_->size() || plot_pyramid_)) {
+        // The pyramid answers ranges with at least a block per row without reading them. Bytes appended beyond it
+        // are plotted once build_index has caught up with them.
+        plot_pyramid_ = true;
+        if (end_ <= pyramid_->size()) plot_view_->set_data(0, pyramid_, start_, end_);
+        stageDone();
+    } else {
+        worker_->post(gen, [this, worker, gen, dat, n, entropy_acc] {
+            offset_t s = entropy_acc->size();
+            if (!for_each_window(dat.get() + s, n - s, [&entropy_acc, worker, gen](const unsigned char *p, offset_t m) {
+                entropy_acc->add(p, m);
+                return !worker->cancelled(gen);
+            })) return;
+
+            offset_t dd_n;
+            std::shared_ptr<float> dd(entropy_acc->result(dd_n), std::default_delete<float[]>());
+            worker->deliver(gen, [this, entropy_acc, dd, dd_n] {
+                entropy_acc_ = entropy_acc;
+                plot_pyramid_ = false;
+                if (dd) plot_view_->set_data(0, dd.get(), dd_n);
+                stageDone();
+            });
+        });
+    }
+
+    std::shared_ptr<const BlockIndex> index;
+    if (index_ && end_ <= index_->size()) index = index_;
+    offset_t start = start_;
+
+    worker_->post(gen, [this, worker, gen, dat, n, histo_acc, index, start, shift, d] {
+        if (shift) {
+            histo_acc->shift(dat.get(), n, d);
+        } else if (index && histo_acc->size() == 0) {
+            offset_t cnt[256];
+            index->histo(dat.get(), start, n, cnt);
+            histo_acc->add_counts(cnt, n);
+        }
+
+        offset_t s = histo_acc->size();
+        if (!for_each_window(dat.get() + s, n - s, [&histo_acc, worker, gen](const unsigned char *p, offset_t m) {
+            histo_acc->add(p, m);
+            return !worker->cancelled(gen);
+        })) return;
+
+        std::shared_ptr<float> dd(histo_acc->result(), std::default_delete<float[]>());
+        worker->deliver(gen, [this, histo_acc, dd, dat, start] {
+            histo_acc_ = histo_acc;
+            histo_dat_ = dat;
+            histo_start_ = start;
+            if (dd) plot_view_->set_data(1, dd.get(), 256, false);
+            stageDone();
+        });
+    });
+}
+
+/// build_index indexes the bytes of the file not yet in index_ and pyramid_ in the background.
+void MainApp::build_index() {
+    // The delivered index may be in use, a copy carries on from where it stopped.
+    std::shared_ptr<BlockIndex> index;
+    if (index_) index = std::make_shared<BlockIndex>(*index_);
+    else index = std::make_shared<BlockIndex>(bin_len_);
+    std::shared_ptr<EntropyPyramid> pyramid;
+    if (pyramid_) pyramid = std::make_shared<EntropyPyramid>(*pyramid_);
+    else pyramid = std::make_shared<EntropyPyramid>();
+    std::shared_ptr<ByteClassPyramid> class_pyramid;
+    if (class_pyramid_) class_pyramid = std::make_shared<ByteClassPyramid>(*class_pyramid_);
+    else class_pyramid = std::make_shared<ByteClassPyramid>();
+
+    file_data_t dat = file_data(src_);
+    offset_t n = bin_len_;
+
+    int gen = index_worker_->restart();
+    Worker *worker = index_worker_;
+    index_worker_->post(gen, [this, worker, gen, dat, n, index, pyramid, class_pyramid] {
+        // All of them have always seen the same bytes.
+        offset_t s = index->size();
+        if (!for_each_window(dat.get() + s, n - s, [&](const unsigned char *p, offset_t m) {
+            index->add(p, m);
+            pyramid->add(p, m);
+            class_pyramid->add(p, m);
+            return !worker->cancelled(gen);
+        })) return;
+
+        worker->deliver(gen, [this, index, pyramid, class_pyramid] {
+            index_ = index;
+            pyramid_ = pyramid;
+            class_pyramid_ = class_pyramid;
+            overall_primary_->set_pyramid(class_pyramid_, 0);
+            overall_zoomed_->set_pyramid(class_pyramid_, start_);
+            if (plot_pyramid_ && end_ <= pyramid_->size()) plot_view_->set_data(0, pyramid_, start_, end_);
+        });
+    });
+}
+
+void MainApp::followToggled(bool) {
+    watch_file();
+}
+
+/// watch_file watches the current file for changes while following is enabled.
+void MainApp::watch_file() {
+    if (!watcher_->files().isEmpty()) watcher_->removePaths(watcher_->files());
+
+    if (follow_->isChecked() && src_) {
+        watcher_->addPath(QString::fromStdString(src_->filename()));
+        poll_timer_->start();
+        checkGrowth();
+    } else {
+        poll_timer_->stop();
+    }
+}
+
+/// stop_analyses cancels everything reading the current file in the background and waits for it to return, the views
+/// are left showing what they had.
+void MainApp::stop_analyses() {
+    worker_->cancel();
+    index_worker_->cancel();
+    prefetcher_->cancel();
+    overall_primary_->stop();
+    overall_zoomed_->stop();
+    histogram_2d_->stop();
+    histogram_3d_->stop();
+    image_view_->stop();
+    dot_plot_->stop();
+    worker_->join();
+    index_worker_->join();
+    prefetcher_->join();
+}
+
+/// checkGrowth maps the current file again if its size changed and updates the views with the difference.
+void MainApp::checkGrowth() {
+    if (!follow_->isChecked() || !src_) return;
+
+    // Let the previous update finish first, otherwise a file that grows continuously would keep cancelling it.
+    if (progress_->value() < progress_->maximum()) return;
+
+    QString filename = QString::fromStdString(src_->filename());
+
+    // A file that is replaced rather than appended to drops out of the watcher.
+    if (!watcher_->files().contains(filename)) watcher_->addPath(filename);
+
+    if (QFileInfo(filename).size() == bin_len_) return;
+
+    // Mapping the whole file again is cheap, pages are only read once touched and only the appended ones are analyzed.
+    auto src = std::make_shared<FileSource>();
+    if (!src->open(filename.toStdString()) || src->size() == 0) return;
+
+    offset_t old_len = bin_len_;
+
+    // The old mapping now ends before the pages the analyses may still be reading, they are stopped before it goes.
+    if (offset_t(src->size()) < old_len) stop_analyses();
+
+    src_ = src;
+    bin_ = src_->data();
+    bin_len_ = offset_t(src_->size());
+
+    if (bin_len_ < old_len) {
+        // Truncated or rewritten, nothing computed so far can be reused.
+        start_ = 0;
+        end_ = bin_len_;
+        index_.reset();
+        pyramid_.reset();
+        class_pyramid_.reset();
+        update_views();
+        build_index();
+        return;
+    }
+
+    build_index();
+
+    // A selection reaching the end of the file follows it, any other selection stays put.
+    bool tail = end_ == old_len;
+    if (tail) end_ = bin_len_;
+
+    append_views(tail);
+}
+
+void MainApp::stageDone() {
+    progress_->setValue(std::min(progress_->value() + 1, progress_->maximum()));
+
+    if (progress_->value() == progress_->maximum()) prefetch_neighbors();
+}
+
+/// prefetch_neighbors prepares the files around the current one in the list, so stepping through it does not wait.
+void MainApp::prefetch_neighbors() {
+    if (cur_file_ < 0) return;
+
+    QStringList filenames;
+    for (int i = 1; i <= prefetch_depth; i++) {
+        if (cur_file_ + i < files_.size()) filenames.append(files_[cur_file_ + i]);
+        if (cur_file_ - i >= 0) filenames.append(files_[cur_file_ - i]);
+    }
+
+    prefetch_config_t config{};
+    config.overview_w = overall_primary_->width();
+    config.overview_h = overall_primary_->height();
+    config.use_byte_classes = overall_primary_->useByteClasses();
+    if (histogram_2d_->isVisible()) {
+        config.tuple_dims = 2;
+        config.tuple_dtype = histogram_2d_->dtype();
+        config.tuple_overlap = true;
+    } else if (histogram_3d_->isVisible()) {
+        config.tuple_dims = 3;
+        config.tuple_dtype = histogram_3d_->dtype();
+        config.tuple_overlap = histogram_3d_->overlap();
+    }
+
+    prefetcher_->prefetch(filenames, config);
 }
 
-void MainApp::rangeSelected(float s, float e) {
-    start_ = s * bin_len_;
-    end_ = e * bin_len_;
+/// rangeSelected shows the bytes [s, e) of the file in the range views.
+void MainApp::rangeSelected(offset_t s, offset_t e) {
+    start_ = s;
+    end_ = e;
     update_views(false);
 }
 
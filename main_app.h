@@ -20,8 +20,14 @@
 #ifndef _MAIN_APP_H_
 #define _MAIN_APP_H_
 
+#include <memory>
+
 #include <QDialog>
 
+#include "file_source.h"
+#include "offset.h"
+#include "prefetcher.h"
+
 class OverallView;
 
 class Histogram2dView;
@@ -36,10 +42,30 @@ class Histogram3dView;
 
 class PlotView;
 
+class QCheckBox;
+
 class QComboBox;
 
+class QFileSystemWatcher;
+
+class QTimer;
+
+class BlockIndex;
+
+class ByteClassPyramid;
+
+class EntropyPyramid;
+
+class EntropyAccumulator;
+
+class HistoAccumulator;
+
 class QLabel;
 
+class QProgressBar;
+
+class Worker;
+
 class MainApp : public QDialog {
 Q_OBJECT
 public:
@@ -59,7 +85,7 @@ protected slots:
 
     void quit();
 
-    void rangeSelected(float, float);
+    void rangeSelected(offset_t, offset_t);
 
     void switchView(int);
 
@@ -69,6 +95,12 @@ protected slots:
 
     bool nextFile();
 
+    void stageDone();
+
+    void followToggled(bool);
+
+    void checkGrowth();
+
 protected:
     QComboBox *cur_view_;
     std::vector<QWidget *> views_;
@@ -83,22 +115,60 @@ protected:
     Histogram3dView *histogram_3d_;
 
     QLabel *filename_;
+    QCheckBox *follow_;
+    QFileSystemWatcher *watcher_;
+    QTimer *poll_timer_;
+    QProgressBar *progress_;
+    Worker *worker_;
+    Worker *index_worker_;
+    Prefetcher *prefetcher_;
     QStringList files_;
     int cur_file_;
 
-    unsigned char *bin_;
-    size_t bin_len_;
+    std::shared_ptr<FileSource> src_;
+    const unsigned char *bin_;
+    offset_t bin_len_;
 
     bool done_flag_;
 
-    size_t start_;
-    size_t end_;
+    offset_t start_;
+    offset_t end_;
+
+    // Entropy and byte histogram of [start_, end_) as last delivered, extended in place while following a file.
+    std::shared_ptr<const EntropyAccumulator> entropy_acc_;
+    std::shared_ptr<const HistoAccumulator> histo_acc_;
+    // The bytes histo_acc_ was delivered for, which start histo_start_ bytes into the file.
+    file_data_t histo_dat_;
+    offset_t histo_start_;
+
+    // Index of the bytes of the file read so far, built in the background after loading and used to answer the
+    // histograms of a selected range.
+    std::shared_ptr<const BlockIndex> index_;
+    // Entropy of the file at several block sizes, built along with index_ and used to plot large ranges.
+    std::shared_ptr<const EntropyPyramid> pyramid_;
+    // Byte classes of the file, built along with index_ and used to draw the overviews.
+    std::shared_ptr<const ByteClassPyramid> class_pyramid_;
+    // Whether the entropy plot of [start_, end_) comes from pyramid_, which build_index then keeps up to date.
+    bool plot_pyramid_;
 
 //    void updatePositions(bool resized = false);
 
     void resizeEvent(QResizeEvent *e) override;
 
-    void update_views(bool update_iv1 = true);
+    void update_views(bool update_iv1 = true, const prefetched_t *pre = nullptr);
+
+    void append_views(bool tail);
+
+    void update_plots(int gen, const std::shared_ptr<EntropyAccumulator> &entropy_acc,
+                      const std::shared_ptr<HistoAccumulator> &histo_acc, bool shift = false, offset_t d = 0);
+
+    void build_index();
+
+    void stop_analyses();
+
+    void watch_file();
+
+    void prefetch_neighbors();
 };
 
 #endif
@@ -17,19 +17,35 @@
  *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
 #include <QtGui>
 
+#include "byte_histo.h"
 #include "hilbert.h"
 #include "overall_view.h"
+#include "paint_image.h"
+#include "worker.h"
 
 using std::min;
+using std::max;
+
+// Pixels spanning at least this many bytes are reduced through a byte histogram, smaller ones byte by byte.
+static const offset_t histo_min_n = 4096;
 
 OverallView::OverallView(QWidget *p)
         : QLabel(p),
           m1_(0.), m2_(1.), px_(-1), py_(-1), s_(none), allow_selection_(true),
           use_byte_classes_(true),
           use_hilbert_curve_(true),
-          dat_(nullptr), len_(0) {
+          len_(0), offset_(0) {
+    worker_ = new Worker(this);
+}
+
+/// stop cancels the overview being computed in the background and waits for it to let go of the data.
+void OverallView::stop() {
+    worker_->cancel();
+    worker_->join();
 }
 
 void OverallView::enableSelection(bool v) {
@@ -40,110 +56,312 @@ void OverallView::enableSelection(bool v) {
 void OverallView::setImage(QImage &img) {
     img_ = img;
 
-    update_pix();
-
     update();
 }
 
-void OverallView::set_data(const unsigned char *dat, long len, bool reset_selection) {
-    dat_ = dat;
-    len_ = len;
+/// OverviewAccumulator constructor.
+/// @param [in] w Width of the image.
+/// @param [in] h Height of the image.
+/// @param [in] len Expected length of the stream in bytes, which determines the initial number of bytes per pixel.
+/// @param [in] use_byte_classes Whether to color bytes by class (true) or show the average byte value (false).
+OverviewAccumulator::OverviewAccumulator(int w, int h, offset_t len, bool use_byte_classes)
+        : w_(w), h_(h), use_byte_classes_(use_byte_classes), sf_(len / max(w * h, 1) + 1), len_(0) {
+}
 
-    if (reset_selection) {
-        m1_ = 0.;
-        m2_ = 1.;
+/// add reduces the next window of the stream into pixels, a pixel may span several windows. Should the stream grow
+/// beyond the expected length, the bytes per pixel are doubled and neighboring pixels merged, so the pixels never
+/// outnumber w x h.
+/// @param [in] dat Byte data to be shown.
+/// @param [in] n Length of dat in bytes.
+void OverviewAccumulator::add(const unsigned char *dat, offset_t n) {
+    len_ += max(n, offset_t(0));
+
+    for (offset_t i = 0; i < n;) {
+        // A pixel made from the blocks of a pyramid may be longer than sf_ bytes, and so may two of them merged. Such a
+        // pixel is complete, extending it would lose track of its length.
+        if (cells_.empty() || cells_.back().n >= sf_) {
+            if (offset_t(cells_.size()) >= offset_t(w_) * h_) merge();
+            if (cells_.empty() || cells_.back().n >= sf_) cells_.push_back(cell_t{0, 0, 0, 0});
+        }
+
+        // Sums of sf bytes, which overflow an int once sf exceeds roughly 8M bytes per pixel.
+        cell_t &c = cells_.back();
+        offset_t ie = min(n, i + (sf_ - c.n));
+        c.n += ie - i;
+
+        if (ie - i >= histo_min_n) {
+            // Both kinds of pixel only depend on how often each byte value occurs.
+            offset_t cnt[256] = {0};
+            add_byte_histo(cnt, dat + i, ie - i);
+            i = ie;
+
+            byte_class_sums_t sums = {0, 0, 0, 0, 0};
+            for (int v = 0x01; v <= 0x1f; v++) sums.low += cnt[v];
+            for (int v = 0x20; v <= 0x7f; v++) sums.text += cnt[v];
+            for (int v = 0x80; v < 0xff; v++) sums.high += cnt[v];
+            sums.ff = cnt[0xff];
+            for (int v = 0; v < 256; v++) sums.sum += cnt[v] * v;
+            add_sums(c, sums);
+        } else if (!use_byte_classes_) {
+            for (; i < ie; i++) {
+                c.g += dat[i];
+            }
+        } else {
+            for (; i < ie; i++) {
+                unsigned char v = dat[i];
+                if (v == 0x00) {
+                    c.r += 0x00;
+                    c.g += 0x00;
+                    c.b += 0x00;
+                } else if (0x00 < v && v <= 0x1f) {
+                    c.r += 0x00;
+                    c.g += 0x00;
+                    c.b += 0xf0;
+                } else if (0x1f < v && v <= 0x7f) {
+                    c.r += 0x00;
+                    c.g += 0xf0;
+                    c.b += 0x00;
+                } else if (0x7f < v && v < 0xff) {
+                    c.r += 0xf0;
+                    c.g += 0x00;
+                    c.b += 0x00;
+                } else if (v == 0xff) {
+                    c.r += 0xff;
+                    c.g += 0xff;
+                    c.b += 0xff;
+                }
+            }
+        }
     }
+}
 
-    int w = width();
-    int h = height();
+/// add_sums adds the bytes summed in s to pixel c.
+void OverviewAccumulator::add_sums(cell_t &c, const byte_class_sums_t &s) const {
+    if (!use_byte_classes_) {
+        c.g += s.sum;
+    } else {
+        c.r += s.high * 0xf0 + s.ff * 0xff;
+        c.g += s.text * 0xf0 + s.ff * 0xff;
+        c.b += s.low * 0xf0 + s.ff * 0xff;
+    }
+}
+
+/// add reduces n bytes starting offset bytes into the file summed by pyramid into pixels, without reading them. Pixel
+/// boundaries are moved onto the blocks of the pyramid, which changes the bytes per pixel by less than a block, so
+/// only the bytes at either end of the range are read.
+/// @param [in] pyramid Sums of the file.
+/// @param [in] dat Byte data to be shown, the byte at offset of the file.
+/// @param [in] offset Start of the range.
+/// @param [in] n Length of the range in bytes.
+/// @return Whether the pixels were added, false if the accumulator is not empty, the pyramid does not cover the range
+/// or its blocks are too coarse for the pixels, in which case add(dat, n) has to read the bytes.
+bool OverviewAccumulator::add(const ByteClassPyramid &pyramid, const unsigned char *dat, offset_t offset, offset_t n) {
+    offset_t bs = pyramid.block_size();
+    if (len_ != 0 || n <= 0 || offset + n > pyramid.size() || sf_ < max(histo_min_n, 16 * bs)) return false;
+
+    offset_t a = 0;
+    for (offset_t k = 1; a < n; k++) {
+        // Rounding up makes a pixel up to a block shorter or longer than sf_ bytes, the last one is never longer.
+        offset_t b = min(n, k * sf_);
+        offset_t bb = (offset + b + bs - 1) / bs * bs - offset;
+        if (bb < n) b = bb;
+
+        byte_class_sums_t sums;
+        pyramid.sums(dat + a, offset + a, b - a, sums);
+        cell_t c = {0, 0, 0, b - a};
+        add_sums(c, sums);
+        cells_.push_back(c);
+        a = b;
+    }
+    len_ = n;
+
+    return true;
+}
+
+/// merge doubles the number of bytes per pixel by combining neighboring pixels.
+void OverviewAccumulator::merge() {
+    size_t k = 0;
+    for (size_t i = 0; i < cells_.size(); i += 2, k++) {
+        cell_t c = cells_[i];
+        if (i + 1 < cells_.size()) {
+            c.r += cells_[i + 1].r;
+            c.g += cells_[i + 1].g;
+            c.b += cells_[i + 1].b;
+            c.n += cells_[i + 1].n;
+        }
+        cells_[k] = c;
+    }
+    cells_.resize(k);
+
+    sf_ *= 2;
+}
+
+offset_t OverviewAccumulator::size() const {
+    return len_;
+}
+
+/// matches returns whether the accumulator renders the same image as one constructed with the given arguments.
+bool OverviewAccumulator::matches(int w, int h, bool use_byte_classes) const {
+    return w_ == w && h_ == h && use_byte_classes_ == use_byte_classes;
+}
+
+/// image lays out the pixels seen so far.
+/// @param [in] use_hilbert_curve Whether to lay out pixels along a Hilbert curve (true) or in rows (false).
+/// @return The image, w wide and as high as the pixels fill, to be stretched to w x h when shown.
+QImage OverviewAccumulator::image(bool use_hilbert_curve) const {
+    int w = w_, h = h_;
     int wh = w * h;
-    int sf = len / wh + 1;
+    if (wh <= 0) return QImage();
 
-    int img_w = w, img_h = len / sf / w + 1;
+    int img_w = w, img_h = int(len_ / sf_ / w + 1);
     QImage img(img_w, img_h, QImage::Format_RGB32);
     printf("%d %d   %d %d\n", w, h, img_w, img_h);
     img.fill(0);
 
-    curve_t hilbert;
-    int h_ind = 0;
-    if (use_hilbert_curve_) gilbert2d(img_w, img_h, hilbert);
+    std::shared_ptr<const curve_index_t> hilbert;
+    size_t h_ind = 0;
+    if (use_hilbert_curve) hilbert = gilbert2d_index(img_w, img_h);
 
     auto p = (unsigned int *) img.bits();
 
-    for (int i = 0; i < len;) {
-        int r = 0, g = 0, b = 0;
+    for (const auto &c : cells_) {
+        offset_t r, g, b;
 
         if (!use_byte_classes_) {
-            int cn = 0;
-            int j;
-            for (j = 0; i < len && j < sf; i++, j++) {
-                cn += dat[i];
-            }
             r = 20;
-            g = cn / j;
+            g = c.g / c.n;
             b = 20;
         } else {
-            int j;
-            for (j = 0; i < len && j < sf; i++, j++) {
-                unsigned char c = dat[i];
-                if (c == 0x00) {
-                    r += 0x00;
-                    g += 0x00;
-                    b += 0x00;
-                } else if (0x00 < c && c <= 0x1f) {
-                    r += 0x00;
-                    g += 0x00;
-                    b += 0xf0;
-                } else if (0x1f < c && c <= 0x7f) {
-                    r += 0x00;
-                    g += 0xf0;
-                    b += 0x00;
-                } else if (0x7f < c && c < 0xff) {
-                    r += 0xf0;
-                    g += 0x00;
-                    b += 0x00;
-                } else if (c == 0xff) {
-                    r += 0xff;
-                    g += 0xff;
-                    b += 0xff;
-                }
-            }
-
-            r /= j;
-            g /= j;
-            b /= j;
+            r = c.r / c.n;
+            g = c.g / c.n;
+            b = c.b / c.n;
         }
 
-        r = min(255, r) & 0xff;
-        g = min(255, g) & 0xff;
-        b = min(255, b) & 0xff;
+        r = min(offset_t(255), r) & 0xff;
+        g = min(offset_t(255), g) & 0xff;
+        b = min(offset_t(255), b) & 0xff;
 
         unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
 
-        if (!use_hilbert_curve_) {
+        if (!use_hilbert_curve) {
             *p++ = v;
         } else {
-            if (h_ind >= hilbert.size()) abort();
-
-            int x = hilbert[h_ind].first;
-            int y = hilbert[h_ind++].second;
-            int ind = y * w + x;
-            if (ind < wh) {
-                p[ind] = v;
-            } else {
-                abort();
-            }
+            if (h_ind >= hilbert->size()) abort();
+
+            p[(*hilbert)[h_ind++]] = v;
         }
     }
 
-    img = img.scaled(size());
-    setImage(img);
+    return img;
+}
+
+/// set_data renders the overview of dat in the background, replacing any render still in progress.
+void OverallView::set_data(const file_data_t &dat, offset_t len, bool reset_selection) {
+    dat_ = dat;
+    len_ = len;
+    acc_.reset();
+
+    if (reset_selection) {
+        m1_ = 0.;
+        m2_ = 1.;
+    }
+
+    int w = width();
+    int h = height();
+    if (w * h <= 0 || !dat) {
+        emit(dataReady());
+        return;
+    }
+
+    update_data(std::make_shared<OverviewAccumulator>(w, h, len, use_byte_classes_));
+}
+
+/// append_data extends the overview to len bytes of dat, only the bytes beyond the previous length are read. dat must
+/// start at the same offset as the data last passed to set_data().
+void OverallView::append_data(const file_data_t &dat, offset_t len) {
+    if (!acc_ || acc_->size() > len) {
+        set_data(dat, len, false);
+        return;
+    }
+
+    dat_ = dat;
+    len_ = len;
+
+    // The delivered accumulator is left untouched, a copy carries on from where it stopped.
+    update_data(std::make_shared<OverviewAccumulator>(*acc_));
+}
+
+/// set_prefetched shows the overview of dat from acc computed ahead of time, falling back to set_data() if acc does not
+/// cover len bytes or was made for a different size or coloring.
+void OverallView::set_prefetched(const file_data_t &dat, offset_t len, const std::shared_ptr<const OverviewAccumulator> &acc) {
+    if (!acc || acc->size() != len || !acc->matches(width(), height(), use_byte_classes_)) {
+        set_data(dat, len);
+        return;
+    }
+
+    dat_ = dat;
+    len_ = len;
+    m1_ = 0.;
+    m2_ = 1.;
+
+    // Nothing is left to read, only the image is laid out in the background.
+    update_data(std::make_shared<OverviewAccumulator>(*acc));
+}
+
+/// set_pyramid lets the overview be summed from pyramid rather than read from the bytes. The overview shows the data
+/// starting offset bytes into the file of pyramid, and is not updated until the next set_data().
+void OverallView::set_pyramid(const std::shared_ptr<const ByteClassPyramid> &pyramid, offset_t offset) {
+    pyramid_ = pyramid;
+    offset_ = offset;
+}
+
+bool OverallView::useByteClasses() const {
+    return use_byte_classes_;
+}
+
+/// update_data streams the bytes of dat_ not yet seen by acc into it in the background, then shows the result. An
+/// empty acc is summed from the pyramid instead where it covers dat_.
+void OverallView::update_data(const std::shared_ptr<OverviewAccumulator> &acc) {
+    file_data_t dat = dat_;
+    offset_t len = len_;
+    bool use_hilbert_curve = use_hilbert_curve_;
+    std::shared_ptr<const ByteClassPyramid> pyramid = pyramid_;
+    offset_t offset = offset_;
+
+    int gen = worker_->restart();
+    Worker *worker = worker_;
+    worker_->post(gen, [this, worker, gen, dat, len, acc, use_hilbert_curve, pyramid, offset] {
+        if (pyramid) acc->add(*pyramid, dat.get(), offset, len);
+
+        offset_t s = acc->size();
+        if (!for_each_window(dat.get() + s, len - s, [&acc, worker, gen](const unsigned char *p, offset_t m) {
+            acc->add(p, m);
+            return !worker->cancelled(gen);
+        })) return;
+
+        QImage img = acc->image(use_hilbert_curve);
+        worker->deliver(gen, [this, acc, img] {
+            acc_ = acc;
+            QImage tmp = img;
+            setImage(tmp);
+            emit(dataReady());
+        });
+    });
+}
+
+/// setSelection moves the selection markers, without emitting rangeSelected().
+void OverallView::setSelection(double m1, double m2) {
+    m1_ = m1;
+    m2_ = m2;
+    update();
 }
 
 void OverallView::paintEvent(QPaintEvent *e) {
     QLabel::paintEvent(e);
 
     QPainter p(this);
+    paint_image(p, this, img_);
+
     if (allow_selection_) {
         int ry1 = m1_ * height();
         int ry2 = m2_ * height();
@@ -160,22 +378,6 @@ void OverallView::paintEvent(QPaintEvent *e) {
     p.drawRect(0, 0, width() - 1, height() - 1);
 }
 
-void OverallView::resizeEvent(QResizeEvent *e) {
-    QLabel::resizeEvent(e);
-
-    update_pix();
-}
-
-void OverallView::update_pix() {
-    if (img_.isNull()) return;
-
-    int vw = width() - 4;
-    int vh = height() - 4; // TODO BUG: With QDarkStyle, without the subtraction, the height or width of the application grows without bounds.
-    pix_ = QPixmap::fromImage(img_).scaled(vw, vh); //, Qt::KeepAspectRatio);
-    setPixmap(pix_);
-    printf("%d %d   %d %d   %d %d\n", vw, vh, img_.width(), img_.height(), width(), height());
-}
-
 // Gray code related functions are from https://en.wikipedia.org/wiki/Gray_code
 static unsigned int BinaryToGray(unsigned int num) {
     return num ^ (num >> 1);
@@ -213,7 +415,7 @@ void OverallView::mousePressEvent(QMouseEvent *e) {
         if (y < 0) y = 0;
         if (y > height() - 1) y = height() - 1;
 
-        float yp = y / float(height());
+        double yp = y / double(height());
 
         if (yp > m1_ && (yp - m1_) < .01) {
             s_ = m1_moving;
@@ -247,14 +449,14 @@ void OverallView::mouseMoveEvent(QMouseEvent *e) {
 
     int h = height();
 
-    float m1 = m1_;
-    float m2 = m2_;
+    double m1 = m1_;
+    double m2 = m2_;
     if (s_ == m1_moving) {
-        m1 = y / float(h);
+        m1 = y / double(h);
     } else if (s_ == m2_moving) {
-        m2 = y / float(h);
+        m2 = y / double(h);
     } else if (s_ == m12_moving) {
-        float dy = (y - py_) / float(h);
+        double dy = (y - py_) / double(h);
         m1 += dy;
         m2 += dy;
     }
@@ -271,7 +473,7 @@ void OverallView::mouseMoveEvent(QMouseEvent *e) {
 
     update();
 
-    emit(rangeSelected(m1_, m2_));
+    emit(rangeSelected(min(offset_t(m1_ * len_), len_), min(offset_t(m2_ * len_), len_)));
 }
 
 void OverallView::mouseReleaseEvent(QMouseEvent *e) {
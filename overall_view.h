@@ -20,9 +20,49 @@
 #ifndef _OVERALL_VIEW_H_
 #define _OVERALL_VIEW_H_
 
+#include <memory>
+#include <vector>
+
 #include <QLabel>
 #include <QImage>
-#include <QPixmap>
+
+#include "byte_class_pyramid.h"
+#include "file_source.h"
+#include "offset.h"
+
+class Worker;
+
+/// OverviewAccumulator reduces a stream of bytes that arrives in consecutive windows to at most w x h pixels of
+/// consecutive bytes each.
+class OverviewAccumulator {
+public:
+    OverviewAccumulator(int w, int h, offset_t len, bool use_byte_classes);
+
+    void add(const unsigned char *dat, offset_t n);
+
+    bool add(const ByteClassPyramid &pyramid, const unsigned char *dat, offset_t offset, offset_t n);
+
+    offset_t size() const;
+
+    bool matches(int w, int h, bool use_byte_classes) const;
+
+    QImage image(bool use_hilbert_curve) const;
+
+protected:
+    typedef struct {
+        offset_t r, g, b, n;
+    } cell_t;
+
+    void merge();
+
+    void add_sums(cell_t &c, const byte_class_sums_t &s) const;
+
+    int w_, h_;
+    bool use_byte_classes_;
+    offset_t sf_;
+    offset_t len_;
+    std::vector<cell_t> cells_;
+};
 
 class OverallView : public QLabel {
 Q_OBJECT
@@ -31,11 +71,23 @@ public:
 
     ~OverallView() override = default;
 
+    void stop();
+
 public slots:
 
     void setImage(QImage &img);
 
-    void set_data(const unsigned char *bin, long len, bool reset_selection = true);
+    void set_data(const file_data_t &dat, offset_t len, bool reset_selection = true);
+
+    void append_data(const file_data_t &dat, offset_t len);
+
+    void set_prefetched(const file_data_t &dat, offset_t len, const std::shared_ptr<const OverviewAccumulator> &acc);
+
+    void set_pyramid(const std::shared_ptr<const ByteClassPyramid> &pyramid, offset_t offset);
+
+    bool useByteClasses() const;
+
+    void setSelection(double m1, double m2);
 
     void enableSelection(bool);
 
@@ -43,21 +95,19 @@ protected slots:
 
 protected:
     QImage img_;
-    QPixmap pix_;
 
     void paintEvent(QPaintEvent *) override;
 
-    void resizeEvent(QResizeEvent *e) override;
-
     void mousePressEvent(QMouseEvent *event) override;
 
     void mouseMoveEvent(QMouseEvent *event) override;
 
     void mouseReleaseEvent(QMouseEvent *event) override;
 
-    void update_pix();
+    void update_data(const std::shared_ptr<OverviewAccumulator> &acc);
 
-    float m1_, m2_;
+    // The selection as fractions of len_, in double precision so that it resolves single bytes of large files.
+    double m1_, m2_;
     int px_, py_;
     enum {
         none, m1_moving, m2_moving, m12_moving
@@ -67,12 +117,20 @@ protected:
     bool use_byte_classes_;
     bool use_hilbert_curve_;
 
-    const unsigned char *dat_;
-    long len_;
+    file_data_t dat_;
+    offset_t len_;
+    std::shared_ptr<const OverviewAccumulator> acc_;
+    // Sums of the file dat_ is part of, dat_ starting offset_ bytes into it
+    std::shared_ptr<const ByteClassPyramid> pyramid_;
+    offset_t offset_;
+
+    Worker *worker_;
 
 signals:
 
-    void rangeSelected(float, float);
+    void rangeSelected(offset_t, offset_t);
+
+    void dataReady();
 };
 
 #endif
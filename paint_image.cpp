@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "paint_image.h"
+
+// Space left around the image for the border the views draw.
+static const int border = 2;
+
+/// paint_image draws img stretched over w, inside its border. The painter scales img straight into the device pixels
+/// being painted, so no scaled copy is made, resizing only repaints and HiDPI screens get their full resolution.
+/// @param [in] p Painter of w.
+/// @param [in] w The widget painted.
+/// @param [in] img The image, drawn without smoothing so single bytes stay distinct.
+void paint_image(QPainter &p, const QWidget *w, const QImage &img) {
+    if (img.isNull()) return;
+
+    QRectF target = QRectF(w->rect()).adjusted(border, border, -border, -border);
+    p.drawImage(target, img);
+}
+
+/// device_width returns the width of w in device pixels, the width an image rendered for w needs to show every pixel.
+int device_width(const QWidget *w) {
+    return int(w->width() * w->devicePixelRatioF() + .5);
+}
+
+/// device_height returns the height of w in device pixels.
+int device_height(const QWidget *w) {
+    return int(w->height() * w->devicePixelRatioF() + .5);
+}
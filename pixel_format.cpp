@@ -0,0 +1,535 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+#include "pixel_format.h"
+
+/// pixel_formats returns every format ImageView can decode, in the order it lists them. A new format only needs a
+/// descriptor here, unless it is packed differently than whole 8 or 16 bit samples.
+const std::vector<pixel_format_t> &pixel_formats() {
+    static const std::vector<pixel_format_t> formats = {
+            {"RGB 8",                 3, 0, 1, 2, 1, 8,  false, -1, packing_none},
+            {"RGB 12",                3, 0, 1, 2, 2, 12, false, -1, packing_none},
+            {"RGB 16",                3, 0, 1, 2, 2, 16, false, -1, packing_none},
+            {"RGBA 8",                4, 0, 1, 2, 1, 8,  false, -1, packing_none},
+            {"RGBA 12",               4, 0, 1, 2, 2, 12, false, -1, packing_none},
+            {"RGBA 16",               4, 0, 1, 2, 2, 16, false, -1, packing_none},
+            {"BGR 8",                 3, 2, 1, 0, 1, 8,  false, -1, packing_none},
+            {"BGR 12",                3, 2, 1, 0, 2, 12, false, -1, packing_none},
+            {"BGR 16",                3, 2, 1, 0, 2, 16, false, -1, packing_none},
+            {"BGRA 8",                4, 2, 1, 0, 1, 8,  false, -1, packing_none},
+            {"BGRA 12",               4, 2, 1, 0, 2, 12, false, -1, packing_none},
+            {"BGRA 16",               4, 2, 1, 0, 2, 16, false, -1, packing_none},
+            {"Grey 8",                1, 0, 0, 0, 1, 8,  false, -1, packing_none},
+            {"Grey 12",               1, 0, 0, 0, 2, 12, false, -1, packing_none},
+            {"Grey 16",               1, 0, 0, 0, 2, 16, false, -1, packing_none},
+            {"RGB 16 BE",             3, 0, 1, 2, 2, 16, true,  -1, packing_none},
+            {"Grey 16 BE",            1, 0, 0, 0, 2, 16, true,  -1, packing_none},
+            {"RAW10",                 1, 0, 0, 0, 2, 10, false, -1, packing_mipi},
+            {"RAW12",                 1, 0, 0, 0, 2, 12, false, -1, packing_mipi},
+            {"RAW14",                 1, 0, 0, 0, 2, 14, false, -1, packing_mipi},
+            {"YUYV",                  3, 0, 0, 0, 1, 8,  false, -1, packing_yuyv},
+            {"UYVY",                  3, 0, 0, 0, 1, 8,  false, -1, packing_uyvy},
+            {"NV12",                  3, 0, 0, 0, 1, 8,  false, -1, packing_nv12},
+            {"NV21",                  3, 0, 0, 0, 1, 8,  false, -1, packing_nv21},
+            {"I420",                  3, 0, 0, 0, 1, 8,  false, -1, packing_i420},
+            {"Bayer 8 - 0: 0 1 2 3",  1, 0, 0, 0, 1, 8,  false, 0,  packing_none},
+            {"Bayer 8 - 1: 0 1 3 2",  1, 0, 0, 0, 1, 8,  false, 1,  packing_none},
+            {"Bayer 8 - 2: 0 2 1 3",  1, 0, 0, 0, 1, 8,  false, 2,  packing_none},
+            {"Bayer 8 - 3: 0 2 3 1",  1, 0, 0, 0, 1, 8,  false, 3,  packing_none},
+            {"Bayer 8 - 4: 0 3 1 2",  1, 0, 0, 0, 1, 8,  false, 4,  packing_none},
+            {"Bayer 8 - 5: 0 3 2 1",  1, 0, 0, 0, 1, 8,  false, 5,  packing_none},
+            {"Bayer 8 - 6: 1 0 2 3",  1, 0, 0, 0, 1, 8,  false, 6,  packing_none},
+            {"Bayer 8 - 7: 1 0 3 2",  1, 0, 0, 0, 1, 8,  false, 7,  packing_none},
+            {"Bayer 8 - 8: 1 2 0 3",  1, 0, 0, 0, 1, 8,  false, 8,  packing_none},
+            {"Bayer 8 - 9: 1 2 3 0",  1, 0, 0, 0, 1, 8,  false, 9,  packing_none},
+            {"Bayer 8 - 10: 1 3 0 2", 1, 0, 0, 0, 1, 8,  false, 10, packing_none},
+            {"Bayer 8 - 11: 1 3 2 0", 1, 0, 0, 0, 1, 8,  false, 11, packing_none},
+            {"Bayer 8 - 12: 2 0 1 3", 1, 0, 0, 0, 1, 8,  false, 12, packing_none},
+            {"Bayer 8 - 13: 2 0 3 1", 1, 0, 0, 0, 1, 8,  false, 13, packing_none},
+            {"Bayer 8 - 14: 2 1 0 3", 1, 0, 0, 0, 1, 8,  false, 14, packing_none},
+            {"Bayer 8 - 15: 2 1 3 0", 1, 0, 0, 0, 1, 8,  false, 15, packing_none},
+            {"Bayer 8 - 16: 2 3 0 1", 1, 0, 0, 0, 1, 8,  false, 16, packing_none},
+            {"Bayer 8 - 17: 2 3 1 0", 1, 0, 0, 0, 1, 8,  false, 17, packing_none},
+            {"Bayer 8 - 18: 3 0 1 2", 1, 0, 0, 0, 1, 8,  false, 18, packing_none},
+            {"Bayer 8 - 19: 3 0 2 1", 1, 0, 0, 0, 1, 8,  false, 19, packing_none},
+            {"Bayer 8 - 20: 3 1 0 2", 1, 0, 0, 0, 1, 8,  false, 20, packing_none},
+            {"Bayer 8 - 21: 3 1 2 0", 1, 0, 0, 0, 1, 8,  false, 21, packing_none},
+            {"Bayer 8 - 22: 3 2 0 1", 1, 0, 0, 0, 1, 8,  false, 22, packing_none},
+            {"Bayer 8 - 23: 3 2 1 0", 1, 0, 0, 0, 1, 8,  false, 23, packing_none},
+    };
+    return formats;
+}
+
+/// find_pixel_format returns the index within pixel_formats() of the format called name, -1 if there is none.
+int find_pixel_format(const std::string &name) {
+    const auto &formats = pixel_formats();
+    for (size_t i = 0; i < formats.size(); i++) {
+        if (name == formats[i].name) return int(i);
+    }
+    return -1;
+}
+
+/// pixel_format_size returns the number of bytes of a pixel of f, for formats of whole samples.
+int pixel_format_size(const pixel_format_t &f) {
+    return f.channels * f.sample_size;
+}
+
+/// packing_group returns the fewest whole pixels of f, and the bytes holding them, that rows are made of. Planar
+/// formats count their plane of Y.
+static void packing_group(const pixel_format_t &f, int &px, int &bytes) {
+    switch (f.packing) {
+        case packing_none:
+            px = 1;
+            bytes = pixel_format_size(f);
+            break;
+        case packing_mipi:
+            px = f.bits == 12 ? 2 : 4;
+            bytes = px * f.bits / 8;
+            break;
+        case packing_yuyv:
+        case packing_uyvy:
+            px = 2;
+            bytes = 4;
+            break;
+        default:
+            px = 1;
+            bytes = 1;
+            break;
+    }
+}
+
+/// pixel_format_row_bytes returns the number of bytes of a row of w pixels of f, the last group of pixels of packed
+/// formats completed. The rows of planar formats are those of their plane of Y.
+offset_t pixel_format_row_bytes(const pixel_format_t &f, int w) {
+    int px, bytes;
+    packing_group(f, px, bytes);
+    return offset_t((w + px - 1) / px) * bytes;
+}
+
+/// pixel_format_width returns the most pixels of f a row of row_bytes holds, 0 if that is not a whole number of
+/// groups of pixels.
+int pixel_format_width(const pixel_format_t &f, offset_t row_bytes) {
+    int px, bytes;
+    packing_group(f, px, bytes);
+    if (bytes <= 0 || row_bytes % bytes != 0) return 0;
+    return int(row_bytes / bytes * px);
+}
+
+/// pixel_format_planar returns whether f stores frames of planes, whose rows cannot be found without the number of
+/// rows of a frame.
+bool pixel_format_planar(const pixel_format_t &f) {
+    return f.packing == packing_nv12 || f.packing == packing_nv21 || f.packing == packing_i420;
+}
+
+/// pixel_format_frame_bytes returns the number of bytes of a frame of f of w x frame_h pixels, Y followed by U and V
+/// at half the width and height, rounded up.
+offset_t pixel_format_frame_bytes(const pixel_format_t &f, int w, int frame_h) {
+    if (!pixel_format_planar(f)) return pixel_format_row_bytes(f, w) * frame_h;
+    offset_t cw = (w + 1) / 2, ch = (frame_h + 1) / 2;
+    return offset_t(w) * frame_h + 2 * cw * ch;
+}
+
+/// pixel_format_frame_rows returns the rows of a frame of f of width w. Without a height, frame_h 0, n bytes are a
+/// single frame of as many whole pairs of rows as fit.
+int pixel_format_frame_rows(const pixel_format_t &f, int w, int frame_h, offset_t n) {
+    if (!pixel_format_planar(f) || frame_h > 0 || w <= 0) return frame_h;
+    offset_t pair = 2 * offset_t(w) + 2 * ((w + 1) / 2);
+    return int(std::min(offset_t(1) << 30, n / pair * 2));
+}
+
+template<int sample_size, bool big_endian>
+static inline unsigned int load_sample(const unsigned char *p) {
+    if (sample_size == 1) return p[0];
+    if (big_endian) return (unsigned int) (p[0] << 8) | p[1];
+    return (unsigned int) (p[1] << 8) | p[0];
+}
+
+/// convert_generic converts pixels one at a time, specialized for the layouts of the formats.
+template<int channels, int sample_size, bool big_endian>
+static void convert_generic(const pixel_format_t &f, const unsigned char *src, offset_t n, uint32_t *dst) {
+    const int ps = channels * sample_size;
+    const int shift = f.bits - 8;
+    const int ro = f.r * sample_size, go = f.g * sample_size, bo = f.b * sample_size;
+
+    for (offset_t i = 0; i < n; i++) {
+        const unsigned char *p = src + i * ps;
+        unsigned int r = (load_sample<sample_size, big_endian>(p + ro) >> shift) & 0xff;
+        unsigned int g = (load_sample<sample_size, big_endian>(p + go) >> shift) & 0xff;
+        unsigned int b = (load_sample<sample_size, big_endian>(p + bo) >> shift) & 0xff;
+        dst[i] = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
+    }
+}
+
+/// mipi_byte returns the byte of a row of f holding the top 8 bits of pixel i, packing_mipi.
+static inline offset_t mipi_byte(int px, int bytes, offset_t i) {
+    return i / px * bytes + i % px;
+}
+
+/// convert_mipi converts pixels one at a time from the top 8 bits of their samples, the low bits of which are packed
+/// after every group of pixels.
+static void convert_mipi(const pixel_format_t &f, const unsigned char *src, offset_t n, uint32_t *dst) {
+    int px, bytes;
+    packing_group(f, px, bytes);
+    for (offset_t i = 0; i < n; i++) {
+        unsigned int v = src[mipi_byte(px, bytes, i)];
+        dst[i] = 0xff000000 | (v << 16) | (v << 8) | v;
+    }
+}
+
+typedef void (*convert_fn_t)(const pixel_format_t &f, const unsigned char *src, offset_t n, uint32_t *dst);
+
+/// generic_kernel returns the specialization of convert_generic() for f, or convert_mipi().
+static convert_fn_t generic_kernel(const pixel_format_t &f) {
+    if (f.packing == packing_mipi) return convert_mipi;
+    if (f.packing != packing_none) return nullptr;
+
+#define PIXEL_KERNEL(c) \
+    if (f.sample_size == 1) return convert_generic<c, 1, false>; \
+    if (f.big_endian) return convert_generic<c, 2, true>; \
+    return convert_generic<c, 2, false>;
+
+    switch (f.channels) {
+        case 1:
+        PIXEL_KERNEL(1)
+        case 3:
+        PIXEL_KERNEL(3)
+        case 4:
+        PIXEL_KERNEL(4)
+        default:
+            return nullptr;
+    }
+#undef PIXEL_KERNEL
+}
+
+/// yuv_scalar converts pixels of Y, U and V, U and V shared by pairs of pixels, by BT.601 for video, Y of 16 to 235
+/// and U and V of 16 to 240.
+static void yuv_scalar(const unsigned char *y, const unsigned char *u, const unsigned char *v, offset_t n,
+                       uint32_t *dst) {
+    for (offset_t i = 0; i < n; i++) {
+        int c = (y[i] - 16) * 298 + 128, d = u[i / 2] - 128, e = v[i / 2] - 128;
+        int r = std::min(255, std::max(0, (c + 409 * e) >> 8));
+        int g = std::min(255, std::max(0, (c - 100 * d - 208 * e) >> 8));
+        int b = std::min(255, std::max(0, (c + 516 * d) >> 8));
+        dst[i] = 0xff000000 | (r << 16) | (g << 8) | b;
+    }
+}
+
+/// shuffle_mask builds the byte shuffle converting the pixels of f within a 16 byte load to 0xffrrggbb, for formats
+/// whose colors are whole bytes.
+/// @param [in] f The format.
+/// @param [out] mask The shuffle, 16 bytes, 0x80 selecting 0.
+/// @param [out] step The number of bytes of the pixels of a load, the distance to the next load.
+/// @return The number of pixels converted per load, 0 if f cannot be converted by a shuffle.
+static int shuffle_mask(const pixel_format_t &f, unsigned char *mask, int &step) {
+    memset(mask, 0x80, 16);
+
+    if (f.packing == packing_mipi) {
+        // The top bytes of 4 pixels, at most 7 bytes apart
+        int px, bytes;
+        packing_group(f, px, bytes);
+        for (int p = 0; p < 4; p++) {
+            auto i = (unsigned char) mipi_byte(px, bytes, p);
+            mask[p * 4 + 0] = mask[p * 4 + 1] = mask[p * 4 + 2] = i;
+        }
+        step = 4 / px * bytes;
+        return 4;
+    }
+
+    if (f.packing != packing_none || f.bits != 8 * f.sample_size ||
+        (f.channels != 1 && f.channels != 3 && f.channels != 4)) {
+        return 0;
+    }
+
+    int ps = pixel_format_size(f);
+    int px = std::min(4, 16 / ps);
+    // The top byte of a sample holds the 8 bits shown
+    int top = f.sample_size == 2 && !f.big_endian ? 1 : 0;
+
+    for (int p = 0; p < px; p++) {
+        mask[p * 4 + 0] = (unsigned char) (p * ps + f.b * f.sample_size + top);
+        mask[p * 4 + 1] = (unsigned char) (p * ps + f.g * f.sample_size + top);
+        mask[p * 4 + 2] = (unsigned char) (p * ps + f.r * f.sample_size + top);
+    }
+    step = px * ps;
+    return px;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_FORMAT_DISPATCH
+
+/// convert_ssse3 converts px pixels per 16 byte load with a shuffle, a load every step bytes, stopping where a load
+/// would read beyond the src_n bytes of src.
+/// @return The number of pixels converted.
+__attribute__((target("ssse3")))
+static offset_t convert_ssse3(const unsigned char *src, offset_t src_n, uint32_t *dst, int step, int px,
+                              const unsigned char *mask) {
+    const __m128i m = _mm_loadu_si128((const __m128i *) mask);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+
+    offset_t i = 0, s = 0;
+    for (; s + 16 <= src_n; s += step, i += px) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + s)), m);
+        v = _mm_or_si128(v, alpha);
+        if (px == 4) _mm_storeu_si128((__m128i *) (dst + i), v);
+        else _mm_storel_epi64((__m128i *) (dst + i), v);
+    }
+    return i;
+}
+
+/// convert_avx2 converts two loads of px pixels each per step, one per 128 bit lane.
+/// @return The number of pixels converted.
+__attribute__((target("avx2")))
+static offset_t convert_avx2(const unsigned char *src, offset_t src_n, uint32_t *dst, int step, int px,
+                             const unsigned char *mask) {
+    const __m128i m128 = _mm_loadu_si128((const __m128i *) mask);
+    const __m256i m = _mm256_inserti128_si256(_mm256_castsi128_si256(m128), m128, 1);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+
+    offset_t i = 0, s = 0;
+    for (; s + step + 16 <= src_n; s += 2 * step, i += 2 * px) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + s));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + s + step));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, m), alpha);
+        if (px == 4) {
+            _mm256_storeu_si256((__m256i *) (dst + i), v);
+        } else {
+            // The pixels are in the low 8 bytes of each lane
+            v = _mm256_permute4x64_epi64(v, 0x08);
+            _mm_storeu_si128((__m128i *) (dst + i), _mm256_castsi256_si128(v));
+        }
+    }
+    return i;
+}
+
+/// yuv_sse4 converts 4 pixels per step as yuv_scalar, in 32 bit lanes.
+/// @return The number of pixels converted.
+__attribute__((target("sse4.1")))
+static offset_t yuv_sse4(const unsigned char *y, const unsigned char *u, const unsigned char *v, offset_t n,
+                         uint32_t *dst) {
+    const __m128i k16 = _mm_set1_epi32(16), k128 = _mm_set1_epi32(128), k255 = _mm_set1_epi32(255);
+    const __m128i zero = _mm_setzero_si128(), alpha = _mm_set1_epi32(int(0xff000000));
+
+    offset_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32_t y4;
+        uint16_t u2, v2;
+        memcpy(&y4, y + i, 4);
+        memcpy(&u2, u + i / 2, 2);
+        memcpy(&v2, v + i / 2, 2);
+        __m128i uu = _mm_cvtsi32_si128(u2), vv = _mm_cvtsi32_si128(v2);
+
+        __m128i yy = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(y4));
+        __m128i d = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_unpacklo_epi8(uu, uu)), k128);
+        __m128i e = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_unpacklo_epi8(vv, vv)), k128);
+        __m128i c = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(yy, k16), _mm_set1_epi32(298)), k128);
+
+        __m128i r = _mm_srai_epi32(_mm_add_epi32(c, _mm_mullo_epi32(e, _mm_set1_epi32(409))), 8);
+        __m128i g = _mm_srai_epi32(_mm_sub_epi32(c, _mm_add_epi32(_mm_mullo_epi32(d, _mm_set1_epi32(100)),
+                                                                  _mm_mullo_epi32(e, _mm_set1_epi32(208)))), 8);
+        __m128i b = _mm_srai_epi32(_mm_add_epi32(c, _mm_mullo_epi32(d, _mm_set1_epi32(516))), 8);
+        r = _mm_min_epi32(_mm_max_epi32(r, zero), k255);
+        g = _mm_min_epi32(_mm_max_epi32(g, zero), k255);
+        b = _mm_min_epi32(_mm_max_epi32(b, zero), k255);
+
+        __m128i px = _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(r, 16)), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+        _mm_storeu_si128((__m128i *) (dst + i), px);
+    }
+    return i;
+}
+
+/// yuv_avx2 converts 8 pixels per step as yuv_scalar.
+/// @return The number of pixels converted.
+__attribute__((target("avx2")))
+static offset_t yuv_avx2(const unsigned char *y, const unsigned char *u, const unsigned char *v, offset_t n,
+                         uint32_t *dst) {
+    const __m256i k16 = _mm256_set1_epi32(16), k128 = _mm256_set1_epi32(128), k255 = _mm256_set1_epi32(255);
+    const __m256i zero = _mm256_setzero_si256(), alpha = _mm256_set1_epi32(int(0xff000000));
+
+    offset_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int32_t u4, v4;
+        memcpy(&u4, u + i / 2, 4);
+        memcpy(&v4, v + i / 2, 4);
+        __m128i uu = _mm_cvtsi32_si128(u4), vv = _mm_cvtsi32_si128(v4);
+
+        __m256i yy = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (y + i)));
+        __m256i d = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_unpacklo_epi8(uu, uu)), k128);
+        __m256i e = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_unpacklo_epi8(vv, vv)), k128);
+        __m256i c = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(yy, k16), _mm256_set1_epi32(298)), k128);
+
+        __m256i r = _mm256_srai_epi32(_mm256_add_epi32(c, _mm256_mullo_epi32(e, _mm256_set1_epi32(409))), 8);
+        __m256i g = _mm256_srai_epi32(
+                _mm256_sub_epi32(c, _mm256_add_epi32(_mm256_mullo_epi32(d, _mm256_set1_epi32(100)),
+                                                     _mm256_mullo_epi32(e, _mm256_set1_epi32(208)))), 8);
+        __m256i b = _mm256_srai_epi32(_mm256_add_epi32(c, _mm256_mullo_epi32(d, _mm256_set1_epi32(516))), 8);
+        r = _mm256_min_epi32(_mm256_max_epi32(r, zero), k255);
+        g = _mm256_min_epi32(_mm256_max_epi32(g, zero), k255);
+        b = _mm256_min_epi32(_mm256_max_epi32(b, zero), k255);
+
+        __m256i px = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_slli_epi32(r, 16)),
+                                     _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+        _mm256_storeu_si256((__m256i *) (dst + i), px);
+    }
+    return i;
+}
+#endif
+
+typedef offset_t (*yuv_fn_t)(const unsigned char *y, const unsigned char *u, const unsigned char *v, offset_t n,
+                             uint32_t *dst);
+
+/// select_yuv picks the YUV conversion for the instruction sets of the CPU running the program, null if there is
+/// none.
+static yuv_fn_t select_yuv() {
+#ifdef PIXEL_FORMAT_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return yuv_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return yuv_sse4;
+#endif
+    return nullptr;
+}
+
+/// convert_yuv converts n pixels of Y every y_step bytes from y, and of U and V, shared by pairs of pixels, every
+/// uv_step bytes from u and v. Interleaved samples are gathered into planes a part of the row at a time.
+static void convert_yuv(const unsigned char *y, int y_step, const unsigned char *u, const unsigned char *v,
+                        int uv_step, offset_t n, uint32_t *dst) {
+    static const yuv_fn_t kernel = select_yuv();
+    const int part = 1024;
+    unsigned char yb[part], ub[part / 2], vb[part / 2];
+
+    for (offset_t s = 0; s < n; s += part) {
+        offset_t m = std::min(offset_t(part), n - s);
+        const unsigned char *py = y + s * y_step, *pu = u + s / 2 * uv_step, *pv = v + s / 2 * uv_step;
+        if (y_step != 1) {
+            for (offset_t i = 0; i < m; i++) yb[i] = py[i * y_step];
+            py = yb;
+        }
+        if (uv_step != 1) {
+            for (offset_t i = 0; i < (m + 1) / 2; i++) {
+                ub[i] = pu[i * uv_step];
+                vb[i] = pv[i * uv_step];
+            }
+            pu = ub;
+            pv = vb;
+        }
+
+        offset_t i = kernel ? kernel(py, pu, pv, m, dst + s) : 0;
+        // The scalar tail starts at an even pixel, at the start of its pair
+        yuv_scalar(py + i, pu + i / 2, pv + i / 2, m - i, dst + s + i);
+    }
+}
+
+typedef offset_t (*shuffle_fn_t)(const unsigned char *src, offset_t src_n, uint32_t *dst, int step, int px,
+                                 const unsigned char *mask);
+
+/// select_shuffle picks the shuffle for the instruction sets of the CPU running the program, null if there is none.
+static shuffle_fn_t select_shuffle() {
+#ifdef PIXEL_FORMAT_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return convert_avx2;
+    if (__builtin_cpu_supports("ssse3")) return convert_ssse3;
+#endif
+    return nullptr;
+}
+
+/// convert_pixels converts n pixels of format f to 0xffrrggbb. Formats of whole byte colors, and the top bytes of
+/// MIPI packed samples, are shuffled 4 or 8 pixels at a time where the CPU allows, the rest one pixel at a time. YUV
+/// is converted 4 or 8 pixels at a time. Bayer mosaics are converted as grey, and planar formats as the grey of Y.
+/// @param [in] f The format of src.
+/// @param [in] src The pixels, pixel_format_row_bytes(f, n) bytes.
+/// @param [in] n The number of pixels.
+/// @param [out] dst The converted pixels, n of them.
+void convert_pixels(const pixel_format_t &f, const unsigned char *src, offset_t n, uint32_t *dst) {
+    static const shuffle_fn_t shuffle = select_shuffle();
+
+    if (f.packing == packing_yuyv) {
+        convert_yuv(src, 2, src + 1, src + 3, 4, n, dst);
+        return;
+    }
+    if (f.packing == packing_uyvy) {
+        convert_yuv(src + 1, 2, src, src + 2, 4, n, dst);
+        return;
+    }
+    if (pixel_format_planar(f)) {
+        static const int grey = find_pixel_format("Grey 8");
+        convert_pixels(pixel_formats()[grey], src, n, dst);
+        return;
+    }
+
+    int gpx, gbytes;
+    packing_group(f, gpx, gbytes);
+
+    offset_t i = 0;
+    unsigned char mask[16];
+    int step = 0;
+    int px = shuffle_mask(f, mask, step);
+    if (shuffle && px > 0) i = shuffle(src, n / px * step, dst, step, px, mask);
+
+    // i is a whole number of groups
+    convert_fn_t fn = generic_kernel(f);
+    if (fn) fn(f, src + i / gpx * gbytes, n - i, dst + i);
+}
+
+/// convert_row converts a row of an image of format f to 0xffrrggbb, as many pixels of it as dat holds.
+/// @param [in] f The format of dat.
+/// @param [in] dat The image.
+/// @param [in] n Length of dat in bytes.
+/// @param [in] w Width of the image in pixels.
+/// @param [in] frame_h Rows of a frame of planar formats, see pixel_format_frame_rows().
+/// @param [in] row The row converted.
+/// @param [out] dst The converted pixels, at most w of them.
+/// @return The number of pixels converted, those of planar formats only of complete frames.
+int convert_row(const pixel_format_t &f, const unsigned char *dat, offset_t n, int w, int frame_h, offset_t row,
+                uint32_t *dst) {
+    if (w <= 0 || row < 0) return 0;
+
+    if (pixel_format_planar(f)) {
+        if (frame_h <= 0) return 0;
+        offset_t fb = pixel_format_frame_bytes(f, w, frame_h);
+        offset_t base = row / frame_h * fb;
+        if (base + fb > n) return 0;
+
+        offset_t y = row % frame_h, cw = (w + 1) / 2, ch = (frame_h + 1) / 2;
+        const unsigned char *py = dat + base + y * w, *chroma = dat + base + offset_t(w) * frame_h;
+        if (f.packing == packing_i420) {
+            convert_yuv(py, 1, chroma + y / 2 * cw, chroma + cw * ch + y / 2 * cw, 1, w, dst);
+        } else {
+            const unsigned char *uv = chroma + y / 2 * cw * 2;
+            bool nv21 = f.packing == packing_nv21;
+            convert_yuv(py, 1, uv + (nv21 ? 1 : 0), uv + (nv21 ? 0 : 1), 2, w, dst);
+        }
+        return w;
+    }
+
+    int px, bytes;
+    packing_group(f, px, bytes);
+    offset_t s = row * pixel_format_row_bytes(f, w);
+    if (bytes <= 0 || s >= n) return 0;
+
+    int m = int(std::min(offset_t(w), (n - s) / bytes * px));
+    convert_pixels(f, dat + s, m, dst);
+    return m;
+}
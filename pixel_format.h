@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PIXEL_FORMAT_H_
+#define _PIXEL_FORMAT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "offset.h"
+
+/// pixel_packing_t is how the samples of the pixels of a format are stored, other than as whole samples.
+typedef enum {
+    packing_none,  // Whole samples of sample_size bytes
+    packing_mipi,  // MIPI CSI-2 RAW10, RAW12 and RAW14, the top 8 bits of each of 4, 2 or 4 pixels, then their low bits
+    packing_yuyv,  // YUV 4:2:2, Y0 U Y1 V per two pixels
+    packing_uyvy,  // YUV 4:2:2, U Y0 V Y1 per two pixels
+    packing_nv12,  // YUV 4:2:0, frames of a plane of Y and a plane of U V pairs at half width and height
+    packing_nv21,  // YUV 4:2:0, as NV12 with V U pairs
+    packing_i420   // YUV 4:2:0, frames of planes of Y, U and V, the last two at half width and height
+} pixel_packing_t;
+
+/// pixel_format_t describes how the pixels of an image are laid out in memory. Samples beyond those of the colors,
+/// such as alpha, are skipped.
+typedef struct {
+    const char *name;
+    int channels;    // Samples per pixel
+    int r, g, b;     // Sample holding each color, all the same for grey
+    int sample_size; // Bytes per sample, 1 or 2
+    int bits;        // Significant bits of a sample, of which the top 8 are shown
+    bool big_endian;
+    int bayer_perm;  // Order of the colors of a Bayer mosaic, see bayerBG(), -1 for any other format
+    pixel_packing_t packing;
+} pixel_format_t;
+
+const std::vector<pixel_format_t> &pixel_formats();
+
+int find_pixel_format(const std::string &name);
+
+int pixel_format_size(const pixel_format_t &f);
+
+offset_t pixel_format_row_bytes(const pixel_format_t &f, int w);
+
+int pixel_format_width(const pixel_format_t &f, offset_t row_bytes);
+
+bool pixel_format_planar(const pixel_format_t &f);
+
+int pixel_format_frame_rows(const pixel_format_t &f, int w, int frame_h, offset_t n);
+
+offset_t pixel_format_frame_bytes(const pixel_format_t &f, int w, int frame_h);
+
+void convert_pixels(const pixel_format_t &f, const unsigned char *src, offset_t n, uint32_t *dst);
+
+int convert_row(const pixel_format_t &f, const unsigned char *dat, offset_t n, int w, int frame_h, offset_t row,
+                uint32_t *dst);
+
+#endif
@@ -21,13 +21,16 @@
 #include <QtGui>
 
 #include "plot_view.h"
+#include "paint_image.h"
+#include "entropy_pyramid.h"
 
 using std::min;
 using std::max;
 
 PlotView::PlotView(QWidget *p)
         : QLabel(p),
-          m1_(0.), m2_(1.), px_(-1), py_(-1), ind_(0), s_(none), allow_selection_(true) {
+          m1_(0.), m2_(1.), px_(-1), py_(-1), ind_(0), s_(none), allow_selection_(true),
+          pyramid_ind_(0), pyramid_s_(0), pyramid_e_(0) {
 }
 
 void PlotView::enableSelection(bool v) {
@@ -38,26 +41,60 @@ void PlotView::enableSelection(bool v) {
 void PlotView::setImage(int ind, QImage &img) {
     img_[ind] = img;
 
-    update_pix();
-
     update();
 }
 
-void PlotView::set_data(const float *dat, long len, bool normalize) {
+void PlotView::set_data(const float *dat, offset_t len, bool normalize) {
     ind_ = 0;
     set_data(0, dat, len, normalize);
 }
 
-void PlotView::set_data(int ind, const float *dat, long len, bool normalize) {
-    int w = width();
-    int h = height();
+void PlotView::set_data(int ind, const float *dat, offset_t len, bool normalize) {
+    if (pyramid_ && pyramid_ind_ == ind) pyramid_.reset();
+
+    QImage img = render(dat, len, device_width(this), device_height(this), normalize);
+    setImage(ind, img);
+}
+
+/// set_data plots the entropy of [s, e) from pyramid, which is consulted again whenever the plot is resized.
+/// @param [in] ind The plot to set.
+/// @param [in] pyramid Entropy of the file.
+/// @param [in] s Start of the plotted range.
+/// @param [in] e End of the plotted range.
+void PlotView::set_data(int ind, const std::shared_ptr<const EntropyPyramid> &pyramid, offset_t s, offset_t e) {
+    pyramid_ = pyramid;
+    pyramid_ind_ = ind;
+    pyramid_s_ = s;
+    pyramid_e_ = e;
+
+    render_pyramid();
+}
+
+/// render_pyramid plots the pyramid range at the level matching the current height.
+void PlotView::render_pyramid() {
+    offset_t dd_n;
+    int w = device_width(this), h = device_height(this);
+    std::unique_ptr<float[]> dd(pyramid_->entropy(pyramid_s_, pyramid_e_, h, dd_n));
+    if (!dd) return;
 
+    QImage img = render(dd.get(), dd_n, w, h);
+    setImage(pyramid_ind_, img);
+}
+
+/// render draws dat as a trace running from top to bottom, averaging the values that fall onto the same row.
+/// @param [in] dat Values to be plotted.
+/// @param [in] len Length of dat.
+/// @param [in] w Width of the image.
+/// @param [in] h Height of the image.
+/// @param [in] normalize Whether to scale dat to its range (true) or treat it as lying within [0., 1.] (false).
+/// @return The plot.
+QImage PlotView::render(const float *dat, offset_t len, int w, int h, bool normalize) {
     float mn = 0.;
     float mx = 1.;
     if (normalize) {
         mn = 99999999.;
         mx = -99999999.;
-        for (int i = 0; i < len; i++) {
+        for (offset_t i = 0; i < len; i++) {
             mn = min(mn, dat[i]);
             mx = max(mx, dat[i]);
         }
@@ -67,54 +104,54 @@ void PlotView::set_data(int ind, const float *dat, long len, bool normalize) {
         }
     }
 
-    {
-        QImage img(w, h, QImage::Format_RGB32);
-        img.fill(0);
-
-        auto acc = new float[h];
-        memset(acc, 0, h * sizeof(float));
-        auto cnt = new int[h];
-        memset(cnt, 0, h * sizeof(int));
-
-        for (int i = 0; i < len; i++) {
-            float v = dat[i];
-            int ind2 = int((i / float(len)) * (h - 1) + .5);
-            acc[ind2] += (v - mn) / (mx - mn);
-            cnt[ind2]++;
-        }
+    QImage img(w, h, QImage::Format_RGB32);
+    img.fill(0);
 
-        auto p = (unsigned int *) img.bits();
-        int px = -1;
-        int pc = -1;
-        for (int i = 0; i < h; i++) {
-            int x = px;
-            int c = pc;
-            if (cnt[i] == 0 && px == -1) continue;
-            if (cnt[i] > 0) {
-                float na = acc[i] / cnt[i];
-                x = int(na * (w - 4) + .5) + 2; // slight offset so not to interfere with border
-                px = x;
-                c = 20 + int(na * (255 - 20));
-                pc = c;
-            }
-            unsigned char r = 20;
-            unsigned char g = min(c + 60, 255);
-            unsigned char b = 20;
-            unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
-            p[i * w + x] = v;
-        }
+    auto acc = new float[h];
+    memset(acc, 0, h * sizeof(float));
+    auto cnt = new int[h];
+    memset(cnt, 0, h * sizeof(int));
 
-        delete[] acc;
-        delete[] cnt;
+    for (offset_t i = 0; i < len; i++) {
+        float v = dat[i];
+        int ind2 = int((i / double(len)) * (h - 1) + .5);
+        acc[ind2] += (v - mn) / (mx - mn);
+        cnt[ind2]++;
+    }
 
-        setImage(ind, img);
+    auto p = (unsigned int *) img.bits();
+    int px = -1;
+    int pc = -1;
+    for (int i = 0; i < h; i++) {
+        int x = px;
+        int c = pc;
+        if (cnt[i] == 0 && px == -1) continue;
+        if (cnt[i] > 0) {
+            float na = acc[i] / cnt[i];
+            x = int(na * (w - 4) + .5) + 2; // slight offset so not to interfere with border
+            px = x;
+            c = 20 + int(na * (255 - 20));
+            pc = c;
+        }
+        unsigned char r = 20;
+        unsigned char g = min(c + 60, 255);
+        unsigned char b = 20;
+        unsigned int v = 0xff000000 | (r << 16) | (g << 8) | (b << 0);
+        p[i * w + x] = v;
     }
+
+    delete[] acc;
+    delete[] cnt;
+
+    return img;
 }
 
 void PlotView::paintEvent(QPaintEvent *e) {
     QLabel::paintEvent(e);
 
     QPainter p(this);
+    paint_image(p, this, img_[ind_]);
+
     if (allow_selection_) {
         int ry1 = m1_ * height();
         int ry2 = m2_ * height();
@@ -136,16 +173,8 @@ void PlotView::paintEvent(QPaintEvent *e) {
 void PlotView::resizeEvent(QResizeEvent *e) {
     QLabel::resizeEvent(e);
 
-    update_pix();
-}
-
-void PlotView::update_pix() {
-    if (img_[ind_].isNull()) return;
-
-    int vw = width() - 4;
-    int vh = height() - 4; // TODO BUG: With QDarkStyle, without the subtraction, the height or width of the application grows without bounds.
-    pix_ = QPixmap::fromImage(img_[ind_]).scaled(vw, vh); //, Qt::KeepAspectRatio);
-    setPixmap(pix_);
+    // Other plots are stretched when painted, the pyramid is drawn again with as many rows as are on screen.
+    if (pyramid_) render_pyramid();
 }
 
 void PlotView::mousePressEvent(QMouseEvent *e) {
@@ -227,7 +256,6 @@ void PlotView::mouseReleaseEvent(QMouseEvent *e) {
 
     if (e->button() == Qt::RightButton) {
         ind_ = (ind_ + 1) % 2;
-        update_pix();
         update();
     }
 
@@ -20,9 +20,14 @@
 #ifndef _PLOT_VIEW_H_
 #define _PLOT_VIEW_H_
 
+#include <memory>
+
 #include <QLabel>
 #include <QImage>
-#include <QPixmap>
+
+#include "offset.h"
+
+class EntropyPyramid;
 
 class PlotView : public QLabel {
 Q_OBJECT
@@ -31,13 +36,17 @@ public:
 
     ~PlotView() override = default;
 
+    static QImage render(const float *dat, offset_t len, int w, int h, bool normalize = true);
+
 public slots:
 
     void setImage(int ind, QImage &img);
 
-    void set_data(const float *bin, long len, bool normalize = true);
+    void set_data(const float *bin, offset_t len, bool normalize = true);
+
+    void set_data(int ind, const float *bin, offset_t len, bool normalize = true);
 
-    void set_data(int ind, const float *bin, long len, bool normalize = true);
+    void set_data(int ind, const std::shared_ptr<const EntropyPyramid> &pyramid, offset_t s, offset_t e);
 
     void enableSelection(bool);
 
@@ -45,7 +54,6 @@ protected slots:
 
 protected:
     QImage img_[2];
-    QPixmap pix_;
 
     void paintEvent(QPaintEvent *) override;
 
@@ -57,7 +65,7 @@ protected:
 
     void mouseReleaseEvent(QMouseEvent *event) override;
 
-    void update_pix();
+    void render_pyramid();
 
     float m1_, m2_;
     int px_, py_;
@@ -67,6 +75,12 @@ protected:
     } s_;
     bool allow_selection_;
 
+    // The plot of ind pyramid_ind_ is drawn from [pyramid_s_, pyramid_e_) of pyramid_ at whatever height is on screen.
+    std::shared_ptr<const EntropyPyramid> pyramid_;
+    int pyramid_ind_;
+    offset_t pyramid_s_;
+    offset_t pyramid_e_;
+
 signals:
 
     void rangeSelected(float, float);
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QFileInfo>
+
+#include "prefetcher.h"
+#include "overall_view.h"
+#include "worker.h"
+
+
+bool operator==(const prefetch_config_t &a, const prefetch_config_t &b) {
+    return a.overview_w == b.overview_w && a.overview_h == b.overview_h &&
+           a.use_byte_classes == b.use_byte_classes &&
+           a.tuple_dims == b.tuple_dims && a.tuple_dtype == b.tuple_dtype && a.tuple_overlap == b.tuple_overlap;
+}
+
+Prefetcher::Prefetcher(QObject *p)
+        : QObject(p), budget_(size_t(256) << 20), pending_config_() {
+    worker_ = new Worker(this);
+}
+
+/// set_budget limits the memory held by prefetched files, both their analyses and the pages left resident.
+/// @param [in] bytes The budget in bytes.
+void Prefetcher::set_budget(size_t bytes) {
+    budget_ = bytes;
+}
+
+/// prefetch analyzes filenames in the background, in order of priority, as far as the budget allows. Results for
+/// files that are not listed any more are dropped, as is work for an earlier list that has not finished yet.
+/// @param [in] filenames The files expected to be opened next, the most likely first.
+/// @param [in] config The analyses to run.
+void Prefetcher::prefetch(const QStringList &filenames, const prefetch_config_t &config) {
+    for (auto it = cache_.begin(); it != cache_.end();) {
+        if (!filenames.contains(it->first) || !(it->second->config == config)) {
+            it = cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (filenames == pending_ && config == pending_config_) return;
+    pending_ = filenames;
+    pending_config_ = config;
+
+    int gen = worker_->restart();
+
+    size_t used = 0;
+    for (const auto &j : cache_) {
+        used += j.second->cost;
+    }
+
+    Worker *worker = worker_;
+    for (const auto &filename : filenames) {
+        if (cache_.count(filename) > 0) continue;
+
+        // Nearer files come first, stop at the first one that does not fit rather than skipping ahead.
+        size_t cost = estimate_cost(QFileInfo(filename).size(), config);
+        if (used + cost > budget_) break;
+        used += cost;
+
+        std::string fn = filename.toStdString();
+        worker_->post(gen, [this, worker, gen, filename, fn, config] {
+            std::shared_ptr<const prefetched_t> rv = analyze(fn, config, [worker, gen] { return worker->cancelled(gen); });
+            if (!rv) return;
+            worker->deliver(gen, [this, filename, rv] {
+                cache_[filename] = rv;
+            });
+        });
+    }
+}
+
+/// cancel stops prefetching, for instance to leave the machine to the analysis of the file being shown.
+void Prefetcher::cancel() {
+    worker_->cancel();
+    pending_.clear();
+}
+
+/// join waits for the file being analyzed when cancel() was called to be let go of.
+void Prefetcher::join() {
+    worker_->join();
+}
+
+/// take hands over the prefetched results for filename.
+/// @param [in] filename The file about to be opened.
+/// @return The results, null if filename was not prefetched or has changed since.
+std::shared_ptr<const prefetched_t> Prefetcher::take(const QString &filename) {
+    auto it = cache_.find(filename);
+    if (it == cache_.end()) return nullptr;
+
+    auto rv = it->second;
+    cache_.erase(it);
+
+    if (QFileInfo(filename).size() != offset_t(rv->src->size())) return nullptr;
+
+    return rv;
+}
+
+/// estimate_cost estimates the memory held by the results of prefetching a file of len bytes.
+size_t Prefetcher::estimate_cost(offset_t len, const prefetch_config_t &config) {
+    // for_each_window() releases the pages of files spanning more than one window, smaller files stay resident.
+    size_t cost = len <= analysis_window ? len : 0;
+
+    cost += size_t(config.overview_w) * config.overview_h * 4 * sizeof(offset_t);
+    cost += len / entropy_stride(len) * sizeof(float);
+    if (config.tuple_dims == 2) cost += 256 * 256 * sizeof(offset_t);
+    if (config.tuple_dims == 3) cost += 256 * 256 * 256 * sizeof(offset_t);
+
+    return cost;
+}
+
+/// analyze maps filename and runs the analyses of config over its entire length, run on a background thread.
+/// @param [in] filename The file to analyze.
+/// @param [in] config The analyses to run.
+/// @param [in] cancelled Polled between windows of the file, analysis stops early when it returns true.
+/// @return The results, null if the file could not be opened, is empty or analysis was cancelled.
+std::shared_ptr<prefetched_t> Prefetcher::analyze(const std::string &filename, const prefetch_config_t &config,
+                                                  const std::function<bool()> &cancelled) {
+    auto src = std::make_shared<FileSource>();
+    if (!src->open(filename) || src->size() == 0) return nullptr;
+
+    const unsigned char *dat = src->data();
+    offset_t len = src->size();
+
+    auto overview = std::make_shared<OverviewAccumulator>(config.overview_w, config.overview_h, len,
+                                                          config.use_byte_classes);
+    auto entropy = std::make_shared<EntropyAccumulator>(entropy_block_size(len), entropy_stride(len));
+    auto histo = std::make_shared<HistoAccumulator>();
+    std::shared_ptr<TupleHistoAccumulator> tuple_histo;
+    if (config.tuple_dims != 0) {
+        tuple_histo = std::make_shared<TupleHistoAccumulator>(config.tuple_dims, config.tuple_dtype, config.tuple_overlap);
+    }
+
+    // A single pass feeds every accumulator while the window is still in cache.
+    if (!for_each_window(dat, len, [&](const unsigned char *p, offset_t m) {
+        overview->add(p, m);
+        entropy->add(p, m);
+        histo->add(p, m);
+        if (tuple_histo) tuple_histo->add(p, m);
+        return !cancelled();
+    })) return nullptr;
+
+    auto rv = std::make_shared<prefetched_t>();
+    rv->config = config;
+    rv->src = src;
+    rv->overview = overview;
+    rv->entropy = entropy;
+    rv->histo = histo;
+    rv->tuple_histo = tuple_histo;
+    rv->cost = estimate_cost(len, config);
+    // Estimated at the size of a dense trigram array, what is actually held is usually far less.
+    if (config.tuple_dims == 3 && tuple_histo) {
+        rv->cost = rv->cost - 256 * 256 * 256 * sizeof(offset_t) + tuple_histo->memory();
+    }
+
+    return rv;
+}
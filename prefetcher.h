@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PREFETCHER_H_
+#define _PREFETCHER_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include "file_source.h"
+#include "histogram_calc.h"
+#include "offset.h"
+
+class OverviewAccumulator;
+
+class Worker;
+
+// The analyses to run ahead of time, matching the settings of the views that are going to show them.
+typedef struct {
+    int overview_w, overview_h;
+    bool use_byte_classes;
+    int tuple_dims; // 2 or 3 to also count digrams or trigrams, 0 to skip them
+    histo_dtype_t tuple_dtype;
+    bool tuple_overlap;
+} prefetch_config_t;
+
+bool operator==(const prefetch_config_t &a, const prefetch_config_t &b);
+
+// A mapped file together with the analyses of its entire length.
+typedef struct {
+    prefetch_config_t config;
+    std::shared_ptr<FileSource> src;
+    std::shared_ptr<const OverviewAccumulator> overview;
+    std::shared_ptr<const EntropyAccumulator> entropy;
+    std::shared_ptr<const HistoAccumulator> histo;
+    std::shared_ptr<const TupleHistoAccumulator> tuple_histo;
+    size_t cost;
+} prefetched_t;
+
+/// Prefetcher maps files and analyzes them on a background thread before they are asked for, keeping the memory held
+/// by the results within a budget.
+class Prefetcher : public QObject {
+Q_OBJECT
+public:
+    explicit Prefetcher(QObject *p = nullptr);
+
+    ~Prefetcher() override = default;
+
+    void set_budget(size_t bytes);
+
+    void prefetch(const QStringList &filenames, const prefetch_config_t &config);
+
+    void cancel();
+
+    void join();
+
+    std::shared_ptr<const prefetched_t> take(const QString &filename);
+
+protected:
+    static size_t estimate_cost(offset_t len, const prefetch_config_t &config);
+
+    static std::shared_ptr<prefetched_t> analyze(const std::string &filename, const prefetch_config_t &config,
+                                                 const std::function<bool()> &cancelled);
+
+    size_t budget_;
+    QStringList pending_;
+    prefetch_config_t pending_config_;
+    std::map<QString, std::shared_ptr<const prefetched_t>> cache_;
+
+    Worker *worker_;
+};
+
+#endif
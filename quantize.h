@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _QUANTIZE_H_
+#define _QUANTIZE_H_
+
+#include <cstdint>
+#include <cstring>
+
+typedef enum {
+    unsigned_kind, signed_kind, float_kind
+} quantizer_kind_t;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static const bool host_big_endian = true;
+#else
+static const bool host_big_endian = false;
+#endif
+
+inline uint8_t byte_swap(uint8_t v) { return v; }
+
+inline uint16_t byte_swap(uint16_t v) { return __builtin_bswap16(v); }
+
+inline uint32_t byte_swap(uint32_t v) { return __builtin_bswap32(v); }
+
+inline uint64_t byte_swap(uint64_t v) { return __builtin_bswap64(v); }
+
+/// Quantizer maps elements stored as U, holding a value of the given kind in the low bits bits, to 0 - 255 in the
+/// order of their values. Signed values are offset by half their range, and floats are mapped through their bit
+/// patterns, so that each step is a fixed fraction of the exponent range: -inf and negative NaNs map to 0, +inf and
+/// positive NaNs to 255. Everything is decided at compile time, the inner loop is a load, an optional byte swap, an
+/// exclusive or and a shift.
+template<class U, quantizer_kind_t kind, bool big_endian, int bits = 8 * sizeof(U)>
+struct Quantizer {
+    static const int size = sizeof(U);
+
+    static inline int q(const unsigned char *p) {
+        U v;
+        memcpy(&v, p, sizeof(U));
+        if (big_endian != host_big_endian) v = byte_swap(v);
+        if (bits < 8 * int(sizeof(U))) v &= U((uint64_t(1) << bits) - 1);
+
+        const U sign = U(uint64_t(1) << (bits - 1));
+        if (kind == signed_kind) v ^= sign;
+        if (kind == float_kind) v = (v & sign) ? U(~v) : U(v | sign);
+
+        return int(v >> (bits - 8)) & 0xff;
+    }
+};
+
+#endif
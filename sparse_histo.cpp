@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sparse_histo.h"
+
+static const int initial_bits = 10;
+
+/// SparseHisto constructor.
+/// @param [in] n_keys Size of the key space, keys range from 0 to n_keys - 1.
+SparseHisto::SparseHisto(uint32_t n_keys)
+        : n_keys_(n_keys), bits_(initial_bits), used_(0) {
+    slots_.assign(size_t(1) << bits_, slot_t{empty_key, 0});
+}
+
+/// grow doubles the hash table, or switches to the dense array once the table has reached a quarter of its size. Keys
+/// whose counts went back to zero, as when a range slides along the file, are dropped, and a table that is mostly made
+/// up of them is only rehashed.
+void SparseHisto::grow() {
+    std::vector<slot_t> slots;
+    slots.swap(slots_);
+
+    size_t live = 0;
+    for (const auto &s : slots) {
+        if (s.key != empty_key && s.cnt != 0) live++;
+    }
+    int bits = live * 4 <= slots.size() ? bits_ : bits_ + 1;
+
+    if (bits > bits_ && (slots.size() * 2) * sizeof(slot_t) > size_t(n_keys_) * sizeof(offset_t) / 4) {
+        dense_.assign(n_keys_, 0);
+        for (const auto &s : slots) {
+            if (s.key != empty_key) dense_[s.key] += s.cnt;
+        }
+        return;
+    }
+
+    bits_ = bits;
+    used_ = 0;
+    slots_.assign(size_t(1) << bits_, slot_t{empty_key, 0});
+    for (const auto &s : slots) {
+        if (s.key != empty_key && s.cnt != 0) add(s.key, s.cnt);
+    }
+}
+
+/// count returns the count of key.
+offset_t SparseHisto::count(uint32_t key) const {
+    if (!dense_.empty()) return dense_[key];
+
+    uint32_t mask = uint32_t(slots_.size() - 1);
+    for (uint32_t i = slot(key);; i = (i + 1) & mask) {
+        const slot_t &s = slots_[i];
+        if (s.key == key) return s.cnt;
+        if (s.key == empty_key) return 0;
+    }
+}
+
+/// merge adds the counts of o, which counts the same key space, or the part of it starting at base.
+/// @param [in] o The counts to add.
+/// @param [in] base The key of this histogram that key 0 of o stands for.
+void SparseHisto::merge(const SparseHisto &o, uint32_t base) {
+    o.for_each([this, base](uint32_t key, offset_t cnt) {
+        add(base + key, cnt);
+    });
+}
+
+/// memory returns the number of bytes held by the counts.
+size_t SparseHisto::memory() const {
+    return slots_.size() * sizeof(slot_t) + dense_.size() * sizeof(offset_t);
+}
+
+/// is_dense returns whether the counts are held in the dense array.
+bool SparseHisto::is_dense() const {
+    return !dense_.empty();
+}
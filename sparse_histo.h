@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SPARSE_HISTO_H_
+#define _SPARSE_HISTO_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "offset.h"
+
+/// SparseHisto counts keys from a large key space, such as the 2^24 trigrams, in an open addressing hash table whose
+/// size follows the number of distinct keys seen. Once the table would grow to a quarter of the size of a dense array
+/// of counts, it switches to the dense array. Once dense, several threads may add to it at once, if no two add the same
+/// key.
+class SparseHisto {
+public:
+    explicit SparseHisto(uint32_t n_keys);
+
+    void add(uint32_t key, offset_t inc = 1);
+
+    offset_t count(uint32_t key) const;
+
+    void merge(const SparseHisto &o, uint32_t base = 0);
+
+    size_t memory() const;
+
+    bool is_dense() const;
+
+    /// for_each calls fn(key, count) for every key with a non-zero count, in no particular order.
+    template<class F>
+    void for_each(F fn) const {
+        if (!dense_.empty()) {
+            for (uint32_t k = 0; k < n_keys_; k++) {
+                if (dense_[k] != 0) fn(k, dense_[k]);
+            }
+        } else {
+            for (const auto &s : slots_) {
+                if (s.key != empty_key && s.cnt != 0) fn(s.key, s.cnt);
+            }
+        }
+    }
+
+protected:
+    typedef struct {
+        uint32_t key;
+        offset_t cnt;
+    } slot_t;
+
+    static const uint32_t empty_key = 0xffffffff;
+
+    uint32_t slot(uint32_t key) const;
+
+    void grow();
+
+    uint32_t n_keys_;
+    int bits_;
+    size_t used_;
+    std::vector<slot_t> slots_;
+    std::vector<offset_t> dense_;
+};
+
+/// slot returns where the search for key starts, from the high bits of a multiplicative hash.
+inline uint32_t SparseHisto::slot(uint32_t key) const {
+    return uint32_t(key * 0x9e3779b1u) >> (32 - bits_);
+}
+
+/// add adds inc to the count of key.
+inline void SparseHisto::add(uint32_t key, offset_t inc) {
+    if (!dense_.empty()) {
+        dense_[key] += inc;
+        return;
+    }
+
+    uint32_t mask = uint32_t(slots_.size() - 1);
+    for (uint32_t i = slot(key);; i = (i + 1) & mask) {
+        slot_t &s = slots_[i];
+        if (s.key == key) {
+            s.cnt += inc;
+            return;
+        }
+        if (s.key == empty_key) {
+            s.key = key;
+            s.cnt = inc;
+            break;
+        }
+    }
+
+    // Kept at most half full, so probe sequences stay short.
+    if (++used_ * 2 > slots_.size()) grow();
+}
+
+#endif
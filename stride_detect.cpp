@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <thread>
+
+#include "stride_detect.h"
+#include "byte_histo.h"
+
+typedef std::complex<double> cplx_t;
+
+// The autocorrelation averages windows of this many bytes, at most max_windows of them spread evenly over the data.
+static const int window_n = 1 << 19;
+static const int max_windows = 4;
+
+// Pixel sizes of the formats ImageView decodes, and the lags the pixel size is judged by
+static const int pixel_sizes[] = {1, 2, 3, 4, 6, 8};
+static const int pixel_lags = 48;
+
+// Strides are searched from this many bytes, shorter periods are taken for pixels. A stride needs this many of its
+// multiples within the lags correlated, periods of the content of the image longer than the rows have fewer.
+static const int min_stride = 16;
+static const int n_harmonics = 3;
+
+// Pixel sizes scoring less are taken for noise, and strides scoring less than this many times the spread of the
+// correlation of random bytes.
+static const double min_pixel_score = .02;
+static const double noise_scores = 4;
+
+/// fft transforms a in place, a.size() a power of two.
+/// @param [in,out] a The data, replaced by its transform.
+/// @param [in] inverse Whether to transform back, without dividing by the size.
+static void fft(std::vector<cplx_t> &a, bool inverse) {
+    size_t n = a.size();
+
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+
+    std::vector<cplx_t> tw(n / 2);
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double ang = 2 * M_PI / double(len) * (inverse ? 1 : -1);
+        for (size_t k = 0; k < len / 2; k++) tw[k] = std::polar(1., ang * double(k));
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t k = 0; k < len / 2; k++) {
+                cplx_t u = a[i + k], v = a[i + k + len / 2] * tw[k];
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+            }
+        }
+    }
+}
+
+/// add_power adds the power spectrum of each of the windows, zero padded to twice their length so that lags do not
+/// wrap around, to spectrum.
+static void add_power(const unsigned char *dat, const std::vector<offset_t> &starts, int n,
+                      std::vector<double> &spectrum) {
+    std::vector<cplx_t> a(spectrum.size());
+    for (offset_t s : starts) {
+        double mean = 0;
+        for (int i = 0; i < n; i++) mean += dat[s + i];
+        mean /= n;
+
+        std::fill(a.begin(), a.end(), cplx_t(0));
+        for (int i = 0; i < n; i++) a[i] = dat[s + i] - mean;
+        fft(a, false);
+        for (size_t i = 0; i < a.size(); i++) spectrum[i] += std::norm(a[i]);
+    }
+}
+
+/// autocorrelation returns the correlation of the bytes of windows of dat with themselves k bytes later, for k from 0
+/// up to half the window. The windows are transformed on as many threads as there are processors.
+/// @param [in] dat Byte data.
+/// @param [in] n Length of dat in bytes.
+/// @param [out] used Number of bytes correlated.
+static std::vector<double> autocorrelation(const unsigned char *dat, offset_t n, offset_t &used) {
+    int wn = int(std::min(offset_t(window_n), n));
+    int n_windows = int(std::min(offset_t(max_windows), n / wn));
+    used = offset_t(wn) * n_windows;
+    size_t fft_n = 1;
+    while (fft_n < size_t(wn) * 2) fft_n <<= 1;
+
+    int n_threads = std::min(kernel_threads(), n_windows);
+    std::vector<std::vector<offset_t>> starts(n_threads);
+    for (int k = 0; k < n_windows; k++) {
+        offset_t s = n_windows > 1 ? (n - wn) / (n_windows - 1) * k : 0;
+        starts[k % n_threads].push_back(s);
+    }
+
+    std::vector<std::vector<double>> spectra(n_threads, std::vector<double>(fft_n, 0.));
+    std::vector<std::thread> threads;
+    for (int k = 1; k < n_threads; k++) {
+        threads.emplace_back(add_power, dat, std::cref(starts[k]), wn, std::ref(spectra[k]));
+    }
+    add_power(dat, starts[0], wn, spectra[0]);
+    for (auto &t : threads) t.join();
+
+    // By Wiener-Khinchin the autocorrelation is the inverse transform of the power spectrum
+    std::vector<cplx_t> a(fft_n);
+    for (size_t i = 0; i < fft_n; i++) {
+        double v = 0;
+        for (const auto &s : spectra) v += s[i];
+        a[i] = v;
+    }
+    fft(a, true);
+
+    // Fewer products are summed at longer lags
+    std::vector<double> rv(size_t(wn / 2) + 1);
+    double r0 = a[0].real() / wn;
+    for (size_t k = 0; k < rv.size(); k++) {
+        rv[k] = r0 > 0 ? a[k].real() / double(wn - k) / r0 : 0.;
+    }
+    return rv;
+}
+
+/// prominence returns how much more r[k] is than the mean of the lags one and two pixels either side of it, which
+/// hold the same byte of the pixel.
+static double prominence(const std::vector<double> &r, size_t k, size_t ps) {
+    if (k < 2 * ps || k + 2 * ps >= r.size()) return 0;
+    return r[k] - (r[k - 2 * ps] + r[k - ps] + r[k + ps] + r[k + 2 * ps]) / 4;
+}
+
+/// detect_stride proposes row lengths of an image held by dat. Rows of an image resemble the rows above them, so the
+/// bytes correlate at a lag of the row length and its multiples more than at the lags around them. Pixels of several
+/// bytes make the bytes correlate at multiples of the pixel size.
+/// @param [in] dat Byte data, the start of an image.
+/// @param [in] n Length of dat in bytes.
+/// @param [in] max_candidates The most candidates returned.
+/// @return The candidates, the most likely first.
+std::vector<stride_candidate_t> detect_stride(const unsigned char *dat, offset_t n, int max_candidates) {
+    std::vector<stride_candidate_t> rv;
+    if (dat == nullptr || n < min_stride * 4) return rv;
+
+    offset_t used = 0;
+    std::vector<double> r = autocorrelation(dat, n, used);
+
+    // Correlations of random bytes spread by about 1 / sqrt(used), a stride must stand out of that
+    double min_score = noise_scores / std::sqrt(double(used));
+
+    // Score each pixel size by how much more the bytes correlate at its multiples than at the other short lags
+    const int n_sizes = sizeof(pixel_sizes) / sizeof(pixel_sizes[0]);
+    double ps_score[n_sizes];
+    int base = 1;
+    for (int j = 0; j < n_sizes; j++) {
+        double on = 0, off = 0;
+        int n_on = 0, n_off = 0;
+        for (int k = 1; k <= pixel_lags && size_t(k) < r.size(); k++) {
+            if (k % pixel_sizes[j] == 0) {
+                on += r[k];
+                n_on++;
+            } else {
+                off += r[k];
+                n_off++;
+            }
+        }
+        ps_score[j] = n_on > 0 && n_off > 0 ? on / n_on - off / n_off : 0.;
+        if (ps_score[j] > min_pixel_score && ps_score[j] > ps_score[0]) {
+            base = pixel_sizes[j];
+            ps_score[0] = ps_score[j];
+        }
+    }
+    ps_score[0] = 0;
+
+    // Score each multiple of the pixel size that scores best by the prominence of its first multiples. Where channels
+    // correlate that may be a part of the pixel, the size of a candidate is chosen once its stride is known.
+    std::vector<std::pair<double, size_t>> strides;
+    size_t max_lag = r.size() - 1 - 2 * base;
+    for (size_t k = (min_stride + base - 1) / base * base; k * n_harmonics <= max_lag; k += base) {
+        double s = 0;
+        for (int m = 1; m <= n_harmonics; m++) s += prominence(r, k * m, base);
+        s /= n_harmonics;
+        if (s > min_score) strides.emplace_back(s, k);
+    }
+    std::sort(strides.begin(), strides.end(),
+              [](const std::pair<double, size_t> &a, const std::pair<double, size_t> &b) { return a.first > b.first; });
+
+    for (const auto &c : strides) {
+        if (int(rv.size()) >= max_candidates) break;
+
+        // Multiples of, and lags next to, a better stride are the same stride again
+        bool seen = false;
+        for (const auto &v : rv) {
+            offset_t k = offset_t(c.second);
+            seen |= k % v.stride <= 4 * base || v.stride - k % v.stride <= 4 * base;
+        }
+        if (seen) continue;
+
+        // The pixel size that fits the bytes best among those dividing the stride
+        int ps = 1;
+        double best = 0;
+        for (int j = 0; j < n_sizes; j++) {
+            if (c.second % pixel_sizes[j] == 0 && ps_score[j] > best) {
+                best = ps_score[j];
+                ps = pixel_sizes[j];
+            }
+        }
+        rv.push_back({offset_t(c.second), ps, c.first});
+    }
+    return rv;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STRIDE_DETECT_H_
+#define _STRIDE_DETECT_H_
+
+#include <vector>
+
+#include "offset.h"
+
+/// stride_candidate_t is a length of the rows of an image that data may hold.
+typedef struct {
+    offset_t stride;  // Bytes per row
+    int pixel_size;   // Bytes per pixel, a divisor of stride
+    double score;     // How much more the bytes correlate stride bytes apart than at the lags around it
+} stride_candidate_t;
+
+std::vector<stride_candidate_t> detect_stride(const unsigned char *dat, offset_t n, int max_candidates);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "virtual_scroll.h"
+
+using std::min;
+using std::max;
+
+// Largest value handed to a QScrollBar, well below INT_MAX to leave room for page steps.
+static const int max_scroll_value = 1 << 30;
+
+
+VirtualScroll::VirtualScroll()
+        : max_row_(0), n_visible_(1), max_value_(0) {
+}
+
+/// set_rows sets the total number of rows and the number of rows visible at a time.
+/// @param [in] n_rows Total number of rows in the document.
+/// @param [in] n_visible Number of rows shown at once.
+void VirtualScroll::set_rows(offset_t n_rows, offset_t n_visible) {
+    n_visible_ = max(offset_t(1), n_visible);
+    max_row_ = max(offset_t(0), n_rows - n_visible_ + 1);
+    max_value_ = int(min(max_row_, offset_t(max_scroll_value)));
+}
+
+offset_t VirtualScroll::max_row() const {
+    return max_row_;
+}
+
+int VirtualScroll::maximum() const {
+    return max_value_;
+}
+
+int VirtualScroll::page_step() const {
+    offset_t page = max(offset_t(16), n_visible_ - 2);
+    if (max_row_ > max_value_) {
+        page = page * max_value_ / max_row_;
+    }
+    return int(max(offset_t(1), min(page, offset_t(max_value_))));
+}
+
+/// row_for_value converts a scroll bar position to the first visible row.
+offset_t VirtualScroll::row_for_value(int value) const {
+    if (max_row_ == max_value_) return value;
+    if (value >= max_value_) return max_row_;
+    return offset_t(std::floor(value / double(max_value_) * max_row_));
+}
+
+/// value_for_row converts the first visible row to the nearest scroll bar position.
+int VirtualScroll::value_for_row(offset_t row) const {
+    row = clamp_row(row);
+    if (max_row_ == max_value_) return int(row);
+    return int(std::lround(row / double(max_row_) * max_value_));
+}
+
+offset_t VirtualScroll::clamp_row(offset_t row) const {
+    return max(offset_t(0), min(row, max_row_));
+}
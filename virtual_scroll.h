@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VIRTUAL_SCROLL_H_
+#define _VIRTUAL_SCROLL_H_
+
+#include "offset.h"
+
+/// VirtualScroll maps a 64-bit range of rows onto the int range of a QScrollBar.
+/// When the number of rows fits within the scroll bar the mapping is the identity, otherwise each scroll bar step
+/// covers several rows and the current row is tracked separately so that fine grained movement is not lost.
+class VirtualScroll {
+public:
+    VirtualScroll();
+
+    void set_rows(offset_t n_rows, offset_t n_visible);
+
+    offset_t max_row() const;
+
+    int maximum() const;
+
+    int page_step() const;
+
+    offset_t row_for_value(int value) const;
+
+    int value_for_row(offset_t row) const;
+
+    offset_t clamp_row(offset_t row) const;
+
+protected:
+    offset_t max_row_;
+    offset_t n_visible_;
+    int max_value_;
+};
+
+#endif
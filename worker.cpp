@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QMetaObject>
+
+#include "worker.h"
+
+
+Worker::Worker(QObject *p)
+        : QObject(p), gen_(0) {
+    // Queued calls on context_ execute in the event loop of thread_
+    context_ = new QObject;
+    context_->moveToThread(&thread_);
+    connect(&thread_, SIGNAL(finished()), context_, SLOT(deleteLater()));
+    thread_.start();
+}
+
+Worker::~Worker() {
+    cancel();
+    thread_.quit();
+    thread_.wait();
+}
+
+/// restart cancels all outstanding work and begins a new generation.
+/// @return The new generation, to be passed to post() and deliver().
+int Worker::restart() {
+    return ++gen_;
+}
+
+void Worker::cancel() {
+    ++gen_;
+}
+
+/// join blocks until the tasks posted so far have finished or been skipped. Preceded by cancel(), it returns once the
+/// running task has noticed and none of them touches its inputs any longer.
+void Worker::join() {
+    QMetaObject::invokeMethod(context_, [] {}, Qt::BlockingQueuedConnection);
+}
+
+/// cancelled may be polled from within a task to stop early once its results are no longer wanted.
+/// @param [in] gen The generation of the task.
+/// @return True if a newer generation has been started.
+bool Worker::cancelled(int gen) const {
+    return gen != gen_;
+}
+
+/// post queues compute to run on the background thread, it is skipped if gen is cancelled before it starts.
+void Worker::post(int gen, const task_t &compute) {
+    QMetaObject::invokeMethod(context_, [this, gen, compute] {
+        if (!cancelled(gen)) compute();
+    }, Qt::QueuedConnection);
+}
+
+/// deliver queues apply to run on the thread owning the Worker, typically the GUI thread. Called from within a
+/// task to hand over results, apply is dropped if gen has been cancelled in the meantime.
+void Worker::deliver(int gen, const task_t &apply) {
+    QMetaObject::invokeMethod(this, [this, gen, apply] {
+        if (!cancelled(gen)) apply();
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2015, 2017, 2020 Kent A. Vander Velden, kent.vandervelden@gmail.com
+ *
+ * This file is part of BinVis.
+ *
+ *     BinVis is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     BinVis is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with BinVis.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <atomic>
+#include <functional>
+
+#include <QObject>
+#include <QThread>
+
+/// Worker runs tasks in order on a background thread and hands results back to the thread that owns the Worker.
+/// Work is grouped into generations, starting a new generation cancels all queued and unfinished work of older ones.
+class Worker : public QObject {
+Q_OBJECT
+public:
+    typedef std::function<void()> task_t;
+
+    explicit Worker(QObject *p = nullptr);
+
+    ~Worker() override;
+
+    int restart();
+
+    void cancel();
+
+    void join();
+
+    bool cancelled(int gen) const;
+
+    void post(int gen, const task_t &compute);
+
+    void deliver(int gen, const task_t &apply);
+
+protected:
+    QThread thread_;
+    QObject *context_;
+    std::atomic<int> gen_;
+};
+
+#endif